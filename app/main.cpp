@@ -5,7 +5,17 @@
 #include <cstring>
 #include <iostream>
 #include <utility>
+#include <algorithm>
 #include <memory>
+#include <vector>
+
+#ifndef _WIN32
+#define NITRO_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -22,7 +32,17 @@ typedef uint64_t u64;
  * 	- output file name
  * nitro has 1 one optional:
  * 	- optional flag of compressions method (default being block, -b) only valid if compressing (otherwise ignored)
+ * 	  -p selects the chunked block format which is encoded and decoded on all cores
+ * 	  -s selects the streaming format which is processed with a fixed memory budget
+ *
+ * A file name of - means stdin/stdout. Piped data is always processed with the streaming
+ * API (reports go to stderr then), just like decompressing a file holding a STREAM frame.
  *
+ * -g PATTERN FILE prints the offset of every match of PATTERN in the original data,
+ * block encoded files are searched without decompressing them.
+ *
+ * -D DICT (after the file names) compresses/decompresses against a dictionary trained with
+ * nitro --train DICT SAMPLE... where every line of the sample files is one sample record.
  */
 
 struct cmd_args
@@ -31,22 +51,41 @@ struct cmd_args
 	const char* infile;
 	const char* outfile;
 	NitroEncoderType encode_method {BLOCK};
+	const char* dictionary {nullptr};
 };
 
 void abort_nitro()
 {
-	printf("Aborting\n");
+	fprintf(stderr, "Aborting\n");
 	exit(-1);
 }
 
 void print_help()
 {
 	printf("Usage:   nitro [-cx] [FILE] [FILE]\n");
+	printf("         nitro --train DICT SAMPLE...\n");
+	printf("         nitro -g PATTERN FILE\n");
 	printf("Example: nitro -c genome.txt compressed.bin\n");
 	printf("         nitro -x compressed.bin genome.txt\n");
+	printf("         cat genome.txt | nitro -c - - > compressed.bin\n");
+	printf("         nitro --train events.dict sample.jsonl && nitro -c event.json event.bin -D events.dict\n");
+	printf("         nitro -g GATTACA compressed.bin\n");
 	printf("Flags:\n");
 	printf("  -c	 compress\n");
 	printf("  -x	 decompress\n");
+	printf("  -g	 print the offsets of PATTERN in the compressed FILE (block types searched packed)\n");
+	printf("Compression methods (optional, after the file names):\n");
+	printf("  -b	 block encoding (default)\n");
+	printf("  -p	 chunked block encoding, parallel on all cores\n");
+	printf("  -s	 streaming block encoding, fixed memory use (implied when a FILE is -)\n");
+	printf("  -r	 range coding (order-0 entropy coder)\n");
+	printf("  -a	 interleaved rANS (order-0 entropy coder, fast decoding)\n");
+	printf("  -h	 canonical Huffman coding\n");
+	printf("  -o	 automatic: the smallest of the above for every 1 MiB chunk\n");
+	printf("  -l	 run length pre-pass (long N runs, homopolymers), then automatic\n");
+	printf("  -d	 nucleotides: A, C, G, T at 2 bits, other symbols listed apart\n");
+	printf("  -z	 LZ77: long repeats (logs, configs, general data)\n");
+	printf("  -D DICT LZ77 against a dictionary from --train (small records), also to decompress\n");
 }
 
 bool parse_cmd_args(int argc, char** argv, cmd_args& cmd)
@@ -67,15 +106,50 @@ bool parse_cmd_args(int argc, char** argv, cmd_args& cmd)
 	cmd.infile = cp;
 	cp = *(argv++);
 	cmd.outfile = cp;
-	// parse compress method
-	if(argc > 3 && cmd.compress) {
+	// parse compress method and dictionary
+	for(int i = 3; i < argc; i++, argv++) {
 		if(strnlen(*argv, 2) < 2)
 			return false;
 		char method = (*argv)[1];
+		if(method == 'D') {
+			if(++i == argc)
+				return false;
+			cmd.dictionary = *++argv;
+			continue;
+		}
+		if(!cmd.compress)
+			continue;
 		switch(method) {
 		case 'b':
 			cmd.encode_method = NitroEncoderType::BLOCK;
 			break;
+		case 'p':
+			cmd.encode_method = NitroEncoderType::BLOCK_CHUNKED;
+			break;
+		case 's':
+			cmd.encode_method = NitroEncoderType::STREAM;
+			break;
+		case 'r':
+			cmd.encode_method = NitroEncoderType::RANGE;
+			break;
+		case 'a':
+			cmd.encode_method = NitroEncoderType::RANS;
+			break;
+		case 'h':
+			cmd.encode_method = NitroEncoderType::HUFFMAN;
+			break;
+		case 'o':
+			cmd.encode_method = NitroEncoderType::AUTO;
+			break;
+		case 'l':
+			cmd.encode_method = NitroEncoderType::RLE;
+			break;
+		case 'd':
+			cmd.encode_method = NitroEncoderType::DNA;
+			break;
+		case 'z':
+			cmd.encode_method = NitroEncoderType::LZ;
+			break;
 		default:
 			printf("Unsupported compression method.\n");
 			break;
@@ -84,24 +158,72 @@ bool parse_cmd_args(int argc, char** argv, cmd_args& cmd)
 	return true;
 }
 
-void emit_statistics(const NitroData& nitrodata, u64 original_length)
+void emit_statistics(const NitroData& nitrodata, u64 original_length, FILE* out = stdout)
 {
 	const char* method;
 	switch(nitrodata.enctype) {
 	case BLOCK:
 		method = "BLOCK";
 		break;
+	case BLOCK_CHUNKED:
+		method = "BLOCK_CHUNKED";
+		break;
+	case STREAM:
+		method = "STREAM";
+		break;
+	case RANGE:
+		method = "RANGE";
+		break;
+	case RANS:
+		method = "RANS";
+		break;
+	case HUFFMAN:
+		method = "HUFFMAN";
+		break;
+	case RAW:
+		method = "RAW";
+		break;
+	case RLE:
+		method = "RLE";
+		break;
+	case DNA:
+		method = "DNA";
+		break;
+	case LZ:
+		method = "LZ";
+		break;
+	case DICT:
+		method = "DICT";
+		break;
 	default:
 		method = "N/A";
 		break;
 	}
 	double ratio = ((double)nitrodata.len) / original_length;
-	printf("--------------------------------------\n");
-	printf("Compression statistics:\n");
-	printf("Method: %s\n", method);
-	printf("Bytes written: %llu\n", nitrodata.len);
-	printf("Compressed/Original Ratio: %.1f%%\n", 100.0 * ratio);
-	printf("--------------------------------------\n");
+	fprintf(out, "--------------------------------------\n");
+	fprintf(out, "Compression statistics:\n");
+	fprintf(out, "Method: %s\n", method);
+	fprintf(out, "Bytes written: %llu\n", nitrodata.len);
+	fprintf(out, "Compressed/Original Ratio: %.1f%%\n", 100.0 * ratio);
+	fprintf(out, "--------------------------------------\n");
+}
+
+// per stage timing of the last library call (NITRO_OPTION_STATS)
+void emit_stage_statistics(FILE* out = stdout)
+{
+	NitroStats stats;
+	if (!nitro_get_last_stats(&stats) || !stats.total_ns)
+		return;
+	auto ms = [](u64 ns) { return ns / 1e6; };
+	fprintf(out, "Stages (ms): model %.3f, alloc %.3f, header %.3f, code %.3f, total %.3f\n",
+		ms(stats.model_ns), ms(stats.alloc_ns), ms(stats.header_ns), ms(stats.code_ns), ms(stats.total_ns));
+	fprintf(out, "Bytes in/out: %llu/%llu\n", (unsigned long long)stats.bytes_in, (unsigned long long)stats.bytes_out);
+	if (stats.bits_per_block)
+		fprintf(out, "Bits per symbol: %u\n", stats.bits_per_block);
+	fprintf(out, "Allocations: %u\n", stats.allocations);
+	u64 original = std::max(stats.bytes_in, stats.bytes_out);	// throughput counts the uncompressed side
+	fprintf(out, "Throughput: %.1f MB/s\n", original * 1e3 / stats.total_ns);
+	fprintf(out, "--------------------------------------\n");
 }
 
 pair<unique_ptr<u8>, u64>  read_file(const char* filename)
@@ -149,23 +271,166 @@ bool write_file(const char* filename, u8* data, u64 len)
 	return true;
 }
 
-pair<unique_ptr<u8>, u64> read_data(const char* filename)
+/*
+ * Contents of the input file
+ * The file is memory mapped read only where possible (no copy, the page cache is the buffer),
+ * otherwise it is read into a heap buffer.
+ */
+class InputData
+{
+public:
+	~InputData()
+	{
+#ifdef NITRO_MMAP
+		if (_mapping)
+			munmap(_mapping, _len);
+#endif
+	}
+	bool load(const char* filename)
+	{
+		if (map(filename))
+			return true;
+		auto contents = read_file(filename);
+		_buffer = move(contents.first);
+		_data = _buffer.get();
+		_len = contents.second;
+		return _data != nullptr;
+	}
+	const u8*	get() const { return _data; }
+	u64			size() const { return _len; }
+
+private:
+	bool map(const char* filename)
+	{
+#ifdef NITRO_MMAP
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED) {
+				madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+				_mapping = mapping;
+				_data = (const u8*)mapping;
+				_len = st.st_size;
+			}
+		}
+		close(fd);	// the mapping stays valid
+		if (_mapping)
+			printf("Mapped input file: %s\n", filename);
+		return _mapping != nullptr;
+#else
+		(void)filename;
+		return false;
+#endif
+	}
+
+	const u8*		_data{ nullptr };
+	u64				_len{ 0 };
+	void*			_mapping{ nullptr };
+	unique_ptr<u8>	_buffer;
+};
+
+/*
+ * Output file created with its final size and written through a shared mapping
+ * so the result goes straight into the page cache. create returns nullptr where
+ * mapping is not possible - fall back to write_file then. discard removes the
+ * file again when the result turns out to be unusable.
+ */
+class OutputMapping
 {
-	auto contents = read_file(filename);
-	if(!contents.first){  	// if pointer to data is null - exit
+public:
+	~OutputMapping() { finish(_len); }
+	u8* create(const char* filename, u64 len)
+	{
+#ifdef NITRO_MMAP
+		_fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (_fd < 0)
+			return nullptr;
+		_filename = filename;
+		if (len && ftruncate(_fd, len) == 0) {
+			void* mapping = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+			if (mapping != MAP_FAILED) {
+				_mapping = (u8*)mapping;
+				_len = len;
+				return _mapping;
+			}
+		}
+		discard();
+#else
+		(void)filename;
+		(void)len;
+#endif
+		return nullptr;
+	}
+	// unmaps and removes the file, nothing is left behind of a failed run
+	void discard()
+	{
+#ifdef NITRO_MMAP
+		finish(0);
+		if (_filename)
+			unlink(_filename);
+		_filename = nullptr;
+#endif
+	}
+	// unmaps and cuts the file to the number of bytes actually written
+	bool finish(u64 written)
+	{
+		bool good = true;
+#ifdef NITRO_MMAP
+		if (_mapping)
+			munmap(_mapping, _len);
+		if (_fd >= 0) {
+			good = written == _len || ftruncate(_fd, written) == 0;
+			good = (close(_fd) == 0) && good;
+		}
+		_mapping = nullptr;
+		_fd = -1;
+#else
+		(void)written;
+#endif
+		return good;
+	}
+
+private:
+	u8*			_mapping{ nullptr };
+	u64			_len{ 0 };
+	int			_fd{ -1 };
+	const char*	_filename{ nullptr };
+};
+
+void read_data(const char* filename, InputData& contents)
+{
+	if(!contents.load(filename)){  	// if pointer to data is null - exit
 		fprintf(stderr, "Error during reading file: %s\n", filename);
 		abort_nitro();
 	}
-	return contents;
 }
 
 void compress(const char* infile_name, const char* outfile_name, NitroEncoderType method)
 {
-	auto contents = read_data(infile_name);
-	auto& data = contents.first;
-	auto& len = contents.second;
+	InputData data;
+	read_data(infile_name, data);
+	u64 len = data.size();
 
 	printf("Compressing...\n");
+	// encode straight into the mapped output file (sized for the worst case, cut to size after)
+	OutputMapping mapping;
+	u8* out = mapping.create(outfile_name, nitro_compress_bound(len, method));
+	if (out) {
+		NitroData result = nitro_compress_into(data.get(), len, method, out, nitro_compress_bound(len, method));
+		bool good = result.data && mapping.finish(result.len);
+		if(good) {
+			emit_statistics(result, len);
+			emit_stage_statistics();
+		}
+		else {
+			mapping.discard();
+			fprintf(stderr, "Failed compression. Output file will not be written\n");
+		}
+		return;
+	}
 	NitroData result = nitro_compress(data.get(), len, method);
 	bool good = false;
 	if(result.data && result.len) {
@@ -175,17 +440,32 @@ void compress(const char* infile_name, const char* outfile_name, NitroEncoderTyp
 		fprintf(stderr, "Failed compression. Output file will not be written\n");
 	}
 	free(result.data);		// need to use free to deallocate the memory returned from nitro library
-	if(good)
+	if(good) {
 		emit_statistics(result, len);
+		emit_stage_statistics();
+	}
 }
 
 void decompress(const char* infile_name, const char* outfile_name)
 {
-	auto contents = read_data(infile_name);
-	auto& data = contents.first;
-	auto& len = contents.second;
+	InputData data;
+	read_data(infile_name, data);
 	printf("Decompressing...\n");
-	NitroData result = nitro_decompress(data.get(), len);
+	// decode straight into the mapped output file created with the final size
+	OutputMapping mapping;
+	u64 size = nitro_decompressed_size(data.get(), data.size());
+	u8* out = size ? mapping.create(outfile_name, size) : nullptr;
+	if (out) {
+		NitroData result = nitro_decompress_into(data.get(), data.size(), out, size);
+		if(!result.data || !mapping.finish(result.len)) {
+			mapping.discard();
+			fprintf(stderr, "Failed decompression. Output file will not be written\n");
+		}
+		else
+			emit_stage_statistics();
+		return;
+	}
+	NitroData result = nitro_decompress(data.get(), data.size());
 	bool good = false;
 	if(result.data && result.len) {
 		good = write_file(outfile_name, result.data, result.len);
@@ -194,20 +474,201 @@ void decompress(const char* infile_name, const char* outfile_name)
 		fprintf(stderr, "Failed compression. Output file will not be written\n");
 	}
 	free(result.data);		// need to use free to deallocate the memory returned from nitro library
+	if(good)
+		emit_stage_statistics();
+}
+
+/*
+ * Trains a dictionary on the lines of the sample files (the records must outlive training,
+ * so the files stay loaded until the dictionary is written)
+ */
+void train_dictionary(const char* outfile_name, int count, char** sample_names)
+{
+	vector<unique_ptr<InputData>> files;
+	vector<NitroBuffer> samples;
+	for (int i = 0; i < count; i++) {
+		files.push_back(make_unique<InputData>());
+		read_data(sample_names[i], *files.back());
+		const u8* p = files.back()->get();
+		const u8* end = p + files.back()->size();
+		while (p < end) {
+			const u8* line_end = (const u8*)memchr(p, '\n', end - p);
+			if (!line_end)
+				line_end = end;
+			if (line_end > p)
+				samples.push_back(NitroBuffer{ p, (u64)(line_end - p) });
+			p = line_end + 1;
+		}
+	}
+	printf("Training on %llu samples...\n", (unsigned long long)samples.size());
+	NitroData dict = nitro_train_dictionary(samples.data(), samples.size(), 0);
+	if (!dict.data || !write_file(outfile_name, dict.data, dict.len)) {
+		fprintf(stderr, "Failed to train the dictionary.\n");
+		free(dict.data);
+		abort_nitro();
+	}
+	printf("Dictionary size: %llu\n", (unsigned long long)dict.len);
+	free(dict.data);
+}
+
+/* compresses (DICT frame) or decompresses through a context with the dictionary loaded */
+void process_with_dictionary(const char* infile_name, const char* outfile_name, const char* dictionary_name, bool compress)
+{
+	InputData dictionary, data;
+	read_data(dictionary_name, dictionary);
+	read_data(infile_name, data);
+	NitroContext* ctx = nitro_context_create();
+	if (!ctx || !nitro_context_load_dictionary(ctx, dictionary.get(), dictionary.size())) {
+		fprintf(stderr, "Failed to load the dictionary: %s\n", dictionary_name);
+		nitro_context_free(ctx);
+		abort_nitro();
+	}
+	printf(compress ? "Compressing...\n" : "Decompressing...\n");
+	NitroData result = compress ? nitro_context_compress(ctx, data.get(), data.size())
+								: nitro_context_decompress(ctx, data.get(), data.size());
+	bool good = result.data && write_file(outfile_name, result.data, result.len);	// the result lives in the context
+	if (!good)
+		fprintf(stderr, "Failed %s.\n", compress ? "compression" : "decompression");
+	else if (compress)
+		emit_statistics(result, data.size());
+	nitro_context_free(ctx);
+	if (good)
+		emit_stage_statistics();
+}
+
+int print_match(uint64_t position, void*)
+{
+	printf("%llu\n", (unsigned long long)position);
+	return 1;
+}
+
+void search(const char* pattern, const char* infile_name)
+{
+	InputData data;
+	if(!data.load(infile_name)) {
+		fprintf(stderr, "Error during reading file: %s\n", infile_name);
+		abort_nitro();
+	}
+	int64_t matches = nitro_search(data.get(), data.size(), (const u8*)pattern, strlen(pattern), print_match, nullptr);
+	if (matches < 0) {
+		fprintf(stderr, "Failed search.\n");
+		abort_nitro();
+	}
+	fprintf(stderr, "Matches: %lld\n", (long long)matches);
+}
+
+bool is_stdio(const char* filename)
+{
+	return strcmp(filename, "-") == 0;
+}
+
+bool is_stream_file(const char* filename)
+{
+	ifstream infile(filename, ifstream::in | ifstream::binary);
+	return infile.is_open() && infile.get() == NitroEncoderType::STREAM;
+}
+
+/*
+ * Pumps the input through a nitro stream with fixed size buffers
+ * Returns the number of bytes written or -1 on failure.
+ */
+int64_t pump_stream(NitroStream* stream, FILE* in, FILE* out)
+{
+	const u64 buffer_size = 1 << 20;
+	unique_ptr<u8[]> inbuf { new u8[buffer_size] };
+	unique_ptr<u8[]> outbuf { new u8[buffer_size] };
+	u64 total = 0;
+	u64 consumed, written;
+	NitroStreamStatus status;
+	size_t len;
+	while ((len = fread(inbuf.get(), 1, buffer_size, in)) > 0) {
+		u8* p = inbuf.get();
+		do {
+			status = nitro_stream_update(stream, p, len, &consumed, outbuf.get(), buffer_size, &written);
+			if (status == NITRO_STREAM_ERROR || fwrite(outbuf.get(), 1, written, out) != written)
+				return -1;
+			p += consumed;
+			len -= consumed;
+			total += written;
+		} while (status == NITRO_STREAM_OUTPUT_FULL);
+	}
+	if (ferror(in))
+		return -1;
+	do {
+		status = nitro_stream_finish(stream, outbuf.get(), buffer_size, &written);
+		if (status == NITRO_STREAM_ERROR || fwrite(outbuf.get(), 1, written, out) != written)
+			return -1;
+		total += written;
+	} while (status != NITRO_STREAM_END);
+	return total;
+}
+
+void process_stream(const char* infile_name, const char* outfile_name, bool compress)
+{
+	FILE* in = is_stdio(infile_name) ? stdin : fopen(infile_name, "rb");
+	if (!in) {
+		fprintf(stderr, "Failed to open input file: %s\n", infile_name);
+		abort_nitro();
+	}
+	FILE* out = is_stdio(outfile_name) ? stdout : fopen(outfile_name, "wb");
+	if (!out) {
+		fprintf(stderr, "Failed to open file to write results: %s\n", outfile_name);
+		abort_nitro();
+	}
+	fprintf(stderr, compress ? "Compressing (streaming)...\n" : "Decompressing (streaming)...\n");
+	NitroStream* stream = nitro_stream_init(compress ? NITRO_STREAM_COMPRESS : NITRO_STREAM_DECOMPRESS, 0);
+	int64_t written = stream ? pump_stream(stream, in, out) : -1;
+	nitro_stream_free(stream);
+	u64 read = (in != stdin) ? ftell(in) : 0;
+	if (in != stdin)
+		fclose(in);
+	if (out != stdout)
+		fclose(out);
+	else
+		fflush(out);
+	if (written < 0) {
+		fprintf(stderr, "Failed %s.\n", compress ? "compression" : "decompression");
+		abort_nitro();
+	}
+	if (compress && in != stdin)
+		emit_statistics(NitroData{ nullptr, (u64)written, STREAM }, read, stderr);
 }
 
 int main(int argc, char** argv)
 {
 	cmd_args cmd;
+	if(argc > 3 && strcmp(argv[1], "--train") == 0) {
+		train_dictionary(argv[2], argc - 3, argv + 3);
+		return 0;
+	}
+	if(argc == 4 && strcmp(argv[1], "-g") == 0 && *argv[2]) {
+		search(argv[2], argv[3]);
+		return 0;
+	}
 	if(!parse_cmd_args(argc - 1, argv + 1, cmd)) {
 		print_help();
 		exit(-1);
 	}
-	if(cmd.compress) {
-		compress(cmd.infile, cmd.outfile, cmd.encode_method);
+	bool piped = is_stdio(cmd.infile) || is_stdio(cmd.outfile);
+	nitro_set_option(NITRO_OPTION_STATS, 1);
+	if(cmd.dictionary) {
+		if(piped) {
+			fprintf(stderr, "A dictionary needs file names, not -.\n");
+			abort_nitro();
+		}
+		process_with_dictionary(cmd.infile, cmd.outfile, cmd.dictionary, cmd.compress);
+	}
+	else if(cmd.compress) {
+		if(piped || cmd.encode_method == NitroEncoderType::STREAM)
+			process_stream(cmd.infile, cmd.outfile, true);
+		else
+			compress(cmd.infile, cmd.outfile, cmd.encode_method);
 	}
 	else {
-		decompress(cmd.infile, cmd.outfile);
+		if(piped || is_stream_file(cmd.infile))
+			process_stream(cmd.infile, cmd.outfile, false);
+		else
+			decompress(cmd.infile, cmd.outfile);
 	}
     return 0;
 }
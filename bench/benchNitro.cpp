@@ -0,0 +1,172 @@
+#include <benchmark/benchmark.h>
+#include <nitro/nitro.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Throughput benchmarks
+ *
+ *	- every alphabet size 1..256 (1 MiB, BLOCK)
+ *	- input sizes 100 B .. 1 GiB for every encoder type (1 GiB for the block types only)
+ *	- corpus files given on the command line (e.g. a genome from python/generate.py --genome)
+ *
+ * Every benchmark reports the input MB/s (bytes_per_second) and the
+ * compressed/original ratio. Run it through run_bench.sh for the JSON output.
+ */
+
+using namespace std;
+
+typedef uint8_t u8;
+typedef uint64_t u64;
+
+static const NitroEncoderType all_types[] = {
+	BLOCK, BLOCK_CHUNKED, STREAM, RANGE, RANS, HUFFMAN, AUTO, RLE, DNA, LZ
+};
+
+static const char* type_name(NitroEncoderType type)
+{
+	switch (type) {
+	case BLOCK: return "BLOCK";
+	case BLOCK_CHUNKED: return "BLOCK_CHUNKED";
+	case STREAM: return "STREAM";
+	case RANGE: return "RANGE";
+	case RANS: return "RANS";
+	case HUFFMAN: return "HUFFMAN";
+	case AUTO: return "AUTO";
+	case RLE: return "RLE";
+	case DNA: return "DNA";
+	case LZ: return "LZ";
+	default: return "N/A";
+	}
+}
+
+// uniform random input over the first symbols of a letter first alphabet, cached per (symbols, size)
+static const vector<u8>& input(unsigned symbols, u64 size)
+{
+	static map<pair<unsigned, u64>, vector<u8>> cache;
+	auto& text = cache[{ symbols, size }];
+	if (text.empty()) {
+		vector<u8> alphabet;
+		for (const char* p = "ACGTNRYKMSWBDHV"; *p && alphabet.size() < symbols; p++)
+			alphabet.push_back((u8)*p);
+		for (unsigned sym = 0; alphabet.size() < symbols; sym++) {
+			if (!memchr(alphabet.data(), sym, alphabet.size()))
+				alphabet.push_back((u8)sym);
+		}
+		mt19937_64 rng(symbols * 7919 + size);
+		text.resize(size);
+		for (auto& c : text)
+			c = alphabet[rng() % symbols];
+	}
+	return text;
+}
+
+static void compress(benchmark::State& state, const vector<u8>& text, NitroEncoderType type)
+{
+	u64 encoded_len = 0;
+	for (auto _ : state) {
+		NitroData enc = nitro_compress(text.data(), text.size(), type);
+		if (!enc.data) {
+			state.SkipWithError("compression failed");
+			break;
+		}
+		encoded_len = enc.len;
+		free(enc.data);
+	}
+	state.SetBytesProcessed((int64_t)(state.iterations() * text.size()));
+	state.counters["ratio"] = (double)encoded_len / text.size();
+}
+
+static void decompress(benchmark::State& state, const vector<u8>& text, NitroEncoderType type)
+{
+	NitroData enc = nitro_compress(text.data(), text.size(), type);
+	if (!enc.data) {
+		state.SkipWithError("compression failed");
+		return;
+	}
+	for (auto _ : state) {
+		NitroData dec = nitro_decompress(enc.data, enc.len);
+		if (dec.len != text.size()) {
+			state.SkipWithError("decompression failed");
+			free(dec.data);
+			break;
+		}
+		free(dec.data);
+	}
+	state.SetBytesProcessed((int64_t)(state.iterations() * text.size()));
+	state.counters["ratio"] = (double)enc.len / text.size();
+	free(enc.data);
+}
+
+static void register_synthetic()
+{
+	for (unsigned symbols = 1; symbols <= 256; symbols++) {
+		string name = "alphabet/BLOCK/" + to_string(symbols);
+		benchmark::RegisterBenchmark(("compress/" + name).c_str(), [symbols](benchmark::State& state) {
+			compress(state, input(symbols, 1 << 20), BLOCK);
+		})->Unit(benchmark::kMillisecond);
+		benchmark::RegisterBenchmark(("decompress/" + name).c_str(), [symbols](benchmark::State& state) {
+			decompress(state, input(symbols, 1 << 20), BLOCK);
+		})->Unit(benchmark::kMillisecond);
+	}
+	const u64 sizes[] = { 100, 10000, 1 << 20, 100 << 20, 1ull << 30 };
+	for (auto type : all_types) {
+		for (u64 size : sizes) {
+			if (size > (100 << 20) && type != BLOCK && type != BLOCK_CHUNKED)
+				continue;
+			string name = string("size/") + type_name(type) + "/" + to_string(size);
+			benchmark::RegisterBenchmark(("compress/" + name).c_str(), [type, size](benchmark::State& state) {
+				compress(state, input(4, size), type);
+			})->Unit(benchmark::kMillisecond);
+			benchmark::RegisterBenchmark(("decompress/" + name).c_str(), [type, size](benchmark::State& state) {
+				decompress(state, input(4, size), type);
+			})->Unit(benchmark::kMillisecond);
+		}
+	}
+}
+
+static void register_corpus(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Can not open corpus %s\n", path);
+		return;
+	}
+	auto text = make_shared<vector<u8>>();
+	u8 buffer[1 << 16];
+	while (size_t n = fread(buffer, 1, sizeof(buffer), file))
+		text->insert(text->end(), buffer, buffer + n);
+	fclose(file);
+	if (text->empty())
+		return;
+	string base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	for (auto type : all_types) {
+		string name = "corpus/" + base + "/" + type_name(type);
+		benchmark::RegisterBenchmark(("compress/" + name).c_str(), [text, type](benchmark::State& state) {
+			compress(state, *text, type);
+		})->Unit(benchmark::kMillisecond);
+		benchmark::RegisterBenchmark(("decompress/" + name).c_str(), [text, type](benchmark::State& state) {
+			decompress(state, *text, type);
+		})->Unit(benchmark::kMillisecond);
+	}
+}
+
+// benchNitro [benchmark flags] [CORPUS_FILE...]
+int main(int argc, char** argv)
+{
+	benchmark::Initialize(&argc, argv);
+	register_synthetic();
+	for (int i = 1; i < argc; i++)
+		register_corpus(argv[i]);
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
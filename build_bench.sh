@@ -0,0 +1,6 @@
+
+CC_PARAMS='-O2 -std=c++17 -Wall -Wextra -g'
+INCLUDE='./nitro/include'
+
+# build benchmark driver
+g++ $CC_PARAMS bench/benchNitro.cpp -o ./bin/benchNitro -I$INCLUDE -L./lib/ -lnitro -lbenchmark -lpthread -Wl,-rpath=/lib
@@ -0,0 +1,446 @@
+#pragma once
+
+#include "common.hpp"
+#include "bitpack.hpp"
+#include "decoder.hpp"
+#include "stream.hpp"
+#include "raw.hpp"
+#include "dna.hpp"
+#include "histogram.hpp"
+#include "rank.hpp"
+#include "search.hpp"
+
+#include <algorithm>
+#include <array>
+
+/*
+ * Random access into encoded data (nitro_open and friends)
+ *
+ * Block encoded data uses the same number of bits for every symbol so the
+ * position of symbol i is i * bits_per_block. The handle parses the metadata once
+ * and keeps one piece per independently packed region (the whole BLOCK frame,
+ * every chunk of a chunked frame, every segment of a stream) together with the
+ * flat code -> symbol table of that region.
+ * Pieces of equal size (chunks, segments) are found in constant time,
+ * otherwise by binary search.
+ * DNA frames are width 2 pieces plus their exception runs: a symbol is the
+ * packed base unless a run (found by binary search) covers it.
+ *
+ * rank (occurrences of a symbol before a position) and select (position of the
+ * k-th occurrence) count codes straight in the packed data (rank.hpp). The optional
+ * index (build_index) holds the cumulative count of every symbol of the data at
+ * every superblock boundary, so a query scans at most one superblock after a
+ * lookup (rank) or a binary search (select). A superblock has at least 512
+ * symbols per indexed symbol, the index costs at most 1/64 byte per symbol.
+ *
+ * search translates the pattern into the codes of every piece and matches them in
+ * the packed data (search.hpp). Matches crossing a piece boundary, patterns with a
+ * symbol only the exception list of a DNA piece holds and the candidates of such a
+ * piece overlapping an exception run are checked on decoded symbols.
+ */
+struct NitroHandle
+{
+public:
+	NitroHandle(const u8* encoded, u64 len)
+	{
+		add_frame(encoded, len, true);	// throws
+		// index / piece size finds the piece only if no piece but the last is shorter
+		_uniform = _pieces.empty() || _pieces.back().count <= _pieces[0].count;
+		for (u64 i = 0; i + 1 < _pieces.size(); i++)
+			_uniform = _uniform && _pieces[i].count == _pieces[0].count;
+		_piece_size = _pieces.empty() ? 0 : _pieces[0].count;
+		add_codes();
+	}
+
+	u64	size() const { return _size; }
+
+	void build_index()
+	{
+		_slots.fill(no_slot);
+		_slot_count = 0;
+		auto add_slot = [this](u8 sym) {
+			if (_slots[sym] == no_slot)
+				_slots[sym] = (u16)_slot_count++;
+		};
+		for (const auto& piece : _pieces) {
+			for (unsigned code = 0; code < (1u << piece.width); code++)
+				add_slot(_tables[piece.table][code]);
+			if (piece.exceptions != no_exceptions) {
+				for (const auto& run : _exceptions[piece.exceptions])
+					add_slot(run.symbol);
+			}
+		}
+		_superblock = 4096;
+		while (_superblock < 512 * _slot_count)
+			_superblock *= 2;
+		u64 blocks = (_size + _superblock - 1) / _superblock;
+		_ranks.assign((blocks + 1) * _slot_count, 0);
+		vector<u8> buffer(std::min(_superblock, _size));
+		u64 counts[256] = { 0 };
+		for (u64 block = 0; block < blocks; block++) {
+			u64 first = block * _superblock;
+			u64 n = std::min(_superblock, _size - first);
+			range(first, n, buffer.data());
+			histogram::count(buffer.data(), n, counts);
+			for (unsigned sym = 0; sym < 256; sym++) {
+				if (_slots[sym] != no_slot)
+					_ranks[(block + 1) * _slot_count + _slots[sym]] = counts[sym];
+			}
+		}
+	}
+
+	/* occurrences of sym among the symbols [0, pos) */
+	u64	rank(u8 sym, u64 pos) const
+	{
+		if (pos > _size)
+			throw runtime_error("Symbol index is out of range.");
+		if (!_superblock)
+			return count(sym, 0, pos);
+		if (_slots[sym] == no_slot)
+			return 0;
+		u64 block = pos / _superblock;
+		return _ranks[block * _slot_count + _slots[sym]] + count(sym, block * _superblock, pos);
+	}
+
+	/* position of occurrence k (0 = the first) of sym, size() if there are at most k */
+	u64	select(u8 sym, u64 k) const
+	{
+		if (!_superblock)
+			return locate(sym, 0, _size, k);
+		if (_slots[sym] == no_slot)
+			return _size;
+		// the last superblock boundary with at most k occurrences before it
+		u64 low = 0, high = _ranks.size() / _slot_count - 1;
+		if (_ranks[high * _slot_count + _slots[sym]] <= k)
+			return _size;
+		while (low + 1 < high) {
+			u64 middle = (low + high) / 2;
+			if (_ranks[middle * _slot_count + _slots[sym]] <= k)
+				low = middle;
+			else
+				high = middle;
+		}
+		k -= _ranks[low * _slot_count + _slots[sym]];
+		return locate(sym, low * _superblock, std::min(_size, high * _superblock), k);
+	}
+
+	u8	at(u64 index) const
+	{
+		if (index >= _size)
+			throw runtime_error("Symbol index is out of range.");
+		const Piece& piece = find(index);
+		u64 local = index - piece.first;
+		if (piece.exceptions != no_exceptions) {
+			const auto& runs = _exceptions[piece.exceptions];
+			auto it = std::upper_bound(runs.begin(), runs.end(), local,
+									   [](u64 i, const dna::Run& r) { return i < r.position; });
+			if (it != runs.begin() && local - (it - 1)->position < (it - 1)->length)
+				return (it - 1)->symbol;
+		}
+		return _tables[piece.table][code_at(piece, local)];
+	}
+
+	void range(u64 offset, u64 count, u8* out) const
+	{
+		if (offset > _size || count > _size - offset)
+			throw runtime_error("Symbol range is out of range.");
+		while (count) {
+			const Piece& piece = find(offset);
+			u64 local = offset - piece.first;
+			u64 n = std::min(count, piece.count - local);
+			const u8* table = _tables[piece.table].data();
+			// symbols up to the next byte boundary (multiple of 8 symbols) one by one
+			u64 lead = std::min<u64>((8 - local % 8) % 8, n);
+			for (u64 i = 0; i < lead; i++)
+				out[i] = table[code_at(piece, local + i)];
+			bitpack::unpack_block(piece.width, piece.data + (local + lead) / 8 * piece.width,
+								  n - lead, table, out + lead);
+			if (piece.exceptions != no_exceptions)
+				patch(_exceptions[piece.exceptions], local, n, out);
+			out += n;
+			offset += n;
+			count -= n;
+		}
+	}
+
+	/*
+	 * Calls visit(position) for every position where the m symbols of pattern start,
+	 * in increasing order (overlapping matches included) until visit returns false.
+	 * Returns false if visit stopped the search.
+	 */
+	template<typename Visit>
+	bool search(const u8* pattern, u64 m, Visit visit) const
+	{
+		if (!pattern || !m)
+			throw runtime_error("invalid input (pattern nullptr or 0 length)");
+		if (m > _size)
+			return true;
+		vector<u8> codes(m), check(m);
+		for (const auto& piece : _pieces) {
+			bool coded = true;
+			for (u64 j = 0; j < m && coded; j++) {
+				u16 code = _codes[piece.table][pattern[j]];
+				coded = !(code >> piece.width);
+				codes[j] = (u8)code;
+			}
+			u64 inside = piece.count >= m ? piece.count - m + 1 : 0;	// starts of matches within the piece
+			auto packed = [&](u64 local) {
+				if (piece.exceptions != no_exceptions) {
+					// the don't care code of an exception slot may look like a base
+					range(piece.first + local, m, check.data());
+					if (memcmp(check.data(), pattern, m))
+						return true;
+				}
+				return visit(piece.first + local);
+			};
+			if (coded && !piece.width) {
+				for (u64 local = 0; local < inside; local++) {
+					if (!visit(piece.first + local))
+						return false;
+				}
+			}
+			else if (coded) {
+				if (!packedsearch::find(piece.width, piece.data, piece.count, codes.data(), m, packed))
+					return false;
+			}
+			else if (piece.exceptions != no_exceptions) {
+				if (!search_decoded(piece.first, piece.first + inside, pattern, m, visit))
+					return false;
+			}
+			// matches starting in the piece and ending in the next ones
+			u64 last = std::min(piece.first + piece.count, _size - m + 1);
+			if (piece.first + inside < last && !search_decoded(piece.first + inside, last, pattern, m, visit))
+				return false;
+		}
+		return true;
+	}
+
+private:
+	// search on decoded symbols for the matches starting in [first, last)
+	template<typename Visit>
+	bool search_decoded(u64 first, u64 last, const u8* pattern, u64 m, Visit& visit) const
+	{
+		const u64 block = 1 << 16;
+		vector<u8> buffer(std::min(block, last - first) + m - 1);
+		for (u64 start = first; start < last; start += block) {
+			u64 starts = std::min(block, last - start);
+			range(start, starts + m - 1, buffer.data());
+			auto global = [&](u64 i) { return visit(start + i); };
+			if (!packedsearch::find_bytes(buffer.data(), starts, pattern, m, global))
+				return false;
+		}
+		return true;
+	}
+
+	// occurrences of sym among the symbols [first, last)
+	u64	count(u8 sym, u64 first, u64 last) const
+	{
+		u64 total = 0;
+		for (u64 p = first < _size ? &find(first) - _pieces.data() : _pieces.size();
+			 p < _pieces.size() && _pieces[p].first < last; p++) {
+			const Piece& piece = _pieces[p];
+			u64 a = std::max(first, piece.first) - piece.first;
+			u64 b = std::min(last, piece.first + piece.count) - piece.first;
+			u16 code = _codes[piece.table][sym];
+			if (code != no_code)
+				total += rankselect::count(piece.width, piece.data, a, b, (u8)code);
+			if (piece.exceptions == no_exceptions)
+				continue;
+			// exception slots hold the code (symbol >> 1) & 3 of their symbol
+			const auto& runs = _exceptions[piece.exceptions];
+			auto it = std::upper_bound(runs.begin(), runs.end(), a,
+									   [](u64 i, const dna::Run& r) { return i < r.position; });
+			if (it != runs.begin())
+				--it;
+			for (; it != runs.end() && it->position < b; ++it) {
+				u64 from = std::max(it->position, a);
+				u64 to = std::min(it->position + it->length, b);
+				if (from >= to)
+					continue;
+				if (it->symbol == sym)
+					total += to - from;
+				else if (code == ((it->symbol >> 1) & 3))
+					total -= to - from;
+			}
+		}
+		return total;
+	}
+
+	// position of occurrence k of sym among the symbols [first, last), last if there are at most k
+	u64	locate(u8 sym, u64 first, u64 last, u64 k) const
+	{
+		for (u64 p = first < _size ? &find(first) - _pieces.data() : _pieces.size();
+			 p < _pieces.size() && _pieces[p].first < last; p++) {
+			const Piece& piece = _pieces[p];
+			u64 a = std::max(first, piece.first) - piece.first;
+			u64 b = std::min(last, piece.first + piece.count) - piece.first;
+			if (piece.exceptions == no_exceptions) {
+				u16 code = _codes[piece.table][sym];
+				u64 found = code == no_code ? b : rankselect::select(piece.width, piece.data, a, b, (u8)code, k);
+				if (found < b)
+					return piece.first + found;
+				continue;
+			}
+			// bases and exceptions mixed: decode and compare
+			u8 buffer[4096];
+			for (u64 pos = a; pos < b; ) {
+				u64 n = std::min<u64>(sizeof(buffer), b - pos);
+				range(piece.first + pos, n, buffer);
+				for (u64 i = 0; i < n; i++) {
+					if (buffer[i] == sym && !k--)
+						return piece.first + pos + i;
+				}
+				pos += n;
+			}
+		}
+		return last;
+	}
+
+	struct Piece
+	{
+		const u8*	data;		// packed codes
+		u64			first;		// index of the first symbol
+		u64			count;		// number of symbols
+		u32			table;		// index into _tables
+		unsigned	width;		// bits per block
+		u32			exceptions;	// index into _exceptions or no_exceptions
+	};
+	static const u32 no_exceptions = ~0u;
+	static constexpr u16 no_code = 0x100;
+	static constexpr u16 no_slot = 0xFFFF;
+
+	// symbol -> lowest code of every table, no_code for symbols the table lacks
+	void add_codes()
+	{
+		for (const auto& table : _tables) {
+			_codes.emplace_back();
+			_codes.back().fill(no_code);
+			for (int code = 255; code >= 0; code--)
+				_codes.back()[table[code]] = (u16)code;
+		}
+	}
+
+	void add_frame(const u8* frame, u64 len, bool top_level)
+	{
+		if (!frame || !len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		switch (determine_type(frame)) {
+		case BLOCK:
+		{
+			BlockDecoder decoder(frame, len);
+			u64 count = decoder.decoded_size();	// throws
+			add_table(decoder);
+			add_piece(decoder.data(), count, decoder.bits_per_block());
+			break;
+		}
+		case BLOCK_CHUNKED:
+		{
+			ChunkedBlockDecoder decoder(frame, len, 1);
+			u64 count = decoder.decoded_size();	// throws
+			add_table(decoder);
+			for (u64 offset : decoder.chunk_offsets()) {
+				u64 chunk = std::min(decoder.chunk_size(), count);
+				add_piece(decoder.data() + offset, chunk, decoder.bits_per_block());
+				count -= chunk;
+			}
+			break;
+		}
+		case RAW:
+		{
+			RawDecoder decoder(frame, len);
+			u64 count = decoder.decoded_size();	// throws
+			_tables.emplace_back();
+			for (unsigned i = 0; i < 256; i++)
+				_tables.back()[i] = (u8)i;		// stored bytes are their own codes
+			add_piece(decoder.data(), count, 8);
+			break;
+		}
+		case DNA:
+		{
+			DnaDecoder decoder(frame, len);
+			u64 count = decoder.decoded_size();	// throws
+			_tables.emplace_back();
+			dna::fill_symbol_table(_tables.back().data());
+			add_piece(decoder.data(), count, 2);
+			if (!decoder.exceptions().empty()) {
+				_pieces.back().exceptions = (u32)_exceptions.size();
+				_exceptions.push_back(decoder.exceptions());
+			}
+			break;
+		}
+		case STREAM:
+		{
+			if (!top_level)
+				throw runtime_error("Malformed stream - nested stream segment.");
+			StreamDecoder decoder(frame, len);
+			decoder.decoded_size();	// throws
+			for (const auto& segment : decoder.segments())
+				add_frame(frame + segment.first, segment.second, false);
+			break;
+		}
+		default:
+			throw runtime_error("Random access is not supported for this encoder type.");
+		}
+	}
+	void add_table(const BlockDecoder& decoder)
+	{
+		_tables.emplace_back();
+		decoder.fill_symbol_table(_tables.back().data());
+	}
+	void add_piece(const u8* data, u64 count, unsigned width)
+	{
+		if (!count)
+			return;
+		_pieces.push_back(Piece{ data, _size, count, (u32)(_tables.size() - 1), width, no_exceptions });
+		_size += count;
+	}
+
+	const Piece& find(u64 index) const
+	{
+		if (_uniform)
+			return _pieces[index / _piece_size];
+		auto it = std::upper_bound(_pieces.begin(), _pieces.end(), index,
+								   [](u64 i, const Piece& p) { return i < p.first; });
+		return *(it - 1);
+	}
+
+	// overwrites the symbols [local, local + count) of out covered by exception runs
+	static void patch(const vector<dna::Run>& runs, u64 local, u64 count, u8* out)
+	{
+		auto it = std::upper_bound(runs.begin(), runs.end(), local,
+								   [](u64 i, const dna::Run& r) { return i < r.position; });
+		if (it != runs.begin())
+			--it;
+		for (; it != runs.end() && it->position < local + count; ++it) {
+			u64 first = std::max(it->position, local);
+			u64 last = std::min(it->position + it->length, local + count);
+			if (first < last)
+				memset(out + (first - local), it->symbol, last - first);
+		}
+	}
+
+	static u8 code_at(const Piece& piece, u64 local)
+	{
+		if (!piece.width)
+			return 0;
+		u64 bit = local * piece.width;
+		u64 byte = bit / 8;
+		unsigned shift = bit % 8;
+		unsigned value = piece.data[byte];
+		if (shift + piece.width > 8)	// the code continues in the next byte
+			value |= piece.data[byte + 1] << 8;
+		return (value >> shift) & ((1u << piece.width) - 1);
+	}
+
+	vector<Piece>					_pieces;
+	vector<std::array<u8, 256>>		_tables;
+	vector<vector<dna::Run>>		_exceptions;
+	vector<std::array<u16, 256>>	_codes;
+	std::array<u16, 256>			_slots;			// symbol -> column of _ranks
+	u64								_slot_count{ 0 };
+	u64								_superblock{ 0 };	// symbols per superblock, 0 without index
+	vector<u64>						_ranks;			// occurrences before every superblock boundary
+	u64								_size{ 0 };
+	u64								_piece_size{ 0 };
+	bool							_uniform{ true };
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "common.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+#include "lz.hpp"
+#include "threadpool.hpp"
+
+#include <cstring>
+
+/*
+ * Batch compression/decompression (nitro_compress_batch and friends)
+ *
+ * The items are spread over a worker pool and written into one allocation:
+ * the offsets array (count + 1 entries) followed by the arena holding the
+ * results back to back.
+ * Compression reserves the worst case size of every group of consecutive items,
+ * encodes the items of a group back to back and closes the gaps between the
+ * groups at the end (pages of the reserve which are never written cost nothing).
+ * Decompression reads all decoded sizes first and decodes into slots of the exact size.
+ * Any failing item fails the whole batch.
+ */
+namespace batch
+{
+	const u64	group_factor = 8;	// item groups per worker - balances uneven item sizes
+
+	// offsets[count + 1] and an arena of arena_size bytes in one block
+	inline NitroBatch allocate(u64 count, u64 arena_size)
+	{
+		u64 offsets_size = (count + 1) * sizeof(u64);
+		u8* block = reinterpret_cast<u8*>(malloc(offsets_size + arena_size));
+		if (!block)
+			throw runtime_error("Memory allocation failed");
+		return NitroBatch{ block + offsets_size, reinterpret_cast<u64*>(block), count };
+	}
+
+	inline NitroBatch compress(const NitroBuffer* items, u64 count, NitroEncoderType type, unsigned threads)
+	{
+		if (!items || !count)
+			throw runtime_error("invalid input (items nullptr or 0 count)");
+		ThreadPool pool(threads);
+		u64 groups = pool.size() == 1 ? 1 : std::min<u64>(count, pool.size() * group_factor);
+		auto first = [count, groups](u64 g) { return count * g / groups; };
+		// every group gets the sum of the bounds of its items
+		vector<u64> slots(groups + 1, 0);
+		for (u64 g = 0; g < groups; g++) {
+			slots[g + 1] = slots[g];
+			for (u64 i = first(g); i < first(g + 1); i++) {
+				u64 bound = nitro_compress_bound(items[i].len, type);
+				if (!bound)
+					throw runtime_error("Unknown encoder type.");
+				slots[g + 1] += bound;
+			}
+		}
+		NitroBatch result = allocate(count, slots[groups]);	// throws
+		try {
+			vector<u64> sizes(count);
+			bool checksums = checksum::enabled();
+			int level = lz::level();
+			pool.parallel_for(groups, [&](u64 g) {
+				checksum::enabled() = checksums;	// the options are per thread
+				lz::level() = level;
+				u8* out = result.arena + slots[g];
+				u8* end = result.arena + slots[g + 1];
+				for (u64 i = first(g); i < first(g + 1); i++) {
+					// the items are the parallelism - one thread per encoder
+					auto encoder = make_encoder(type, items[i].data, items[i].len, 1);
+					encoder->set_output(out, end - out);
+					sizes[i] = encoder->encode().len;	// throws
+					out += sizes[i];
+				}
+			});
+			result.offsets[0] = 0;
+			for (u64 i = 0; i < count; i++)
+				result.offsets[i + 1] = result.offsets[i] + sizes[i];
+			for (u64 g = 1; g < groups; g++) {
+				u64 offset = result.offsets[first(g)];
+				memmove(result.arena + offset, result.arena + slots[g], result.offsets[first(g + 1)] - offset);	// slots[g] >= offset
+			}
+			u64 offsets_size = (count + 1) * sizeof(u64);
+			u8* block = reinterpret_cast<u8*>(realloc(result.offsets, offsets_size + result.offsets[count]));	// shrinking - can not fail
+			result.offsets = reinterpret_cast<u64*>(block);
+			result.arena = block + offsets_size;
+		}
+		catch (...) {
+			free(result.offsets);
+			throw;
+		}
+		return result;
+	}
+
+	inline NitroBatch decompress(const NitroBuffer* items, u64 count, unsigned threads)
+	{
+		if (!items || !count)
+			throw runtime_error("invalid input (items nullptr or 0 count)");
+		ThreadPool pool(threads);
+		vector<unique_ptr<Decoder>> decoders(count);
+		vector<u64> sizes(count);
+		pool.parallel_for(count, [&](u64 i) {
+			if (!items[i].data || !items[i].len)
+				throw runtime_error("Invalid input to decoder!");
+			decoders[i] = make_decoder(items[i].data, items[i].len, 1);
+			if (!decoders[i])
+				throw runtime_error("Failed to obtain decoder object!");
+			sizes[i] = decoders[i]->decoded_size();	// throws
+		});
+		u64 total = 0;
+		for (u64 size : sizes)
+			total += size;
+		NitroBatch result = allocate(count, total);	// throws
+		result.offsets[0] = 0;
+		for (u64 i = 0; i < count; i++)
+			result.offsets[i + 1] = result.offsets[i] + sizes[i];
+		try {
+			pool.parallel_for(count, [&](u64 i) {
+				decoders[i]->set_output(result.arena + result.offsets[i], sizes[i]);
+				decoders[i]->decode();	// throws
+				decoders[i].reset();
+			});
+		}
+		catch (...) {
+			free(result.offsets);
+			throw;
+		}
+		return result;
+	}
+}
@@ -0,0 +1,313 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NITRO_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Word oriented block packing
+ *
+ * The layout is identical to what OutputBitStream::write_bit produces:
+ * codes are written LSB first, symbol i occupies the bits [i * W, (i + 1) * W)
+ * of the little endian bit sequence. Eight symbols always fill exactly W bytes,
+ * so the packer collects eight codes in a 64-bit accumulator and stores W bytes
+ * at once instead of branching on every single bit.
+ */
+namespace bitpack
+{
+	template<unsigned W>
+	inline u64	gather8(const u8* in, const u8* codes)
+	{
+		u64 acc = 0;
+		for (unsigned j = 0; j < 8; j++)
+			acc |= (u64)codes[in[j]] << (j * W);
+		return acc;
+	}
+
+	/*
+	 * Packs count symbols from in to out using the flat code table (256 entries).
+	 * Returns the pointer one past the last byte written.
+	 */
+	template<unsigned W>
+	u8*	pack(const u8* in, u64 count, const u8* codes, u8* out)
+	{
+		static_assert(W >= 1 && W <= 8, "block width must be between 1 and 8 bits");
+		u64 groups = count / 8;
+		for (u64 g = 0; g < groups; g++) {
+			u64 acc = gather8<W>(in, codes);
+			memcpy(out, &acc, W);	// little endian - low bytes hold the first codes
+			in += 8;
+			out += W;
+		}
+		// the last partial group - at most 7 symbols
+		unsigned rem = count % 8;
+		if (rem) {
+			u64 acc = 0;
+			for (unsigned j = 0; j < rem; j++)
+				acc |= (u64)codes[in[j]] << (j * W);
+			unsigned bytes = (rem * W + 7) / 8;
+			memcpy(out, &acc, bytes);
+			out += bytes;
+		}
+		return out;
+	}
+
+	/*
+	 * Runtime dispatch to the specialized packer of the given block width.
+	 * Width 0 (only one distinct symbol) produces no data.
+	 */
+	inline u8*	pack_block(unsigned width, const u8* in, u64 count, const u8* codes, u8* out)
+	{
+		switch (width) {
+		case 0: return out;
+		case 1: return pack<1>(in, count, codes, out);
+		case 2: return pack<2>(in, count, codes, out);
+		case 3: return pack<3>(in, count, codes, out);
+		case 4: return pack<4>(in, count, codes, out);
+		case 5: return pack<5>(in, count, codes, out);
+		case 6: return pack<6>(in, count, codes, out);
+		case 7: return pack<7>(in, count, codes, out);
+		case 8: return pack<8>(in, count, codes, out);
+		default:
+			throw runtime_error("Block width can be max 8 bits.");
+		}
+	}
+
+	/* Number of bytes count symbols of the given width occupy when packed */
+	inline u64	packed_size(unsigned width, u64 count)
+	{
+		u64 total_bits = width * count;
+		return total_bits / 8 + ((total_bits % 8) ? 1 : 0);
+	}
+
+	/*
+	 * Unpacking
+	 *
+	 * Every unpacker expands count codes of the given width from in and maps
+	 * them through the 256 entry table (code -> symbol) into out.
+	 * The input must hold exactly packed_size(W, count) bytes, the kernels never
+	 * read past that.
+	 */
+	enum class SimdLevel
+	{
+		SCALAR,
+		SSSE3,
+		AVX2
+	};
+
+	inline SimdLevel	detect_simd()
+	{
+#ifdef NITRO_X86_SIMD
+		static const SimdLevel level = []() {
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+				return SimdLevel::AVX2;
+			if (__builtin_cpu_supports("ssse3"))
+				return SimdLevel::SSSE3;
+			return SimdLevel::SCALAR;
+		}();
+		return level;
+#else
+		return SimdLevel::SCALAR;
+#endif
+	}
+
+	template<unsigned W>
+	void	unpack_scalar(const u8* in, u64 count, const u8* table, u8* out)
+	{
+		static_assert(W >= 1 && W <= 8, "block width must be between 1 and 8 bits");
+		const u64 mask = (1u << W) - 1;
+		u64 groups = count / 8;
+		for (u64 g = 0; g < groups; g++) {
+			u64 acc = 0;
+			memcpy(&acc, in, W);
+			for (unsigned j = 0; j < 8; j++)
+				out[j] = table[(acc >> (j * W)) & mask];
+			in += W;
+			out += 8;
+		}
+		unsigned rem = count % 8;
+		if (rem) {
+			u64 acc = 0;
+			memcpy(&acc, in, (rem * W + 7) / 8);
+			for (unsigned j = 0; j < rem; j++)
+				out[j] = table[(acc >> (j * W)) & mask];
+		}
+	}
+
+#ifdef NITRO_X86_SIMD
+	/*
+	 * SIMD unpacking works on groups of 16 codes (2 * W bytes).
+	 * Each code is gathered with a byte shuffle into a 16-bit lane together with
+	 * the byte following it (a code spans at most two bytes), the lanes are
+	 * shifted by their bit offset with a multiply (there is no variable 16-bit
+	 * shift before AVX-512) and packed back to bytes.
+	 * The code -> symbol mapping is a byte shuffle on 16 entry slices of the table:
+	 * one shuffle for W <= 4, 2^(W-4) shuffles and selects above that.
+	 */
+	template<unsigned W>
+	struct UnpackConsts
+	{
+		alignas(16) u8	shuf_lo[16];	// gathers codes 0..7 into 16-bit lanes
+		alignas(16) u8	shuf_hi[16];	// gathers codes 8..15
+		alignas(16) u16	mul[8];			// 1 << (8 - bit offset) per lane
+
+		UnpackConsts()
+		{
+			for (unsigned j = 0; j < 16; j++) {
+				unsigned bit = j * W;
+				unsigned first = bit / 8;
+				bool spans = (bit % 8) + W > 8;
+				u8* shuf = (j < 8) ? shuf_lo : shuf_hi;
+				unsigned lane = j % 8;
+				shuf[2 * lane] = (u8)first;
+				shuf[2 * lane + 1] = spans ? (u8)(first + 1) : 0x80;	// 0x80 zeroes the byte
+				if (j < 8)
+					mul[lane] = (u16)(1u << (8 - bit % 8));
+			}
+		}
+	};
+
+	template<unsigned W>
+	__attribute__((target("ssse3")))
+	inline __m128i	lookup_ssse3(__m128i codes, const u8* table)
+	{
+		if constexpr (W <= 4) {
+			return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)table), codes);
+		}
+		else {
+			const __m128i low_nibble = _mm_set1_epi8(0x0F);
+			__m128i idx = _mm_and_si128(codes, low_nibble);
+			__m128i slice = _mm_and_si128(_mm_srli_epi16(codes, 4), low_nibble);
+			__m128i res = _mm_setzero_si128();
+			for (unsigned t = 0; t < (1u << (W - 4)); t++) {
+				__m128i sel = _mm_cmpeq_epi8(slice, _mm_set1_epi8((char)t));
+				__m128i sym = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(table + 16 * t)), idx);
+				res = _mm_or_si128(res, _mm_and_si128(sel, sym));
+			}
+			return res;
+		}
+	}
+
+	template<unsigned W>
+	__attribute__((target("ssse3")))
+	u64		unpack_ssse3(const u8* in, u64 count, const u8* table, u8* out)
+	{
+		static const UnpackConsts<W> c;
+		const __m128i shuf_lo = _mm_load_si128((const __m128i*)c.shuf_lo);
+		const __m128i shuf_hi = _mm_load_si128((const __m128i*)c.shuf_hi);
+		const __m128i mul = _mm_load_si128((const __m128i*)c.mul);
+		const __m128i mask = _mm_set1_epi16((1 << W) - 1);
+		const u8* in_end = in + packed_size(W, count);
+		u64 done = 0;
+		// a 16 byte load must stay inside the input
+		while (count - done >= 16 && in + 16 <= in_end) {
+			__m128i v = _mm_loadu_si128((const __m128i*)in);
+			__m128i lo = _mm_shuffle_epi8(v, shuf_lo);
+			__m128i hi = _mm_shuffle_epi8(v, shuf_hi);
+			lo = _mm_and_si128(_mm_srli_epi16(_mm_mullo_epi16(lo, mul), 8), mask);
+			hi = _mm_and_si128(_mm_srli_epi16(_mm_mullo_epi16(hi, mul), 8), mask);
+			__m128i codes = _mm_packus_epi16(lo, hi);
+			_mm_storeu_si128((__m128i*)out, lookup_ssse3<W>(codes, table));
+			in += 2 * W;
+			out += 16;
+			done += 16;
+		}
+		return done;
+	}
+
+	template<unsigned W>
+	__attribute__((target("avx2")))
+	inline __m256i	lookup_avx2(__m256i codes, const u8* table)
+	{
+		if constexpr (W <= 4) {
+			return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)table)), codes);
+		}
+		else {
+			const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+			__m256i idx = _mm256_and_si256(codes, low_nibble);
+			__m256i slice = _mm256_and_si256(_mm256_srli_epi16(codes, 4), low_nibble);
+			__m256i res = _mm256_setzero_si256();
+			for (unsigned t = 0; t < (1u << (W - 4)); t++) {
+				__m256i sel = _mm256_cmpeq_epi8(slice, _mm256_set1_epi8((char)t));
+				__m256i tbl = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(table + 16 * t)));
+				res = _mm256_or_si256(res, _mm256_and_si256(sel, _mm256_shuffle_epi8(tbl, idx)));
+			}
+			return res;
+		}
+	}
+
+	template<unsigned W>
+	__attribute__((target("avx2")))
+	u64		unpack_avx2(const u8* in, u64 count, const u8* table, u8* out)
+	{
+		static const UnpackConsts<W> c;
+		const __m256i shuf_lo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)c.shuf_lo));
+		const __m256i shuf_hi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)c.shuf_hi));
+		const __m256i mul = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)c.mul));
+		const __m256i mask = _mm256_set1_epi16((1 << W) - 1);
+		const u8* in_end = in + packed_size(W, count);
+		u64 done = 0;
+		// 32 codes per iteration: the low lane holds codes 0..15, the high lane 16..31
+		while (count - done >= 32 && in + 2 * W + 16 <= in_end) {
+			__m256i v = _mm256_inserti128_si256(
+				_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)in)),
+				_mm_loadu_si128((const __m128i*)(in + 2 * W)), 1);
+			__m256i lo = _mm256_shuffle_epi8(v, shuf_lo);
+			__m256i hi = _mm256_shuffle_epi8(v, shuf_hi);
+			lo = _mm256_and_si256(_mm256_srli_epi16(_mm256_mullo_epi16(lo, mul), 8), mask);
+			hi = _mm256_and_si256(_mm256_srli_epi16(_mm256_mullo_epi16(hi, mul), 8), mask);
+			__m256i codes = _mm256_packus_epi16(lo, hi);	// in-lane pack keeps the code order
+			_mm256_storeu_si256((__m256i*)out, lookup_avx2<W>(codes, table));
+			in += 4 * W;
+			out += 32;
+			done += 32;
+		}
+		return done;
+	}
+#endif // NITRO_X86_SIMD
+
+	template<unsigned W>
+	void	unpack(const u8* in, u64 count, const u8* table, u8* out, SimdLevel level)
+	{
+		u64 done = 0;
+#ifdef NITRO_X86_SIMD
+		if (level == SimdLevel::AVX2)
+			done = unpack_avx2<W>(in, count, table, out);
+		if (level >= SimdLevel::SSSE3)
+			done += unpack_ssse3<W>(in + packed_size(W, done), count - done, table, out + done);
+#else
+		(void)level;
+#endif
+		// done is a multiple of 8 so the remaining codes start on a byte boundary
+		unpack_scalar<W>(in + packed_size(W, done), count - done, table, out + done);
+	}
+
+	/*
+	 * Runtime dispatch to the specialized unpacker of the given block width
+	 * using the best instruction set available on this cpu (unless level says otherwise).
+	 * Width 0 (only one distinct symbol) means every output byte is table[0].
+	 */
+	inline void	unpack_block(unsigned width, const u8* in, u64 count, const u8* table, u8* out,
+							 SimdLevel level = detect_simd())
+	{
+		switch (width) {
+		case 0: memset(out, table[0], count); break;
+		case 1: unpack<1>(in, count, table, out, level); break;
+		case 2: unpack<2>(in, count, table, out, level); break;
+		case 3: unpack<3>(in, count, table, out, level); break;
+		case 4: unpack<4>(in, count, table, out, level); break;
+		case 5: unpack<5>(in, count, table, out, level); break;
+		case 6: unpack<6>(in, count, table, out, level); break;
+		case 7: unpack<7>(in, count, table, out, level); break;
+		case 8: unpack<8>(in, count, table, out, level); break;
+		default:
+			throw runtime_error("Block width can be max 8 bits.");
+		}
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "common.hpp"
+#include "bitpack.hpp"
+
+#include <array>
+#include <cstring>
+
+/* CRC32C (Castagnoli) - SSE4.2 crc32 instruction when the cpu has it, table driven otherwise */
+namespace crc32c
+{
+	inline u32 update_scalar(u32 crc, const u8* data, u64 len)
+	{
+		static const auto table = []() {
+			std::array<u32, 256> t;
+			for (u32 i = 0; i < 256; i++) {
+				u32 c = i;
+				for (int k = 0; k < 8; k++)
+					c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+				t[i] = c;
+			}
+			return t;
+		}();
+		for (u64 i = 0; i < len; i++)
+			crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		return crc;
+	}
+
+#ifdef NITRO_X86_SIMD
+	__attribute__((target("sse4.2")))
+	inline u32 update_sse42(u32 crc, const u8* data, u64 len)
+	{
+		u64 c = crc;
+		for (; len >= sizeof(u64); len -= sizeof(u64), data += sizeof(u64)) {
+			u64 word;
+			memcpy(&word, data, sizeof(word));
+			c = _mm_crc32_u64(c, word);
+		}
+		u32 c32 = (u32)c;
+		while (len--)
+			c32 = _mm_crc32_u8(c32, *data++);
+		return c32;
+	}
+
+	inline bool has_sse42()
+	{
+		static const bool supported = []() {
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse4.2") != 0;
+		}();
+		return supported;
+	}
+#endif // NITRO_X86_SIMD
+
+	/* CRC32C of the bytes crc was computed over followed by [data, data + len) - extend(0, ...) starts a new one */
+	inline u32 extend(u32 crc, const u8* data, u64 len)
+	{
+#ifdef NITRO_X86_SIMD
+		if (has_sse42())
+			return ~update_sse42(~crc, data, len);
+#endif
+		return ~update_scalar(~crc, data, len);
+	}
+}
+
+/*
+ * Frame checksums (NITRO_OPTION_CHECKSUM)
+ *
+ * BLOCK and BLOCK_CHUNKED frames written with the option on set checksum::flag in the
+ * symbol table entry count and carry one CRC32C per segment right before the data.
+ * A segment is a chunk of a chunked frame and default_chunk_size symbols of a BLOCK frame,
+ * its checksum covers the frame header (everything before the checksum list) followed by
+ * the packed bytes of the segment, so every segment verifies on its own and a corrupted
+ * header fails all of them.
+ * The CRC runs over every slice right after it is packed or before it is unpacked,
+ * while the packed bytes are still in the L1 cache, not as a separate pass over the data.
+ */
+namespace checksum
+{
+	const u16	flag = 0x8000;				// in the symbol table entry count (which is at most 256)
+	const u64	sizeof_checksum = sizeof(u32);
+	const u64	slice = 1 << 14;			// symbols per CRC update - multiple of 8 so slices are byte aligned
+
+	inline bool& enabled()
+	{
+		static thread_local bool on = false;
+		return on;
+	}
+
+	inline u64 segment_count(u64 len, u64 segment_symbols)
+	{
+		return (len + segment_symbols - 1) / segment_symbols;
+	}
+
+	/* bitpack::pack_block extending crc over the packed bytes, returns the end of the packed data */
+	inline u8* pack_block(unsigned width, const u8* in, u64 count, const u8* codes, u8* out, u32& crc)
+	{
+		for (u64 done = 0; done < count; done += slice) {
+			u8* end = bitpack::pack_block(width, in + done, std::min(slice, count - done), codes, out);
+			crc = crc32c::extend(crc, out, end - out);
+			out = end;
+		}
+		return out;
+	}
+
+	/* bitpack::unpack_block extending crc over the packed bytes */
+	inline void unpack_block(unsigned width, const u8* in, u64 count, const u8* table, u8* out, u32& crc)
+	{
+		for (u64 done = 0; done < count; done += slice) {
+			u64 n = std::min(slice, count - done);
+			u64 bytes = bitpack::packed_size(width, n);
+			crc = crc32c::extend(crc, in, bytes);
+			bitpack::unpack_block(width, in, n, table, out + done);
+			in += bytes;
+		}
+	}
+}
@@ -5,11 +5,12 @@
 #include <cstdint>
 #include <cstdint>
 #include <vector>
-#include <unordered_map>
 #include <iostream> // debugging
 #include <cassert>
 #include <memory>
 #include <exception>
+#include <cstring>
+#include <chrono>
 
 //#define DEBUG
 
@@ -19,7 +20,6 @@
 
 
 using std::vector;
-using std::unordered_map;
 using std::unique_ptr;
 using std::cerr;
 using std::runtime_error;
@@ -35,10 +35,126 @@ namespace protocol
 {
 	extern const int	sizeof_encoder_type;
 	extern const u64	sizeof_table_entry_size;
+	extern const u64	default_chunk_size;
+}
+
+/*
+ * Per stage timing (NITRO_OPTION_STATS)
+ *
+ * Everything is thread local: the API entry points reset the counters of the calling
+ * thread, the coders wrap their stages in a Stage. When the option is off a stage
+ * costs one flag test and no clock reads.
+ */
+namespace stats
+{
+	inline bool& enabled()
+	{
+		static thread_local bool on = false;
+		return on;
+	}
+	inline NitroStats& current()
+	{
+		static thread_local NitroStats counters{};
+		return counters;
+	}
+	inline u64 now_ns()
+	{
+		return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// adds the lifetime of the object to one of the NitroStats counters
+	class Stage
+	{
+	public:
+		explicit Stage(uint64_t NitroStats::* counter) :
+			_counter(enabled() ? counter : nullptr),
+			_start(_counter ? now_ns() : 0)
+		{
+		}
+		~Stage()
+		{
+			if (_counter)
+				current().*_counter += now_ns() - _start;
+		}
+		Stage(const Stage&) = delete;
+		Stage& operator=(const Stage&) = delete;
+	private:
+		uint64_t NitroStats::*	_counter;
+		u64						_start;
+	};
+
+	// one API call: resets the counters, records the sizes and the total time
+	class Call
+	{
+	public:
+		explicit Call(u64 bytes_in) :
+			_start(enabled() ? now_ns() : 0)
+		{
+			if (enabled()) {
+				current() = NitroStats{};
+				current().bytes_in = bytes_in;
+			}
+		}
+		void finish(u64 bytes_out)
+		{
+			if (enabled()) {
+				current().bytes_out = bytes_out;
+				current().total_ns = now_ns() - _start;
+			}
+		}
+	private:
+		u64		_start;
+	};
+
+	inline void allocation()
+	{
+		if (enabled())
+			current().allocations++;
+	}
+	inline void bits_per_block(unsigned bits)
+	{
+		if (enabled())
+			current().bits_per_block = bits;
+	}
+}
+
+/* LEB128 varints of the side lists (RLE runs, DNA exceptions) */
+namespace varint
+{
+	const u64	max_size = 10;
+
+	inline u8* write(u8* out, u64 value)
+	{
+		while (value >= 0x80) {
+			*out++ = (u8)(value | 0x80);
+			value >>= 7;
+		}
+		*out++ = (u8)value;
+		return out;
+	}
+
+	/* throws if the varint runs past end */
+	inline u64 read(const u8*& in, const u8* end)
+	{
+		u64 value = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7) {
+			if (in == end)
+				throw runtime_error("Malformed data - truncated varint list.");
+			u8 byte = *in++;
+			value |= (u64)(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+		throw runtime_error("Malformed data - varint is too long.");
+	}
 }
 
 /*
 	 * Symbol table to hold code mappings
+	 * Two flat 256 entry arrays (symbol -> code, code -> symbol) and a presence
+	 * bitmap over the symbols - no hashing, and iteration goes in increasing
+	 * symbol order so the metadata written from it is deterministic.
 	 */
 class SymbolTable
 {
@@ -46,28 +162,32 @@ private:
 	unsigned bits_needed(unsigned count) const
 	{
 		unsigned bits_needed = 0;
-		while (count > (0x1 << bits_needed)) {
+		while (count > (0x1u << bits_needed)) {
 			bits_needed++;
 		}
 		return bits_needed;
 	}
 public:
-	u8	operator[](u8 sym)
+	u8	operator[](u8 sym) const
 	{
 		assert(find(sym));	// replce with exception
-		return _table[sym];
+		return _codes[sym];
 	}
-	bool find(u8 sym) const { return !(_table.find(sym) == _table.end()); }
+	u8	symbol(u8 code) const { return _symbols[code]; }
+	bool find(u8 sym) const { return (_present[sym >> 6] >> (sym & 63)) & 1; }
 	bool insert(u8 sym, u8 code)
 	{
 		if (find(sym))
 			return false;
-		_table[sym] = code;
+		_present[sym >> 6] |= 1ull << (sym & 63);
+		_codes[sym] = code;
+		_symbols[code] = sym;
+		_size++;
 		return true;
 	}
 	size_t size() const
 	{
-		return _table.size();
+		return _size;
 	}
 
 	size_t raw_size() const
@@ -76,27 +196,44 @@ public:
 		return size() * 2;
 	}
 
-	const auto& get() { return _table; }
+	// flat tables for the packing kernels - entries not in the table are 0
+	const u8*	code_table() const { return _codes; }
+	const u8*	symbol_table() const { return _symbols; }
+
+	// calls f(sym, code) for every entry in increasing symbol order
+	template<typename F>
+	void for_each(F f) const
+	{
+		for (unsigned word = 0; word < 4; word++) {
+			u64 bits = _present[word];
+			while (bits) {
+				u8 sym = (u8)(word * 64 + __builtin_ctzll(bits));
+				f(sym, _codes[sym]);
+				bits &= bits - 1;
+			}
+		}
+	}
 
-	unsigned bits_per_block() const { return bits_needed(_table.size()); }
+	unsigned bits_per_block() const { return bits_needed(_size); }
 
-	void debug_print(bool reverse)
+	void debug_print(bool reverse) const
 	{
 		printf("Symbol table:\n");
-		printf("Symbol count: %llu\n", _table.size());
-		for (const auto& entry : _table) {
-			auto sym = entry.first;
-			auto code = entry.second;
+		printf("Symbol count: %zu\n", size());
+		for_each([reverse](u8 sym, u8 code) {
 			if(!reverse)
 				printf("Entry:%c:%u\n", sym, code);
 			else
 				printf("Entry:%u:%c\n", sym, code);
-		}
+		});
 		printf("End\n");
 	}
 
 private:
-	unordered_map<u8, u8>		_table;
+	u8			_codes[256]{};
+	u8			_symbols[256]{};
+	u64			_present[4]{};
+	unsigned	_size{ 0 };
 };
 
 
@@ -109,10 +246,11 @@ public:
 		_init_common(buf, size);
 	}
 	u8*		begin() const { return _data; }
-	u8*		pointer() const { return _data; }
+	u8*		pointer() const { return _pointer; }
 	u64		size() const { return _data_size; }
 	u64		remaining_bytes() const { return (_data + _data_size) - _pointer; }
 	bool	valid() const { return _data && _data_size; }
+	void	skip(u64 count) { _pointer += count; }	// advance past bytes written/read directly through pointer()
 
 	void release()
 	{
@@ -126,9 +264,11 @@ protected:
 		_data = buf;
 		_data_size = size;
 		_pointer = buf;
+		_bit_buffer = 0;
+		_idx_bit_buf = 0;
 	}
-	u8		_bit_buffer{ 0 };				// current bit buffer
-	u8		_idx_bit_buf{ 0 };			// current bit index to read/write
+	u64		_bit_buffer{ 0 };		// bits not yet written/read, LSB first
+	u8		_idx_bit_buf{ 0 };		// number of bits in the bit buffer
 	u8*		_data{ nullptr };		// points to the beginning of the stream data
 	u64		_data_size{ 0 };		// allocated memory for the stream
 	u8*		_pointer{ nullptr };	// current pointer in the stream
@@ -137,15 +277,16 @@ protected:
 
 
 
+/*
+ * Bits are read LSB first. refill loads 8 bytes at once and keeps at least 56 bits
+ * in the buffer (the bits above the count are the following stream bits, loading
+ * them again on the next refill is harmless). Close to the end it loads byte by byte.
+ * Byte reads (read_bytes) are only valid while no bits are buffered.
+ */
 class InputBitStream : public BitStream
 {
 public:
 	virtual ~InputBitStream() {}
-	virtual void init(u8* buf, u64 size) override
-	{
-		_init_common(buf, size);
-		fetch_next_byte_to_buf();	// we need to fill the bit buffer
-	}
 	u8		read()
 	{
 		return read_bytes<u8>();
@@ -157,33 +298,52 @@ public:
 	template<typename Size>
 	Size	read_bytes()
 	{
-		Size r = *reinterpret_cast<Size*>(_pointer);
+		Size r;
+		memcpy(&r, _pointer, sizeof(Size));
 		_pointer += sizeof(Size);
-		if (_pointer < _data + _data_size)	// do not read past last byte!
-			fetch_next_byte_to_buf();
 		return r;
 	}
 
-	u8		read_bit()
+	void	refill()
 	{
-		if (_idx_bit_buf == 8) {
-			_pointer++;
-			fetch_next_byte_to_buf();
+		if (remaining_bytes() >= sizeof(u64)) {
+			u64 word;
+			memcpy(&word, _pointer, sizeof(word));
+			_bit_buffer |= word << _idx_bit_buf;
+			_pointer += (63 - _idx_bit_buf) >> 3;
+			_idx_bit_buf |= 56;
+			return;
+		}
+		while (_idx_bit_buf <= 56 && remaining_bytes()) {
+			_bit_buffer |= (u64)*_pointer++ << _idx_bit_buf;
+			_idx_bit_buf += 8;
 		}
-		u8 res = 0x1 & (_bit_buffer >> _idx_bit_buf++);	  // grab the next bit from the 8-bit buffer
-		return res;
 	}
-private:
-	void fetch_next_byte_to_buf()
+	unsigned	buffered_bits() const { return _idx_bit_buf; }
+	// the next count bits (count < 64) without consuming them
+	u64		peek_bits(unsigned count) const { return _bit_buffer & ((1ull << count) - 1); }
+	void	consume_bits(unsigned count)
 	{
-		_bit_buffer = *_pointer;
-		_idx_bit_buf = 0;
+		_bit_buffer >>= count;
+		_idx_bit_buf -= count;
+	}
+
+	u8		read_bit()
+	{
+		if (!_idx_bit_buf)
+			refill();
+		u8 res = (u8)peek_bits(1);
+		consume_bits(1);
+		return res;
 	}
 };
 
 
 
 
+/*
+ * Bits are collected LSB first in a 64 bit buffer and stored 4 bytes at a time.
+ */
 class OutputBitStream : public BitStream
 {
 public:
@@ -202,28 +362,32 @@ public:
 		if (bit != 0 && bit != 1)
 			throw runtime_error("Attempt to write not 1 nor 0");
 #endif
-		_bit_buffer |= (bit << _idx_bit_buf++);
-		if (_idx_bit_buf == 8) {
-			write_buffer();
+		write_bits(bit, 1);
+	}
+	// appends the low count bits of value (count <= 32, higher bits of value are 0)
+	void	write_bits(u64 value, unsigned count)
+	{
+		_bit_buffer |= value << _idx_bit_buf;
+		_idx_bit_buf += count;
+		if (_idx_bit_buf >= 32) {
+			u32 word = (u32)_bit_buffer;
+			memcpy(_pointer, &word, sizeof(word));
+			_pointer += sizeof(word);
+			_bit_buffer >>= 32;
+			_idx_bit_buf -= 32;
 		}
 	}
 	void flush()
 	{
-		if (_idx_bit_buf != 0) {
-			write_buffer();
+		// the last byte is partially filled
+		while (_idx_bit_buf) {
+			*_pointer++ = (u8)_bit_buffer;
+			_bit_buffer >>= 8;
+			_idx_bit_buf = _idx_bit_buf > 8 ? _idx_bit_buf - 8 : 0;
 		}
 #ifdef DEBUG
 		if (_pointer - _data != _data_size)
 			throw runtime_error("Encoded data size does not match with allocated mem size!");
 #endif
 	}
-
-
-private:
-	void	write_buffer()
-	{
-		*_pointer++ = _bit_buffer;	// write out the bit buffer to memory
-		_bit_buffer = 0;			// clear bit buffer
-		_idx_bit_buf = 0;			// reset to 0 the 'next bit pos' index
-	}
 };
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "common.hpp"
+#include "bitpack.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+#include "dictionary.hpp"
+
+#include <cstring>
+
+/*
+ * Block encoding against a shared symbol table (SHARED)
+ *
+ * For many small messages the BLOCK header (11 bytes + 2 per symbol) costs more
+ * than the data. A context primed with a sample keeps the symbol table of the
+ * sample, frames encoded through it carry only the 4 byte ID of that table.
+ * Codes are assigned in increasing symbol order, so the table is determined by
+ * the symbol set and the ID is a hash of the set: contexts primed with samples
+ * of the same alphabet agree.
+ *
+ * Layout:
+ *	- encoder type (1 byte)
+ *	- table ID (4 bytes)
+ *	- input length (LEB128 varint)
+ *	- packed codes, bits_per_block of the shared table per symbol
+ */
+namespace shared
+{
+	const u64	sizeof_table_id = sizeof(u32);
+	const u64	max_header_size = protocol::sizeof_encoder_type + sizeof_table_id + varint::max_size;
+
+	inline u64 max_encoded_size(u64 len)
+	{
+		return max_header_size + len;
+	}
+
+	// FNV-1a over the symbols, never 0 (0 means no table)
+	inline u32 table_id(const SymbolTable& table)
+	{
+		u32 hash = 2166136261u;
+		table.for_each([&hash](u8 sym, u8) {
+			hash = (hash ^ sym) * 16777619u;
+		});
+		return hash ? hash : 1;
+	}
+}
+
+class SharedEncoder : public Encoder
+{
+public:
+	SharedEncoder(const u8* input, uint64_t len, const SymbolTable& table, u32 id) :
+		_input(input),
+		_len(len),
+		_table(table),
+		_id(id)
+	{
+		_type = NitroEncoderType::SHARED;
+	}
+	virtual ~SharedEncoder() {}
+
+	// false if the input has a symbol the shared table lacks
+	bool covers()
+	{
+		if (!_covered) {
+			u64 i = 0;
+			while (i < _len && _table.find(_input[i]))
+				i++;
+			_covered = i == _len;
+		}
+		return _covered;
+	}
+
+	virtual NitroData encode() override
+	{
+		if (!_input || !_len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		if (!covers())
+			throw runtime_error("Input has symbols missing from the shared table.");
+		u8 header[shared::max_header_size];
+		header[0] = (u8)NitroEncoderType::SHARED;
+		memcpy(header + protocol::sizeof_encoder_type, &_id, sizeof(u32));
+		u64 header_size = varint::write(header + protocol::sizeof_encoder_type + shared::sizeof_table_id, _len) - header;
+		unsigned width = _table.bits_per_block();
+		u64 len = header_size + bitpack::packed_size(width, _len);
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < len)
+				throw runtime_error("Output buffer is too small to hold the encoded result.");
+		}
+		else {
+			output = reinterpret_cast<u8*>(malloc(len));
+			if (!output)
+				throw runtime_error("Memory allocation failed");
+		}
+		memcpy(output, header, header_size);
+		bitpack::pack_block(width, _input, _len, _table.code_table(), output + header_size);
+		return NitroData{ output, len, NitroEncoderType::SHARED };
+	}
+
+private:
+	const u8*			_input;
+	u64					_len;
+	const SymbolTable&	_table;
+	u32					_id;
+	bool				_covered{ false };
+};
+
+
+class SharedDecoder : public Decoder
+{
+public:
+	/* table may be nullptr - then only decoded_size works (and checks less) */
+	SharedDecoder(const u8* encoded, uint64_t len, const SymbolTable* table, u32 id) :
+		_encoded(encoded),
+		_len(len),
+		_table(table),
+		_id(id)
+	{
+	}
+	virtual ~SharedDecoder() {}
+
+	virtual NitroData decode() override
+	{
+		decoded_size();		// throws - reads the metadata
+		if (!_table)
+			throw runtime_error("Frame references a shared symbol table - decode it through a primed context.");
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < _orig_len)
+				throw runtime_error("Output buffer is too small to hold the decoded result");
+		}
+		else {
+			output = reinterpret_cast<u8*>(malloc(_orig_len));
+			if (!output)
+				throw runtime_error("Could not allocate enough space to hold decoded result");
+		}
+		bitpack::unpack_block(_table->bits_per_block(), _data, _orig_len, _table->symbol_table(), output);
+		return NitroData{ output, _orig_len, NitroEncoderType::SHARED };
+	}
+
+	virtual u64 decoded_size() override
+	{
+		if (!_data) {
+			const u8* end = _encoded + _len;
+			if (!_encoded || _len < protocol::sizeof_encoder_type + shared::sizeof_table_id ||
+				(NitroEncoderType)_encoded[0] != NitroEncoderType::SHARED)
+				throw runtime_error("Malformed protocol - invalid shared table frame header.");
+			memcpy(&_frame_id, _encoded + protocol::sizeof_encoder_type, sizeof(u32));
+			const u8* p = _encoded + protocol::sizeof_encoder_type + shared::sizeof_table_id;
+			_orig_len = varint::read(p, end);	// throws
+			if (!_orig_len)
+				throw runtime_error("Malformed protocol - empty shared table frame.");
+			if (_table) {
+				if (_frame_id != _id)
+					throw runtime_error("Frame was encoded against a different shared symbol table.");
+				if ((u64)(end - p) != bitpack::packed_size(_table->bits_per_block(), _orig_len))
+					throw runtime_error("Malformed data - packed size does not match the shared table.");
+			}
+			_data = p;
+		}
+		return _orig_len;
+	}
+
+private:
+	const u8*			_encoded;
+	u64					_len;
+	const SymbolTable*	_table;
+	u32					_id;
+	u32					_frame_id{ 0 };
+	u64					_orig_len{ 0 };
+	const u8*			_data{ nullptr };
+};
+
+
+/*
+ * Reusable compression context (nitro_context_create and friends)
+ *
+ * Holds the shared symbol table and the scratch buffer the results are written to,
+ * so a call allocates nothing once the scratch has grown to the message size.
+ * Inputs with a symbol outside the table (or any input before priming) are
+ * written as ordinary BLOCK frames, and decompression accepts any frame type.
+ * With a dictionary loaded every input is written as a DICT frame instead.
+ */
+struct NitroContext
+{
+public:
+	u32		prime(const u8* sample, u64 len)
+	{
+		if (!sample || !len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		bool seen[256];
+		histogram::present(sample, len, seen);
+		_table = SymbolTable();
+		u8 code = 0;
+		for (unsigned sym = 0; sym < 256; sym++) {
+			if (seen[sym])
+				_table.insert((u8)sym, code++);
+		}
+		_id = shared::table_id(_table);
+		return _id;
+	}
+
+	u32		table_id() const { return _id; }
+
+	u32		load_dictionary(const u8* serialized, u64 len)
+	{
+		auto content = dictionary::parse(serialized, len);	// throws
+		_dictionary = std::make_unique<lz::History>(content.first, content.second);
+		_dictionary_id = dictionary::id(content.first, content.second);
+		return _dictionary_id;
+	}
+
+	NitroData compress(const u8* input, u64 len)
+	{
+		if (_dictionary) {
+			DictEncoder encoder(input, len, *_dictionary, _dictionary_id);
+			return encode(encoder, dictionary::max_encoded_size(len));	// throws
+		}
+		if (_id) {
+			SharedEncoder encoder(input, len, _table, _id);
+			if (encoder.covers())
+				return encode(encoder, shared::max_encoded_size(len));	// throws
+		}
+		BlockEncoder encoder(input, len);
+		return encode(encoder, BlockEncoder::max_encoded_size(len));	// throws
+	}
+
+	NitroData decompress(const u8* encoded, u64 len)
+	{
+		if (!encoded || !len)
+			throw runtime_error("Invalid input to decoder!");
+		// refused before the claimed size grows the scratch buffer
+		unique_ptr<Decoder> decoder;
+		if (determine_type(encoded) == NitroEncoderType::SHARED) {
+			if (!_id)
+				throw runtime_error("Frame references a shared symbol table - decode it through a primed context.");
+			decoder = std::make_unique<SharedDecoder>(encoded, len, &_table, _id);
+		}
+		else if (determine_type(encoded) == NitroEncoderType::DICT) {
+			if (!_dictionary)
+				throw runtime_error("Frame references a dictionary - decode it through a context with the dictionary loaded.");
+			decoder = std::make_unique<DictDecoder>(encoded, len, _dictionary.get(), _dictionary_id);
+		}
+		else
+			decoder = make_decoder(encoded, len, 1);
+		if (!decoder)
+			throw runtime_error("Failed to obtain decoder object!");
+		u64 size = decoder->decoded_size();	// throws
+		if (_scratch.size() < size)
+			_scratch.resize(size);
+		decoder->set_output(_scratch.data(), _scratch.size());
+		return decoder->decode();	// throws
+	}
+
+private:
+	NitroData encode(Encoder& encoder, u64 bound)
+	{
+		if (_scratch.size() < bound)
+			_scratch.resize(bound);
+		encoder.set_output(_scratch.data(), _scratch.size());
+		return encoder.encode();	// throws
+	}
+
+	SymbolTable		_table;
+	u32				_id{ 0 };
+	unique_ptr<lz::History>	_dictionary;
+	u32				_dictionary_id{ 0 };
+	vector<u8>		_scratch;
+};
@@ -1,6 +1,11 @@
 #pragma once
 
 #include "common.hpp"
+#include "bitpack.hpp"
+#include "checksum.hpp"
+#include "threadpool.hpp"
+
+#include <string>
 
 
 /* Determines the the type of the encoder
@@ -18,55 +23,124 @@ class Decoder
 public:
 	virtual ~Decoder() {}
 	virtual NitroData decode() = 0;
+	// size of the decoded data - only parses the metadata
+	virtual u64 decoded_size() = 0;
+	// decode into a caller provided buffer instead of a malloc-ed one
+	void set_output(u8* buffer, u64 capacity)
+	{
+		_external = buffer;
+		_external_capacity = capacity;
+	}
+protected:
+	u8*		_external{ nullptr };
+	u64		_external_capacity{ 0 };
 };
 
+/*
+ * Creates the decoder matching the encoder type stored in the first byte
+ * Returns nullptr for unknown types. (defined in nitro.cpp)
+ */
+unique_ptr<Decoder> make_decoder(const u8* encoded, u64 len, unsigned threads);
+
 
 class BlockDecoder : public Decoder
 {
 public:
-	BlockDecoder(const u8* encoded, uint64_t len)
+	/* threads: workers unpacking slices of the frame, 0 means one per hardware thread */
+	BlockDecoder(const u8* encoded, uint64_t len, unsigned threads = 1) :
+		BlockDecoder(encoded, len, NitroEncoderType::BLOCK)
 	{
-		// ignoe the first byte which is the encoder type
-		_input.init(const_cast<u8*>(encoded), len);
+		_threads = threads;
 	}
 	virtual ~BlockDecoder() {}
 	virtual NitroData decode() override
 	{
-		if (!_input.valid())
-			throw runtime_error("invalid input (input nullptr or 0 length)");
 #ifdef DEBUG
 		printf("------------DECODING-----------------\n");
 #endif // DEBUG
 		
-		read_metadata(); // throws
-		alloc_space();	 // throws
-		decompress();
+		{
+			stats::Stage stage(&NitroStats::header_ns);
+			decoded_size();	 // throws - reads the metadata
+		}
+		stats::bits_per_block(_symtable.bits_per_block());
+		{
+			stats::Stage stage(&NitroStats::alloc_ns);
+			alloc_space();	 // throws
+		}
+		try {
+			stats::Stage stage(&NitroStats::code_ns);
+			decompress();	// throws on a checksum mismatch
+		}
+		catch (...) {
+			if (!_external)
+				free(_output);
+			_output = nullptr;
+			throw;
+		}
 
-		return NitroData{ _output, _orig_symbol_count, NitroEncoderType::BLOCK };
+		return NitroData{ _output, _orig_symbol_count, _type };
 
 	}
-private:
-	void decompress()
+	virtual u64 decoded_size() override
+	{
+		if (!_metadata_read) {
+			if (!_input.valid())
+				throw runtime_error("invalid input (input nullptr or 0 length)");
+			read_metadata(); // throws
+			_metadata_read = true;
+		}
+		return _orig_symbol_count;
+	}
+	// accessors for random access - valid once the metadata is read
+	unsigned	bits_per_block() const { return _symtable.bits_per_block(); }
+	const u8*	data() const { return _input.pointer(); }
+	void fill_symbol_table(u8* table) const
+	{
+		// flat code -> symbol table for the unpack kernels (the decoder keys the table by code)
+		// codes not present in the table (only in malformed data) decode to 0
+		memcpy(table, _symtable.code_table(), 256);
+	}
+protected:
+	BlockDecoder(const u8* encoded, uint64_t len, NitroEncoderType type) :
+		_type(type)
+	{
+		// ignoe the first byte which is the encoder type
+		_input.init(const_cast<u8*>(encoded), len);
+	}
+	virtual void decompress()
 	{
 		unsigned blocksize = _symtable.bits_per_block();
 		assert(blocksize <= 8);
-		u8* pout = _output;		// current output location
-		// try to decode all the symbols
-		for (u64 i = 0; i < _orig_symbol_count; i++) {
-			u8 code = fetch_next_code(blocksize);
-			u8 sym =  _symtable[code];
-			*pout++ = sym;
-		}
+		u8 table[256];
+		fill_symbol_table(table);
+		// symbol i sits at bit i * blocksize, so slices of segment_symbols() symbols (a multiple of 8)
+		// start on a byte boundary and unpack independently - no format change needed
+		u64 slice_symbols = segment_symbols();
+		u64 slice_bytes = bitpack::packed_size(blocksize, slice_symbols);
+		ThreadPool pool(_threads);
+		pool.parallel_for(checksum::segment_count(_orig_symbol_count, slice_symbols), [&](u64 slice) {
+			const u8* in = _input.pointer() + slice * slice_bytes;
+			u64 first = slice * slice_symbols;
+			if (_checksums)
+				unpack_segment(slice, table, in);	// throws
+			else
+				bitpack::unpack_block(blocksize, in, std::min(slice_symbols, _orig_symbol_count - first),
+									  table, _output + first);
+		});
 	}
-	u8	 fetch_next_code(const unsigned& blocksize)
+	// symbols covered by one checksum and unpacked by one worker
+	virtual u64 segment_symbols() const { return protocol::default_chunk_size; }
+	// unpacks segment number segment from in - throws if its checksum does not match
+	void unpack_segment(u64 segment, const u8* table, const u8* in)
 	{
-		u8 code = 0;
-		for (int bitidx = 0; bitidx < blocksize; bitidx++) {
-			u8 bit = _input.read_bit();
-			assert(bit == 1 || bit == 0);
-			code |= bit << bitidx;
-		}
-		return code;
+		u64 first = segment * segment_symbols();
+		u32 crc = _header_crc, expected;
+		checksum::unpack_block(_symtable.bits_per_block(), in, std::min(segment_symbols(), _orig_symbol_count - first),
+							   table, _output + first, crc);
+		memcpy(&expected, _checksums + segment * checksum::sizeof_checksum, checksum::sizeof_checksum);
+		if (crc != expected)
+			throw runtime_error("Checksum mismatch in chunk " + std::to_string(segment) + " - the data is corrupt.");
 	}
 	void parse_symtable(u16 entrycount)
 	{
@@ -96,17 +170,33 @@ private:
 		// we will need to sanitize the user input whether this data still represents
 		// a valid protocol
 		// be careful - user input can be 'anything' even malicious
-		// TODO - create a hash when encoding possibly and check if the hash matches
-		// at the end of the decoding
+		// frames written with NITRO_OPTION_CHECKSUM carry CRCs of the data (see checksum.hpp)
+		if (_input.remaining_bytes() < protocol::sizeof_encoder_type + protocol::sizeof_table_entry_size)
+			throw runtime_error("Malformed protocol - input is shorter than the metadata.");
 		// 1. check encoder type again
-		if ((NitroEncoderType)_input.read() != NitroEncoderType::BLOCK)
+		if ((NitroEncoderType)_input.read() != _type)
 			throw runtime_error("Wrong decoder for indicated encoder.");
 		// 2. read symbol table entry count (stored on the next 2 bytes)
 		u16 table_entry_count = _input.read_bytes<u16>();
-		parse_symtable(table_entry_count);
+		bool checksummed = table_entry_count & checksum::flag;
+		parse_symtable(table_entry_count & ~checksum::flag);
 		parse_orig_symbol_count();
+		read_layout();					// throws
+		if (checksummed)
+			read_checksums();			// throws
 		validate_orig_symbol_count();	// throws
 	}
+	// frame specific fields between the original symbol count and the data
+	virtual void read_layout() {}
+	void read_checksums()
+	{
+		u64 size = checksum::segment_count(_orig_symbol_count, segment_symbols()) * checksum::sizeof_checksum;
+		if (_input.remaining_bytes() < size)
+			throw runtime_error("Malformed data - checksum list is bigger than the number of bytes left in the stream.");
+		_checksums = _input.pointer();
+		_header_crc = crc32c::extend(0, _input.begin(), _checksums - _input.begin());
+		_input.skip(size);
+	}
 	void parse_orig_symbol_count()
 	{
 		if (_input.remaining_bytes() < sizeof(u64))
@@ -126,14 +216,98 @@ private:
 
 	void alloc_space()
 	{
+		if (_external) {
+			if (_external_capacity < _orig_symbol_count)
+				throw runtime_error("Output buffer is too small to hold the decoded result");
+			_output = _external;
+			return;
+		}
 		_output = reinterpret_cast<u8*>(malloc(_orig_symbol_count));
+		stats::allocation();
 		if (!_output)
 			throw runtime_error("Could not allocate enough space to hold decoded result");
 	}
 
-private:
+protected:
+	NitroEncoderType	_type;
 	InputBitStream		_input;
 	SymbolTable			_symtable;
 	u64					_orig_symbol_count{ 0 };
 	u8*					_output{ nullptr };
+	bool				_metadata_read{ false };
+	const u8*			_checksums{ nullptr };	// nullptr unless the frame has checksums
+	u32					_header_crc{ 0 };
+	unsigned			_threads{ 1 };
+};
+
+
+/*
+ * Decoder of the chunked block frame (see ChunkedBlockEncoder for the layout)
+ * Chunks are unpacked in parallel on a worker pool.
+ */
+class ChunkedBlockDecoder : public BlockDecoder
+{
+public:
+	ChunkedBlockDecoder(const u8* encoded, uint64_t len, unsigned threads) :
+		BlockDecoder(encoded, len, NitroEncoderType::BLOCK_CHUNKED),
+		_pool(threads)
+	{
+	}
+	virtual ~ChunkedBlockDecoder() {}
+
+	u64					chunk_size() const { return _chunk_size; }
+	const vector<u64>&	chunk_offsets() const { return _offsets; }
+
+protected:
+	virtual void read_layout() override
+	{
+		if (_input.remaining_bytes() < sizeof(u64) + sizeof(u32))
+			throw runtime_error("Malformed protocol - not enough bytes remains to read the chunk layout");
+		_chunk_size = _input.read_bytes<u64>();
+		u32 chunk_count = _input.read_bytes<u32>();
+		if (!_chunk_size || _chunk_size % 8)
+			throw runtime_error("Malformed data - chunk size must be a non zero multiple of 8.");
+		if (chunk_count != (_orig_symbol_count + _chunk_size - 1) / _chunk_size)
+			throw runtime_error("Malformed data - chunk count does not match the original symbol count.");
+		if (_input.remaining_bytes() < (u64)chunk_count * sizeof(u64))
+			throw runtime_error("Malformed data - chunk offset table is bigger than the number of bytes left in the stream.");
+		_offsets.resize(chunk_count);
+		for (auto& offset : _offsets)
+			offset = _input.read_bytes<u64>();
+		// every chunk has to lie inside the data
+		unsigned blocksize = _symtable.bits_per_block();
+		u64 data_size = bitpack::packed_size(blocksize, _orig_symbol_count);
+		for (u64 chunk = 0; chunk < _offsets.size(); chunk++) {
+			u64 chunk_bytes = bitpack::packed_size(blocksize, chunk_symbols(chunk));
+			if (_offsets[chunk] > data_size || chunk_bytes > data_size - _offsets[chunk])
+				throw runtime_error("Malformed data - chunk offset points outside of the data.");
+		}
+	}
+
+	virtual void decompress() override
+	{
+		unsigned blocksize = _symtable.bits_per_block();
+		u8 table[256];
+		fill_symbol_table(table);
+		const u8* data = _input.pointer();
+		_pool.parallel_for(_offsets.size(), [&](u64 chunk) {
+			if (_checksums)
+				unpack_segment(chunk, table, data + _offsets[chunk]);	// throws
+			else
+				bitpack::unpack_block(blocksize, data + _offsets[chunk], chunk_symbols(chunk),
+									  table, _output + chunk * _chunk_size);
+		});
+	}
+
+	virtual u64 segment_symbols() const override { return _chunk_size; }
+
+private:
+	u64 chunk_symbols(u64 chunk) const
+	{
+		return std::min(_chunk_size, _orig_symbol_count - chunk * _chunk_size);
+	}
+
+	ThreadPool		_pool;
+	u64				_chunk_size{ 0 };
+	vector<u64>		_offsets;
 };
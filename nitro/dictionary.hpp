@@ -0,0 +1,237 @@
+#pragma once
+
+#include "common.hpp"
+#include "checksum.hpp"
+#include "lz.hpp"
+
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+
+/*
+ * Trained dictionaries (nitro_train_dictionary) and frames compressed against them (DICT)
+ *
+ * A dictionary is a few KiB of content the records of a corpus share, picked from
+ * samples: segments of the samples are scored by how many samples contain their
+ * k-mers and taken greedily, the k-mers of a taken segment no longer count.
+ * The best segments go last, closest to the data, where the offsets are shortest.
+ *
+ * A DICT frame is an LZ frame whose history starts with the dictionary content,
+ * so even the first bytes of a small record are matches:
+ *	- encoder type (1 byte)
+ *	- dictionary ID (4 bytes, CRC32C of the content)
+ *	- input length (LEB128 varint)
+ *	- LZ tokens (see lz.hpp), offsets past the start of the data reach into the dictionary
+ *
+ * Serialized dictionary:
+ *	- magic (4 bytes)
+ *	- dictionary ID (4 bytes)
+ *	- content length (8 bytes)
+ *	- content
+ */
+namespace dictionary
+{
+	const u32	magic = 0x4349444E;		// "NDIC"
+	const u64	sizeof_id = sizeof(u32);
+	const u64	sizeof_header = sizeof(magic) + sizeof_id + sizeof(u64);
+	const u64	max_frame_header_size = protocol::sizeof_encoder_type + sizeof_id + varint::max_size;
+	const u64	default_capacity = 32 << 10;
+	const u64	max_capacity = lz::window / 2 - 1;
+	const u64	kmer = 8;				// bytes per k-mer
+	const u64	segment = 64;			// bytes per candidate segment
+	const u64	stride = 16;			// distance of the candidate segments
+
+	// CRC32C of the content, never 0 (0 means no dictionary)
+	inline u32 id(const u8* content, u64 len)
+	{
+		u32 crc = crc32c::extend(0, content, len);
+		return crc ? crc : 1;
+	}
+
+	inline u64 max_encoded_size(u64 len)
+	{
+		return lz::max_encoded_size(len) - lz::sizeof_header + max_frame_header_size;
+	}
+
+	inline vector<u8> train(const NitroBuffer* samples, u64 count, u64 capacity)
+	{
+		if (!samples || !count)
+			throw runtime_error("invalid input (samples nullptr or 0 count)");
+		capacity = std::min(capacity ? capacity : default_capacity, max_capacity);
+		// number of samples holding each k-mer
+		struct Documents
+		{
+			u32		count;
+			u32		last;	// sample index + 1 which counted it last
+		};
+		std::unordered_map<u64, Documents> kmers;
+		auto key = [](const u8* p) {
+			u64 k;
+			memcpy(&k, p, sizeof(k));
+			return k;
+		};
+		for (u64 s = 0; s < count; s++) {
+			if (!samples[s].data && samples[s].len)
+				throw runtime_error("invalid input (sample nullptr)");
+			for (u64 p = 0; p + kmer <= samples[s].len; p++) {
+				auto& documents = kmers[key(samples[s].data + p)];
+				if (documents.last != s + 1) {
+					documents.last = (u32)(s + 1);
+					documents.count++;
+				}
+			}
+		}
+		// k-mers of one sample only are worth nothing, covered ones neither
+		struct Candidate
+		{
+			u64		score;
+			u64		sample;
+			u64		offset;
+			u64		len;
+			bool operator<(const Candidate& other) const { return score < other.score; }
+		};
+		auto score = [&](const Candidate& c) {
+			u64 total = 0;
+			for (u64 p = 0; p + kmer <= c.len; p++) {
+				u32 documents = kmers[key(samples[c.sample].data + c.offset + p)].count;
+				total += documents > 1 ? documents : 0;
+			}
+			return total;
+		};
+		std::priority_queue<Candidate> queue;
+		for (u64 s = 0; s < count; s++) {
+			for (u64 offset = 0; offset + kmer <= samples[s].len; offset += stride) {
+				Candidate c{ 0, s, offset, std::min(segment, samples[s].len - offset) };
+				c.score = score(c);
+				if (c.score)
+					queue.push(c);
+			}
+		}
+		// lazy greedy: a candidate whose score did not drop below the next one is the best
+		vector<Candidate> taken;
+		u64 size = 0;
+		while (!queue.empty() && size < capacity) {
+			Candidate c = queue.top();
+			queue.pop();
+			c.score = score(c);
+			if (!c.score)
+				continue;
+			if (!queue.empty() && c.score < queue.top().score) {
+				queue.push(c);
+				continue;
+			}
+			for (u64 p = 0; p + kmer <= c.len; p++)
+				kmers[key(samples[c.sample].data + c.offset + p)].count = 0;
+			c.len = std::min(c.len, capacity - size);
+			taken.push_back(c);
+			size += c.len;
+		}
+		if (!size)
+			throw runtime_error("The samples share no content to train a dictionary from.");
+		vector<u8> content;
+		content.reserve(size);
+		for (auto c = taken.rbegin(); c != taken.rend(); ++c)
+			content.insert(content.end(), samples[c->sample].data + c->offset, samples[c->sample].data + c->offset + c->len);
+		return content;
+	}
+
+	inline NitroData serialize(const vector<u8>& content)
+	{
+		u64 len = sizeof_header + content.size();
+		u8* output = reinterpret_cast<u8*>(malloc(len));
+		if (!output)
+			throw runtime_error("Memory allocation failed");
+		u32 dictionary_id = id(content.data(), content.size());
+		u64 content_len = content.size();
+		memcpy(output, &magic, sizeof(magic));
+		memcpy(output + sizeof(magic), &dictionary_id, sizeof_id);
+		memcpy(output + sizeof(magic) + sizeof_id, &content_len, sizeof(u64));
+		memcpy(output + sizeof_header, content.data(), content.size());
+		return NitroData{ output, len, NitroEncoderType::DICT };
+	}
+
+	/* checks a serialized dictionary, returns its content */
+	inline std::pair<const u8*, u64> parse(const u8* data, u64 len)
+	{
+		u32 m, dictionary_id;
+		u64 content_len;
+		if (!data || len < sizeof_header)
+			throw runtime_error("Malformed dictionary - input is shorter than the dictionary header.");
+		memcpy(&m, data, sizeof(m));
+		memcpy(&dictionary_id, data + sizeof(m), sizeof_id);
+		memcpy(&content_len, data + sizeof(m) + sizeof_id, sizeof(u64));
+		if (m != magic)
+			throw runtime_error("Malformed dictionary - not a nitro dictionary.");
+		if (!content_len || content_len != len - sizeof_header || content_len > max_capacity)
+			throw runtime_error("Malformed dictionary - content length does not match the input.");
+		if (id(data + sizeof_header, content_len) != dictionary_id)
+			throw runtime_error("Malformed dictionary - ID does not match the content.");
+		return { data + sizeof_header, content_len };
+	}
+}
+
+class DictEncoder : public LzEncoder
+{
+public:
+	DictEncoder(const u8* input, uint64_t len, const lz::History& history, u32 id) :
+		LzEncoder(input, len, lz::level(), &history, NitroEncoderType::DICT),
+		_id(id)
+	{
+	}
+	virtual ~DictEncoder() {}
+
+protected:
+	virtual u64 max_header_size() const override { return dictionary::max_frame_header_size; }
+	virtual void write_header() override
+	{
+		u8 header[dictionary::max_frame_header_size];
+		header[0] = (u8)NitroEncoderType::DICT;
+		memcpy(header + protocol::sizeof_encoder_type, &_id, dictionary::sizeof_id);
+		u8* end = varint::write(header + protocol::sizeof_encoder_type + dictionary::sizeof_id, _len);
+		_output.write_bytes(header, (int)(end - header));
+	}
+
+private:
+	u32		_id;
+};
+
+
+class DictDecoder : public LzDecoder
+{
+public:
+	/* history may be nullptr - then only decoded_size works */
+	DictDecoder(const u8* encoded, uint64_t len, const lz::History* history, u32 id) :
+		LzDecoder(encoded, len, history, NitroEncoderType::DICT),
+		_id(id)
+	{
+	}
+	virtual ~DictDecoder() {}
+
+	virtual NitroData decode() override
+	{
+		decoded_size();		// throws - reads the metadata
+		if (!_history)
+			throw runtime_error("Frame references a dictionary - decode it through a context with the dictionary loaded.");
+		return LzDecoder::decode();
+	}
+
+protected:
+	virtual void read_header() override
+	{
+		const u8* start = _input.pointer();
+		const u8* end = start + _input.remaining_bytes();
+		if (_input.remaining_bytes() < protocol::sizeof_encoder_type + dictionary::sizeof_id ||
+			(NitroEncoderType)start[0] != NitroEncoderType::DICT)
+			throw runtime_error("Malformed protocol - invalid dictionary frame header.");
+		u32 frame_id;
+		memcpy(&frame_id, start + protocol::sizeof_encoder_type, dictionary::sizeof_id);
+		if (_history && frame_id != _id)
+			throw runtime_error("Frame was encoded against a different dictionary.");
+		const u8* p = start + protocol::sizeof_encoder_type + dictionary::sizeof_id;
+		_orig_len = varint::read(p, end);	// throws
+		_input.skip(p - start);
+	}
+
+private:
+	u32		_id;
+};
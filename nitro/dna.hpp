@@ -0,0 +1,310 @@
+#pragma once
+
+#include "common.hpp"
+#include "bitpack.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+
+#include <array>
+#include <cstring>
+
+/*
+ * 2-bit nucleotide encoding (DNA)
+ *
+ * A, C, G and T are packed at a fixed 2 bits whatever else appears in the input,
+ * every other symbol (N, IUPAC codes, lower case) goes to a sparse exception list
+ * and its slot in the packed data holds a don't care code. The code of a base is
+ * (byte >> 1) & 3, so the packer needs no table lookup: A = 0, C = 1, T = 2, G = 3.
+ * Symbol i sits at bit 2 * i of the packed data, the same layout as a BLOCK
+ * frame of width 2, so random access stays O(1) for the bases.
+ *
+ * Layout:
+ *	- encoder type (1 byte)
+ *	- input length (8 bytes)
+ *	- number of exception runs (8 bytes)
+ *	- packed codes (packed_size(2, input length) bytes)
+ *	- exception runs, LEB128 varints: distance from the end of the previous run,
+ *	  length - 1, then the symbol (1 byte)
+ */
+namespace dna
+{
+	const u64	sizeof_header = protocol::sizeof_encoder_type + 2 * sizeof(u64);
+	const u8	bases[4] = { 'A', 'C', 'T', 'G' };		// code -> symbol
+
+	struct Run
+	{
+		u64		position;
+		u64		length;
+		u8		symbol;
+	};
+
+	inline bool is_base(u8 sym)
+	{
+		return sym == 'A' || sym == 'C' || sym == 'G' || sym == 'T';
+	}
+
+	// flat code -> symbol table for bitpack::unpack_block
+	inline void fill_symbol_table(u8* table)
+	{
+		memset(table, 0, 256);
+		memcpy(table, bases, sizeof(bases));
+	}
+
+	// every byte an exception: a run costs at most its length + 2 bytes
+	inline u64 max_encoded_size(u64 len)
+	{
+		return sizeof_header + bitpack::packed_size(2, len) + 3 * len;
+	}
+
+	inline void add_exception(vector<Run>& runs, u64 position, u8 symbol)
+	{
+		if (!runs.empty() && runs.back().symbol == symbol && runs.back().position + runs.back().length == position)
+			runs.back().length++;
+		else
+			runs.push_back(Run{ position, 1, symbol });
+	}
+
+	inline void pack_scalar(const u8* in, u64 first, u64 count, u8* out, vector<Run>& runs)
+	{
+		static const auto codes = []() {
+			std::array<u8, 256> c;
+			for (unsigned sym = 0; sym < 256; sym++)
+				c[sym] = (sym >> 1) & 3;
+			return c;
+		}();
+		bitpack::pack<2>(in + first, count, codes.data(), out + first / 4);
+		for (u64 i = first; i < first + count; i++) {
+			if (!is_base(in[i]))
+				add_exception(runs, i, in[i]);
+		}
+	}
+
+#ifdef NITRO_X86_SIMD
+	/*
+	 * 32 symbols per iteration: four compares find the exceptions, the codes are
+	 * merged pairwise with multiply-adds (2 -> 4 -> 8 bits) and the low byte of
+	 * every 32-bit lane is gathered into 8 output bytes.
+	 * Returns the number of symbols packed (a multiple of 32).
+	 */
+	__attribute__((target("avx2")))
+	inline u64 pack_avx2(const u8* in, u64 count, u8* out, vector<Run>& runs)
+	{
+		const __m256i a = _mm256_set1_epi8('A'), c = _mm256_set1_epi8('C');
+		const __m256i g = _mm256_set1_epi8('G'), t = _mm256_set1_epi8('T');
+		const __m256i three = _mm256_set1_epi8(3);
+		const __m256i pairs = _mm256_set1_epi16(0x0401);
+		const __m256i quads = _mm256_set1_epi32(0x00100001);
+		const __m256i low_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+												   0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+		const __m256i lanes = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+		u64 done = 0;
+		for (; count - done >= 32; done += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(in + done));
+			__m256i base = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, a), _mm256_cmpeq_epi8(v, c)),
+										   _mm256_or_si256(_mm256_cmpeq_epi8(v, g), _mm256_cmpeq_epi8(v, t)));
+			u32 exceptions = ~(u32)_mm256_movemask_epi8(base);
+			while (exceptions) {
+				unsigned j = __builtin_ctz(exceptions);
+				add_exception(runs, done + j, in[done + j]);
+				exceptions &= exceptions - 1;
+			}
+			__m256i codes = _mm256_and_si256(_mm256_srli_epi16(v, 1), three);
+			__m256i packed = _mm256_madd_epi16(_mm256_maddubs_epi16(codes, pairs), quads);
+			packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(packed, low_bytes), lanes);
+			u64 word = (u64)_mm_cvtsi128_si64(_mm256_castsi256_si128(packed));
+			memcpy(out + done / 4, &word, sizeof(word));
+		}
+		return done;
+	}
+#endif // NITRO_X86_SIMD
+
+	/* packs count symbols to out (packed_size(2, count) bytes), collects the exception runs */
+	inline void pack(const u8* in, u64 count, u8* out, vector<Run>& runs)
+	{
+		u64 done = 0;
+#ifdef NITRO_X86_SIMD
+		if (bitpack::detect_simd() == bitpack::SimdLevel::AVX2)
+			done = pack_avx2(in, count, out, runs);
+#endif
+		pack_scalar(in, done, count - done, out, runs);
+	}
+
+	/* parses count exception runs from [in, end) - throws unless they fit len symbols and fill the list exactly */
+	inline vector<Run> read_exceptions(const u8* in, const u8* end, u64 count, u64 len)
+	{
+		if (count > (u64)(end - in))
+			throw runtime_error("Malformed data - exception count exceeds the exception list.");
+		vector<Run> runs(count);
+		u64 position = 0;
+		for (auto& run : runs) {
+			u64 gap = varint::read(in, end);
+			u64 length = varint::read(in, end);
+			if (in == end || gap > len - position || length >= len - position - gap)
+				throw runtime_error("Malformed data - exception runs past the end of the sequence.");
+			run.position = position + gap;
+			run.length = length + 1;
+			run.symbol = *in++;
+			position = run.position + run.length;
+		}
+		if (in != end)
+			throw runtime_error("Malformed data - exception list does not end with the frame.");
+		return runs;
+	}
+}
+
+class DnaEncoder : public Encoder
+{
+public:
+	DnaEncoder(const u8* input, uint64_t len) :
+		_input(input),
+		_len(len)
+	{
+		_type = NitroEncoderType::DNA;
+	}
+	virtual ~DnaEncoder() {}
+
+	virtual NitroData encode() override
+	{
+		if (!_input || !_len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		u64 packed_end = dna::sizeof_header + bitpack::packed_size(2, _len);
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < packed_end)
+				throw runtime_error("Output buffer is too small to hold the encoded result.");
+		}
+		else {
+			stats::Stage stage(&NitroStats::alloc_ns);
+			output = reinterpret_cast<u8*>(malloc(packed_end));
+			stats::allocation();
+			if (!output)
+				throw runtime_error("Memory allocation failed");
+		}
+		stats::bits_per_block(2);
+		try {
+			vector<dna::Run> runs;
+			{
+				stats::Stage stage(&NitroStats::code_ns);
+				dna::pack(_input, _len, output + dna::sizeof_header, runs);
+			}
+			vector<u8> list = serialize(runs);
+
+			u64 len = packed_end + list.size();
+			if (_external) {
+				if (_external_capacity < len)
+					throw runtime_error("Output buffer is too small to hold the encoded result.");
+			}
+			else {
+				u8* grown = reinterpret_cast<u8*>(realloc(output, len));
+				if (!grown)
+					throw runtime_error("Memory allocation failed");
+				output = grown;
+			}
+			u64 run_count = runs.size();
+			output[0] = (u8)NitroEncoderType::DNA;
+			memcpy(output + protocol::sizeof_encoder_type, &_len, sizeof(u64));
+			memcpy(output + protocol::sizeof_encoder_type + sizeof(u64), &run_count, sizeof(u64));
+			if (!list.empty())		// pure A, C, G, T - data() may be nullptr then
+				memcpy(output + packed_end, list.data(), list.size());
+			return NitroData{ output, len, NitroEncoderType::DNA };
+		}
+		catch (...) {
+			if (!_external)
+				free(output);
+			throw;
+		}
+	}
+
+private:
+	static vector<u8> serialize(const vector<dna::Run>& runs)
+	{
+		vector<u8> list;
+		u8 entry[2 * varint::max_size + 1];
+		u64 position = 0;
+		for (const auto& run : runs) {
+			u8* p = varint::write(entry, run.position - position);
+			p = varint::write(p, run.length - 1);
+			*p++ = run.symbol;
+			list.insert(list.end(), entry, p);
+			position = run.position + run.length;
+		}
+		return list;
+	}
+
+	const u8*	_input;
+	u64			_len;
+};
+
+
+class DnaDecoder : public Decoder
+{
+public:
+	DnaDecoder(const u8* encoded, uint64_t len) :
+		_encoded(encoded),
+		_len(len)
+	{
+	}
+	virtual ~DnaDecoder() {}
+
+	virtual NitroData decode() override
+	{
+		{
+			stats::Stage stage(&NitroStats::header_ns);
+			decoded_size();		// throws - reads the metadata
+		}
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < _orig_len)
+				throw runtime_error("Output buffer is too small to hold the decoded result");
+		}
+		else {
+			stats::Stage stage(&NitroStats::alloc_ns);
+			output = reinterpret_cast<u8*>(malloc(_orig_len));
+			stats::allocation();
+			if (!output)
+				throw runtime_error("Could not allocate enough space to hold decoded result");
+		}
+		stats::bits_per_block(2);
+		stats::Stage stage(&NitroStats::code_ns);
+		u8 table[256];
+		dna::fill_symbol_table(table);
+		bitpack::unpack_block(2, data(), _orig_len, table, output);
+		for (const auto& run : _runs)
+			memset(output + run.position, run.symbol, run.length);
+		return NitroData{ output, _orig_len, NitroEncoderType::DNA };
+	}
+
+	virtual u64 decoded_size() override
+	{
+		if (!_metadata_read) {
+			read_metadata();	// throws
+			_metadata_read = true;
+		}
+		return _orig_len;
+	}
+
+	const u8*					data() const { return _encoded + dna::sizeof_header; }
+	const vector<dna::Run>&		exceptions() const { return _runs; }
+
+private:
+	void read_metadata()
+	{
+		if (!_encoded || _len < dna::sizeof_header || (NitroEncoderType)_encoded[0] != NitroEncoderType::DNA)
+			throw runtime_error("Malformed protocol - invalid DNA frame header.");
+		u64 run_count;
+		memcpy(&_orig_len, _encoded + protocol::sizeof_encoder_type, sizeof(u64));
+		memcpy(&run_count, _encoded + protocol::sizeof_encoder_type + sizeof(u64), sizeof(u64));
+		if (!_orig_len || _orig_len > (_len - dna::sizeof_header) * 4)
+			throw runtime_error("Malformed protocol - input is shorter than the packed bases.");
+		const u8* list = data() + bitpack::packed_size(2, _orig_len);
+		if (list > _encoded + _len)
+			throw runtime_error("Malformed protocol - input is shorter than the packed bases.");
+		_runs = dna::read_exceptions(list, _encoded + _len, run_count, _orig_len);	// throws
+	}
+
+	const u8*			_encoded;
+	u64					_len;
+	u64					_orig_len{ 0 };
+	vector<dna::Run>	_runs;
+	bool				_metadata_read{ false };
+};
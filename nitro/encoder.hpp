@@ -1,6 +1,12 @@
 #pragma once
 
 #include "common.hpp"
+#include "bitpack.hpp"
+#include "checksum.hpp"
+#include "histogram.hpp"
+#include "threadpool.hpp"
+
+#include <array>
 
 
 class Encoder
@@ -9,20 +15,41 @@ public:
 	virtual ~Encoder() {}
     virtual NitroData	encode() = 0;
 	NitroEncoderType			get_my_type() const { return this->_type; }
+	// encode into a caller provided buffer instead of a malloc-ed one
+	void						set_output(u8* buffer, u64 capacity)
+	{
+		_external = buffer;
+		_external_capacity = capacity;
+	}
+	// byte counts of the input already computed by the caller (counts[256]) - saves the histogram pass
+	void						set_histogram(const u64* counts) { _histogram = counts; }
 protected:
 	NitroEncoderType			_type;
+	u8*							_external{ nullptr };
+	u64							_external_capacity{ 0 };
+	const u64*					_histogram{ nullptr };
 };
 
+/*
+ * Creates the encoder of the given type
+ * Returns nullptr for unknown types. (defined in nitro.cpp)
+ */
+unique_ptr<Encoder> make_encoder(NitroEncoderType type, const u8* input, u64 len, unsigned threads);
+
 class BlockEncoder : public Encoder
 {
 public:
-	BlockEncoder(const u8* input, uint64_t len) : 
-		_input(input),
-		_len_of_input(len)
+	BlockEncoder(const u8* input, uint64_t len) :
+		BlockEncoder(input, len, NitroEncoderType::BLOCK)
 	{
-		_type = NitroEncoderType::BLOCK;
 	}
 	virtual ~BlockEncoder() {}
+	// worst case size of the encoded data (all 256 symbols present, checksums on)
+	static u64 max_encoded_size(u64 len)
+	{
+		return protocol::sizeof_encoder_type + protocol::sizeof_table_entry_size + 256 * 2 + sizeof(u64) + len +
+			   checksum::segment_count(len, protocol::default_chunk_size) * checksum::sizeof_checksum;
+	}
 	virtual NitroData encode() override
 	{
 		if (!_input || !_len_of_input)
@@ -30,18 +57,30 @@ public:
 #ifdef DEBUG
 		printf("------------ENCODING-----------------\n");
 #endif // DEBUG
-		build_symtable();
-		alloc_output();	// throws
+		{
+			stats::Stage stage(&NitroStats::model_ns);
+			build_symtable();
+		}
+		stats::bits_per_block(_symtable.bits_per_block());
+		{
+			stats::Stage stage(&NitroStats::alloc_ns);
+			alloc_output();	// throws
+		}
 #ifdef DEBUG
 		printf("Allocated bytes for encoding: %llu\n", _output.size());
 		printf("Writing metadata\n");
 #endif // DEBUG
-		write_metadata();
+		{
+			stats::Stage stage(&NitroStats::header_ns);
+			write_metadata();
+		}
 #ifdef DEBUG
 		printf("Compressing...\n");
 #endif // DEBUG
-
-		compress();
+		{
+			stats::Stage stage(&NitroStats::code_ns);
+			compress();
+		}
 #ifdef DEBUG
 		printf("Done.\n");
 #endif // DEBUG
@@ -51,64 +90,112 @@ public:
 		return NitroData{ data, len, get_my_type() };
 	}
 
-private:
+protected:
+	BlockEncoder(const u8* input, uint64_t len, NitroEncoderType type) :
+		_input(input),
+		_len_of_input(len),
+		_checksum(checksum::enabled())
+	{
+		_type = type;
+	}
+
 	void write_encoder_type()
 	{
 		u8 type = static_cast<u8>(get_my_type());
 		_output.write_bytes(&type, protocol::sizeof_encoder_type);
 	}
-	void write_metadata()
+	virtual void write_metadata()
 	{
 		write_encoder_type();
 		auto& table = _symtable;
 		assert(table.size() <= 256);
 		u16 entry_count = (u16)table.size();			// cast should be safe now
+		if (_checksum)
+			entry_count |= checksum::flag;
 		_output.write_bytes(&entry_count, protocol::sizeof_table_entry_size);		// write how many entries we have in the table
-		// now write each entry (sym - code)
-		for (const auto& entry : table.get()) {
-			u8 sym = entry.first;
-			u8 code = entry.second;
+		// now write each entry (sym - code) in increasing symbol order
+		table.for_each([this](u8 sym, u8 code) {
 			_output.write_bytes(&code, 1);
 			_output.write_bytes(&sym, 1);
-		}
+		});
 		// now write the length of the input - use 8 bytes
 		_output.write_bytes(&_len_of_input, sizeof(_len_of_input));
+		write_layout();
+		if (_checksum) {
+			// the list is filled in while packing
+			_checksums = _output.pointer();
+			_header_crc = crc32c::extend(0, _output.begin(), _checksums - _output.begin());
+			_output.skip(checksum_size());
+		}
+	}
+	// frame specific fields between the input length and the data
+	virtual void write_layout() {}
+	// symbols covered by one checksum
+	virtual u64 segment_symbols() const { return protocol::default_chunk_size; }
+	u64 checksum_size() const
+	{
+		return _checksum ? checksum::segment_count(_len_of_input, segment_symbols()) * checksum::sizeof_checksum : 0;
 	}
-	void compress()
+	// packs segment number segment of the input to out and records its checksum
+	u8* pack_segment(u64 segment, const u8* codes, u8* out)
+	{
+		u64 first = segment * segment_symbols();
+		u32 crc = _header_crc;
+		out = checksum::pack_block(_symtable.bits_per_block(), _input + first,
+								   std::min(segment_symbols(), _len_of_input - first), codes, out, crc);
+		memcpy(_checksums + segment * checksum::sizeof_checksum, &crc, checksum::sizeof_checksum);
+		return out;
+	}
+	void fill_code_table(u8* codes) const
+	{
+		// flat code table - no hash lookup per input byte
+		memcpy(codes, _symtable.code_table(), 256);
+	}
+	virtual void compress()
 	{
 		try
 		{
 			// encode and write the input
 			unsigned blocksize = _symtable.bits_per_block();
-			const u8* pinput = _input;
-			// iterate over the input and write the code bit blocks to the bitstream
-			for (uint64_t i = 0; i < _len_of_input; i++) {
-				u8 sym = *pinput++;
-				u8 code = _symtable[sym];
-				// write the code block 
-				for (int bitidx = 0; bitidx < blocksize; bitidx++) {
-					_output.write_bit(0x1 & (code >> bitidx));
-				}
+			u8 codes[256];
+			fill_code_table(codes);
+			u8* start = _output.pointer();
+			u8* end = start;
+			if (_checksum) {
+				for (u64 segment = 0; segment * segment_symbols() < _len_of_input; segment++)
+					end = pack_segment(segment, codes, end);
 			}
-			// we need to flush the last 'buffer' byte which might hold the remaining bits
-			// when decoding this is an EDGE CASE
+			else {
+				end = bitpack::pack_block(blocksize, _input, _len_of_input, codes, start);
+			}
+			_output.skip(end - start);
+			// the packer already wrote the last partially filled byte
+			// flush only does the size check in debug builds
 			_output.flush();
 		}
 		catch (const runtime_error& err)
 		{
 			cerr << err.what() << endl;
-			_output.release();
+			if (!_external)
+				_output.release();
 			throw err;
 		}
 	}
-	void build_symtable()
+	virtual void build_symtable()
 	{
-		auto& _table = _symtable;
+		// codes are assigned in increasing symbol order
+		bool present[256];
+		if (_histogram) {
+			for (unsigned sym = 0; sym < 256; sym++)
+				present[sym] = _histogram[sym] != 0;
+		}
+		else {
+			histogram::present(_input, _len_of_input, present);
+		}
 		u8 encoding = 0;
-		for (size_t i = 0; i < _len_of_input; i++) {
-			u8 ch = _input[i];
-			if (!_table.find(ch))
-				_table.insert(ch, encoding++);
+		for (unsigned sym = 0; sym < 256; sym++) {
+			if (present[sym])
+				_symtable.insert((u8)sym, encoding++);
 		}
 #ifdef DEBUG
 		//_symtable.debug_print(false);
@@ -139,7 +226,14 @@ private:
 			bytes_for_data++;
 
 		u64 space_required =  header_size() + bytes_for_data;
+		if (_external) {
+			if (_external_capacity < space_required)
+				throw runtime_error("Output buffer is too small to hold the encoded result.");
+			_output.init(_external, space_required);
+			return;
+		}
 		u8* buffer = (u8*) malloc(space_required);
+		stats::allocation();
 		if (!buffer) {
 			fprintf(stderr,
 					"Allocation failed for %llu bytes for holding the encoded result.\n",
@@ -149,17 +243,125 @@ private:
 		_output.init(buffer, space_required);
 	}
 
-	inline unsigned header_size() const
+	virtual u64 header_size() const
 	{
 		return	protocol::sizeof_encoder_type + protocol::sizeof_table_entry_size + 
-				_symtable.raw_size() + sizeof(_len_of_input);
+				_symtable.raw_size() + sizeof(_len_of_input) + checksum_size();
 	}
 
-private:
+protected:
 	const u8*			_input;
 	OutputBitStream		_output;
 	const u64			_len_of_input;
 	SymbolTable			_symtable;
+	bool				_checksum;
+	u8*					_checksums{ nullptr };
+	u32					_header_crc{ 0 };
 };
 
 
+/*
+ * Block encoding split into independently decodable chunks
+ *
+ * Layout:
+ *	- encoder type, symbol table and input length exactly as in BLOCK
+ *	- number of symbols per chunk (8 bytes, multiple of 8 so chunks are byte aligned)
+ *	- chunk count (4 bytes)
+ *	- byte offset of each chunk relative to the start of the data (8 bytes each)
+ *	- CRC32C of each chunk (4 bytes each) if the frame has checksums (see checksum.hpp)
+ *	- data
+ *
+ * All chunks share the one symbol table. Building the table, packing and unpacking
+ * are spread over a worker pool one chunk at a time.
+ */
+class ChunkedBlockEncoder : public BlockEncoder
+{
+public:
+	ChunkedBlockEncoder(const u8* input, uint64_t len, unsigned threads,
+						u64 chunk_size = protocol::default_chunk_size) :
+		BlockEncoder(input, len, NitroEncoderType::BLOCK_CHUNKED),
+		_pool(threads),
+		_chunk_size(chunk_size)
+	{
+		assert(_chunk_size && _chunk_size % 8 == 0);
+		_chunk_count = (_len_of_input + _chunk_size - 1) / _chunk_size;
+	}
+	virtual ~ChunkedBlockEncoder() {}
+	static u64 max_encoded_size(u64 len, u64 chunk_size = protocol::default_chunk_size)
+	{
+		u64 chunk_count = (len + chunk_size - 1) / chunk_size;
+		return BlockEncoder::max_encoded_size(len) + sizeof(u64) + sizeof(u32) +
+			   chunk_count * (sizeof(u64) + checksum::sizeof_checksum);
+	}
+
+protected:
+	virtual void build_symtable() override
+	{
+		if (_chunk_count > UINT32_MAX)
+			throw runtime_error("Too many chunks - increase the chunk size.");
+		// every worker marks the symbols present in its chunk, the results are merged
+		// codes are assigned in increasing symbol order so the output does not depend
+		// on the thread count
+		vector<std::array<bool, 256>> seen(_chunk_count);
+		_pool.parallel_for(_chunk_count, [&](u64 chunk) {
+			histogram::present(_input + chunk * _chunk_size, chunk_symbols(chunk), seen[chunk].data());
+		});
+		u8 encoding = 0;
+		for (unsigned sym = 0; sym < 256; sym++) {
+			for (const auto& present : seen) {
+				if (present[sym]) {
+					_symtable.insert((u8)sym, encoding++);
+					break;
+				}
+			}
+		}
+		assert(_symtable.size() <= 256);
+	}
+
+	virtual void write_layout() override
+	{
+		u32 count = (u32)_chunk_count;
+		_output.write_bytes(&_chunk_size, sizeof(_chunk_size));
+		_output.write_bytes(&count, sizeof(count));
+		u64 chunk_bytes = bitpack::packed_size(_symtable.bits_per_block(), _chunk_size);
+		for (u64 chunk = 0; chunk < _chunk_count; chunk++) {
+			u64 offset = chunk * chunk_bytes;
+			_output.write_bytes(&offset, sizeof(offset));
+		}
+	}
+
+	virtual void compress() override
+	{
+		unsigned blocksize = _symtable.bits_per_block();
+		u8 codes[256];
+		fill_code_table(codes);
+		u8* data = _output.pointer();
+		u64 chunk_bytes = bitpack::packed_size(blocksize, _chunk_size);
+		_pool.parallel_for(_chunk_count, [&](u64 chunk) {
+			if (_checksum)
+				pack_segment(chunk, codes, data + chunk * chunk_bytes);
+			else
+				bitpack::pack_block(blocksize, _input + chunk * _chunk_size, chunk_symbols(chunk),
+									codes, data + chunk * chunk_bytes);
+		});
+		_output.skip(bitpack::packed_size(blocksize, _len_of_input));
+		_output.flush();
+	}
+
+	virtual u64 header_size() const override
+	{
+		return BlockEncoder::header_size() + sizeof(_chunk_size) + sizeof(u32) + _chunk_count * sizeof(u64);
+	}
+
+	virtual u64 segment_symbols() const override { return _chunk_size; }
+
+private:
+	u64 chunk_symbols(u64 chunk) const
+	{
+		return std::min(_chunk_size, _len_of_input - chunk * _chunk_size);
+	}
+
+	ThreadPool		_pool;
+	u64				_chunk_size;
+	u64				_chunk_count{ 0 };
+};
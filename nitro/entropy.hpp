@@ -0,0 +1,208 @@
+#pragma once
+
+#include "common.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+#include "histogram.hpp"
+#include "model.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * Common frame of the order-0 entropy coders (RANGE, RANS)
+ *
+ * Layout:
+ *	- encoder type (1 byte)
+ *	- frequency table (see FrequencyTable)
+ *	- input length (8 bytes)
+ *	- coder specific data
+ *
+ * The derived classes only implement the coding of the data.
+ */
+namespace entropy
+{
+	inline u64 max_header_size()
+	{
+		return protocol::sizeof_encoder_type + FrequencyTable::max_serialized_size() + sizeof(u64);
+	}
+
+	/*
+	 * Most symbols data_size bytes of coded data can hold: a symbol of frequency f costs
+	 * log2(scale / f) >= (scale - f) / scale bits, the most frequent one the least.
+	 * Unbounded for a single symbol model, which costs nothing per symbol.
+	 */
+	inline u64 max_symbols(const FrequencyTable& model, u64 data_size)
+	{
+		u32 top = 0;
+		for (unsigned sym = 0; sym < 256; sym++)
+			top = std::max(top, model.freq((u8)sym));
+		if (top >= FrequencyTable::scale)
+			return ~0ull;
+		unsigned __int128 bits = ((unsigned __int128)data_size + sizeof(u64)) * 8;	// a word of slack for the flush
+		unsigned __int128 symbols = bits * FrequencyTable::scale / (FrequencyTable::scale - top);
+		return symbols > ~0ull ? ~0ull : (u64)symbols;
+	}
+}
+
+class EntropyEncoder : public Encoder
+{
+public:
+	virtual ~EntropyEncoder() {}
+
+	virtual NitroData encode() override
+	{
+		if (!_input || !_len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		{
+			stats::Stage stage(&NitroStats::model_ns);
+			u64 counts[256] = { 0 };
+			if (_histogram)
+				memcpy(counts, _histogram, sizeof(counts));
+			else
+				histogram::count(_input, _len, counts);
+			_model.normalize(counts);
+		}
+
+		u64 capacity = max_data_size() + entropy::max_header_size();
+		u8* output = _external;
+		if (output) {
+			capacity = _external_capacity;
+		}
+		else {
+			stats::Stage stage(&NitroStats::alloc_ns);
+			output = reinterpret_cast<u8*>(malloc(capacity));
+			stats::allocation();
+			if (!output)
+				throw runtime_error("Memory allocation failed");
+		}
+		try {
+			u64 header = protocol::sizeof_encoder_type + _model.serialized_size() + sizeof(u64);
+			if (capacity < header)
+				throw runtime_error("Output buffer is too small to hold the encoded result.");
+			u8* p;
+			{
+				stats::Stage stage(&NitroStats::header_ns);
+				output[0] = (u8)get_my_type();
+				p = _model.write(output + protocol::sizeof_encoder_type);
+				memcpy(p, &_len, sizeof(u64));
+				p += sizeof(u64);
+			}
+			u64 len;
+			{
+				stats::Stage stage(&NitroStats::code_ns);
+				len = compress(p, output + capacity) - output;	// throws
+			}
+			if (!_external)
+				output = reinterpret_cast<u8*>(realloc(output, len));	// shrinking - can not fail
+			return NitroData{ output, len, get_my_type() };
+		}
+		catch (...) {
+			if (!_external)
+				free(output);
+			throw;
+		}
+	}
+
+protected:
+	EntropyEncoder(const u8* input, uint64_t len, NitroEncoderType type) :
+		_input(input),
+		_len(len)
+	{
+		_type = type;
+	}
+
+	// worst case size of the coded data
+	virtual u64	max_data_size() const = 0;
+	/* codes the input into [out, end), returns the end of the written data - throws if it does not fit */
+	virtual u8*	compress(u8* out, u8* end) = 0;
+
+	const u8*		_input;
+	u64				_len;
+	FrequencyTable	_model;
+};
+
+
+class EntropyDecoder : public Decoder
+{
+public:
+	virtual ~EntropyDecoder() {}
+
+	virtual NitroData decode() override
+	{
+		{
+			stats::Stage stage(&NitroStats::header_ns);
+			decoded_size();		// throws - reads the metadata
+		}
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < _orig_len)
+				throw runtime_error("Output buffer is too small to hold the decoded result");
+		}
+		else {
+			stats::Stage stage(&NitroStats::alloc_ns);
+			output = reinterpret_cast<u8*>(malloc(_orig_len));
+			stats::allocation();
+			if (!output)
+				throw runtime_error("Could not allocate enough space to hold decoded result");
+		}
+		try {
+			stats::Stage stage(&NitroStats::code_ns);
+			decompress(output);		// throws
+		}
+		catch (...) {
+			if (!_external)
+				free(output);
+			throw;
+		}
+		return NitroData{ output, _orig_len, _type };
+	}
+
+	virtual u64 decoded_size() override
+	{
+		if (!_metadata_read) {
+			read_metadata();	// throws
+			_metadata_read = true;
+		}
+		return _orig_len;
+	}
+
+protected:
+	EntropyDecoder(const u8* encoded, uint64_t len, NitroEncoderType type) :
+		_type(type),
+		_encoded(encoded),
+		_len(len)
+	{
+	}
+
+	// smallest valid size of the coded data
+	virtual u64		min_data_size() const = 0;
+	/* decodes the data [_data, _encoded + _len) - throws on malformed data */
+	virtual void	decompress(u8* output) = 0;
+
+	NitroEncoderType	_type;
+	const u8*			_encoded;
+	u64					_len;
+	const u8*			_data{ nullptr };
+	FrequencyTable		_model;
+	u64					_orig_len{ 0 };
+
+private:
+	void read_metadata()
+	{
+		if (!_encoded || !_len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		if ((NitroEncoderType)_encoded[0] != _type)
+			throw runtime_error("Wrong decoder for indicated encoder.");
+		const u8* end = _encoded + _len;
+		const u8* p = _model.read(_encoded + protocol::sizeof_encoder_type, end);	// throws
+		if ((u64)(end - p) < sizeof(u64) + min_data_size())
+			throw runtime_error("Malformed protocol - input is shorter than the metadata.");
+		memcpy(&_orig_len, p, sizeof(u64));
+		_data = p + sizeof(u64);
+		if (!_orig_len || _orig_len > entropy::max_symbols(_model, end - _data))
+			throw runtime_error("Malformed protocol - length does not match the size of the coded data.");
+	}
+
+	bool	_metadata_read{ false };
+};
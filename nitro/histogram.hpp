@@ -0,0 +1,161 @@
+#pragma once
+
+#include "common.hpp"
+#include "bitpack.hpp"		// SIMD detection
+
+#include <cstring>
+
+/*
+ * Byte histograms
+ *
+ * count: occurrences of every byte value. The scalar kernel spreads consecutive
+ * bytes over 4 sub-histograms so runs of the same byte do not wait on the
+ * store of the previous increment (store-to-load forwarding stall).
+ * Small alphabets (at most 8 distinct values, e.g. DNA) take an AVX2 path which
+ * compares 32 bytes at a time against every symbol and accumulates the matches
+ * in byte lanes. It starts from the symbols seen in a scalar counted sample and
+ * falls back to the scalar kernel (after resampling) when a new symbol shows up.
+ *
+ * present: the set of byte values in the data - stops as soon as all 256 were seen.
+ */
+namespace histogram
+{
+	const u64	sample_size = 4096;
+	const u64	presence_block = 1 << 16;
+	const unsigned max_small_alphabet = 8;
+
+	// counts into u32 sub-histograms - len must be less than 2^32
+	inline void count_scalar_block(const u8* in, u64 len, u32 (*sub)[256])
+	{
+		u64 i = 0;
+		for (; i + 8 <= len; i += 8) {
+			u64 w;
+			memcpy(&w, in + i, sizeof(w));
+			sub[0][(u8)w]++;
+			sub[1][(u8)(w >> 8)]++;
+			sub[2][(u8)(w >> 16)]++;
+			sub[3][(u8)(w >> 24)]++;
+			sub[0][(u8)(w >> 32)]++;
+			sub[1][(u8)(w >> 40)]++;
+			sub[2][(u8)(w >> 48)]++;
+			sub[3][(u8)(w >> 56)]++;
+		}
+		for (; i < len; i++)
+			sub[0][in[i]]++;
+	}
+
+	inline void count_scalar(const u8* in, u64 len, u64* counts)
+	{
+		const u64 max_block = 1ull << 31;	// keeps the u32 sub-histograms from overflowing
+		u32 sub[4][256];
+		while (len) {
+			u64 n = len < max_block ? len : max_block;
+			memset(sub, 0, sizeof(sub));
+			count_scalar_block(in, n, sub);
+			for (unsigned sym = 0; sym < 256; sym++)
+				counts[sym] += (u64)sub[0][sym] + sub[1][sym] + sub[2][sym] + sub[3][sym];
+			in += n;
+			len -= n;
+		}
+	}
+
+#ifdef NITRO_X86_SIMD
+	/*
+	 * Counts the bytes of in as long as they are all one of the k symbols in syms.
+	 * Returns the number of bytes counted - a multiple of 32 unless it is len,
+	 * the vector holding the first foreign byte is not counted.
+	 */
+	__attribute__((target("avx2")))
+	inline u64	count_small_alphabet_avx2(const u8* in, u64 len, const u8* syms, unsigned k, u64* counts)
+	{
+		__m256i sym[max_small_alphabet];
+		for (unsigned j = 0; j < k; j++)
+			sym[j] = _mm256_set1_epi8((char)syms[j]);
+		const __m256i zero = _mm256_setzero_si256();
+		u64 done = 0;
+		bool foreign = false;
+		while (!foreign && len - done >= 32) {
+			// byte lane accumulators overflow after 255 vectors
+			u64 vectors = (len - done) / 32;
+			if (vectors > 255)
+				vectors = 255;
+			__m256i acc[max_small_alphabet];
+			for (unsigned j = 0; j < k; j++)
+				acc[j] = zero;
+			u64 v = 0;
+			for (; v < vectors; v++) {
+				__m256i data = _mm256_loadu_si256((const __m256i*)(in + done + v * 32));
+				__m256i matched = zero;
+				__m256i eq[max_small_alphabet];
+				for (unsigned j = 0; j < k; j++) {
+					eq[j] = _mm256_cmpeq_epi8(data, sym[j]);
+					matched = _mm256_or_si256(matched, eq[j]);
+				}
+				if ((u32)_mm256_movemask_epi8(matched) != 0xFFFFFFFFu) {
+					foreign = true;
+					break;
+				}
+				for (unsigned j = 0; j < k; j++)
+					acc[j] = _mm256_sub_epi8(acc[j], eq[j]);	// a match is -1
+			}
+			for (unsigned j = 0; j < k; j++) {
+				__m256i sums = _mm256_sad_epu8(acc[j], zero);	// 4 x 64-bit lane sums
+				counts[syms[j]] += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+								   _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+			}
+			done += v * 32;
+		}
+		return done;
+	}
+#endif // NITRO_X86_SIMD
+
+	/* counts[256] is incremented by the occurrences of every byte value */
+	inline void count(const u8* in, u64 len, u64* counts)
+	{
+#ifdef NITRO_X86_SIMD
+		if (bitpack::detect_simd() == bitpack::SimdLevel::AVX2) {
+			u64 pos = 0;
+			while (len - pos > sample_size) {
+				// the sample decides the alphabet for the vector path
+				count_scalar(in + pos, sample_size, counts);
+				pos += sample_size;
+				u8 syms[max_small_alphabet];
+				unsigned k = 0;
+				for (unsigned sym = 0; sym < 256 && k <= max_small_alphabet; sym++) {
+					if (counts[sym]) {
+						if (k < max_small_alphabet)
+							syms[k] = (u8)sym;
+						k++;
+					}
+				}
+				if (k > max_small_alphabet)
+					break;
+				pos += count_small_alphabet_avx2(in + pos, len - pos, syms, k, counts);
+			}
+			in += pos;
+			len -= pos;
+		}
+#endif // NITRO_X86_SIMD
+		count_scalar(in, len, counts);
+	}
+
+	/*
+	 * Marks the byte values present in the data in seen[256]
+	 * Returns the number of distinct values.
+	 */
+	inline unsigned present(const u8* in, u64 len, bool* seen)
+	{
+		u64 counts[256] = { 0 };
+		unsigned distinct = 0;
+		for (u64 pos = 0; pos < len && distinct < 256; pos += presence_block) {
+			u64 n = len - pos < presence_block ? len - pos : presence_block;
+			count(in + pos, n, counts);
+			distinct = 0;
+			for (unsigned sym = 0; sym < 256; sym++)
+				distinct += counts[sym] != 0;
+		}
+		for (unsigned sym = 0; sym < 256; sym++)
+			seen[sym] = counts[sym] != 0;
+		return distinct;
+	}
+}
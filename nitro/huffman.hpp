@@ -0,0 +1,390 @@
+#pragma once
+
+#include "common.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * Canonical Huffman coding (HUFFMAN)
+ *
+ * Layout:
+ *	- encoder type (1 byte)
+ *	- entry count (2 bytes)
+ *	- entries in increasing symbol order: symbol (1 byte), code length (1 byte)
+ *	- input length (8 bytes)
+ *	- codes, LSB first
+ *
+ * Only the code lengths are stored - the codes are canonical: ordered by
+ * (length, symbol), each one is the previous plus one shifted to its length.
+ * They are written bit reversed so the decoder can index its table with the
+ * next bits of the LSB first stream. Lengths are limited to 11 bits, the
+ * decoder table has 2^11 entries each holding as many (up to 3) whole symbols
+ * as fit into the 11 bits looked up.
+ * A single symbol gets the length 0 and no data is written.
+ */
+namespace huffman
+{
+	const unsigned	max_code_length = 11;
+	const u32		table_size = 1u << max_code_length;
+	const unsigned	max_symbols_per_entry = 3;
+	const u64		sizeof_entry = 2;
+
+	// worst case size of the encoded data (all 256 symbols present, every code max length)
+	inline u64 max_encoded_size(u64 len)
+	{
+		return protocol::sizeof_encoder_type + protocol::sizeof_table_entry_size + 256 * sizeof_entry +
+			   sizeof(u64) + (len * max_code_length + 7) / 8;
+	}
+
+	/*
+	 * Code lengths from the symbol counts, limited to max_code_length
+	 * The Huffman lengths over the limit are cut to the limit and the Kraft sum is
+	 * repaired by lengthening the rarest codes which are still short enough,
+	 * left over code space goes to the most frequent symbols.
+	 */
+	inline void build_lengths(const u64* counts, u8* lengths)
+	{
+		memset(lengths, 0, 256);
+		vector<std::pair<u64, unsigned>> leaves;
+		for (unsigned sym = 0; sym < 256; sym++) {
+			if (counts[sym])
+				leaves.emplace_back(counts[sym], sym);
+		}
+		std::sort(leaves.begin(), leaves.end());
+		u64 n = leaves.size();
+		if (n <= 1)
+			return;
+
+		// leaves and internal nodes are both created in increasing weight order,
+		// the two smallest are always at the front of one of the two queues
+		vector<u64> weight(2 * n - 1);
+		vector<u64> parent(2 * n - 1);
+		for (u64 i = 0; i < n; i++)
+			weight[i] = leaves[i].first;
+		u64 leaf = 0, node = n;
+		for (u64 k = n; k < 2 * n - 1; k++) {
+			u64 pick[2];
+			for (auto& p : pick)
+				p = (leaf < n && (node >= k || weight[leaf] <= weight[node])) ? leaf++ : node++;
+			weight[k] = weight[pick[0]] + weight[pick[1]];
+			parent[pick[0]] = parent[pick[1]] = k;
+		}
+		vector<u64> depth(2 * n - 1);
+		depth[2 * n - 2] = 0;
+		for (u64 k = 2 * n - 2; k-- > 0;)
+			depth[k] = depth[parent[k]] + 1;
+
+		const u32 full = table_size;	// Kraft sum of a complete code, in units of 2^-max_code_length
+		u32 kraft = 0;
+		for (u64 i = 0; i < n; i++) {
+			u8 len = (u8)std::min<u64>(depth[i], max_code_length);
+			lengths[leaves[i].second] = len;
+			kraft += full >> len;
+		}
+		while (kraft > full) {
+			// the rarest symbol among the longest ones below the limit
+			u64 best = n;
+			for (u64 i = 0; i < n; i++) {
+				u8 len = lengths[leaves[i].second];
+				if (len < max_code_length && (best == n || len > lengths[leaves[best].second]))
+					best = i;
+			}
+			u8& len = lengths[leaves[best].second];
+			len++;
+			kraft -= full >> len;
+		}
+		while (kraft < full) {
+			for (u64 i = n; i-- > 0;) {
+				u8& len = lengths[leaves[i].second];
+				if (len > 1 && (full >> len) <= full - kraft) {
+					kraft += full >> len;
+					len--;
+					break;
+				}
+			}
+		}
+	}
+
+	inline u32 reverse_bits(u32 code, unsigned len)
+	{
+		u32 r = 0;
+		for (unsigned i = 0; i < len; i++)
+			r |= ((code >> i) & 1) << (len - 1 - i);
+		return r;
+	}
+
+	/* canonical codes, bit reversed for the LSB first stream */
+	inline void build_codes(const u8* lengths, u32* codes)
+	{
+		u32 code = 0;
+		unsigned previous = 0;
+		for (unsigned len = 1; len <= max_code_length; len++) {
+			for (unsigned sym = 0; sym < 256; sym++) {
+				if (lengths[sym] != len)
+					continue;
+				code <<= len - previous;
+				previous = len;
+				codes[sym] = reverse_bits(code, len);
+				code++;
+			}
+		}
+	}
+
+	struct DecodeEntry
+	{
+		u32		symbols;	// up to 3 symbols, first in the lowest byte
+		u8		count;		// number of symbols
+		u8		bits;		// bits taken by all of them
+		u8		first_bits;	// bits taken by the first symbol
+	};
+
+	/* table[table_size] - lengths have to describe a complete code */
+	inline void build_decode_table(const u8* lengths, DecodeEntry* table)
+	{
+		u32 codes[256];
+		build_codes(lengths, codes);
+		u8 sym_of[table_size], len_of[table_size];
+		for (unsigned sym = 0; sym < 256; sym++) {
+			unsigned len = lengths[sym];
+			if (!len)
+				continue;
+			for (u32 i = codes[sym]; i < table_size; i += 1u << len) {
+				sym_of[i] = (u8)sym;
+				len_of[i] = (u8)len;
+			}
+		}
+		for (u32 i = 0; i < table_size; i++) {
+			DecodeEntry e{ 0, 0, 0, len_of[i] };
+			// the bits above the looked up ones are unknown - only whole codes count
+			while (e.count < max_symbols_per_entry) {
+				u32 next = i >> e.bits;
+				if (e.bits + len_of[next] > max_code_length)
+					break;
+				e.symbols |= (u32)sym_of[next] << (8 * e.count);
+				e.bits += len_of[next];
+				e.count++;
+			}
+			table[i] = e;
+		}
+	}
+}
+
+class HuffmanEncoder : public Encoder
+{
+public:
+	HuffmanEncoder(const u8* input, uint64_t len) :
+		_input(input),
+		_len(len)
+	{
+		_type = NitroEncoderType::HUFFMAN;
+	}
+	virtual ~HuffmanEncoder() {}
+
+	virtual NitroData encode() override
+	{
+		if (!_input || !_len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		u64 counts[256] = { 0 };
+		u16 entry_count = 0;
+		u64 data_bits = 0;
+		{
+			stats::Stage stage(&NitroStats::model_ns);
+			if (_histogram)
+				memcpy(counts, _histogram, sizeof(counts));
+			else
+				histogram::count(_input, _len, counts);
+			huffman::build_lengths(counts, _lengths);
+			huffman::build_codes(_lengths, _codes);
+			for (unsigned sym = 0; sym < 256; sym++) {
+				entry_count += counts[sym] != 0;
+				data_bits += counts[sym] * _lengths[sym];
+			}
+		}
+		u64 space_required = protocol::sizeof_encoder_type + protocol::sizeof_table_entry_size +
+							 entry_count * huffman::sizeof_entry + sizeof(u64) + (data_bits + 7) / 8;
+		u8* buffer = _external;
+		if (buffer) {
+			if (_external_capacity < space_required)
+				throw runtime_error("Output buffer is too small to hold the encoded result.");
+		}
+		else {
+			stats::Stage stage(&NitroStats::alloc_ns);
+			buffer = reinterpret_cast<u8*>(malloc(space_required));
+			stats::allocation();
+			if (!buffer)
+				throw runtime_error("Memory allocation failed");
+		}
+		_output.init(buffer, space_required);
+
+		{
+			stats::Stage stage(&NitroStats::header_ns);
+			u8 type = (u8)NitroEncoderType::HUFFMAN;
+			_output.write_bytes(&type, protocol::sizeof_encoder_type);
+			_output.write_bytes(&entry_count, protocol::sizeof_table_entry_size);
+			for (unsigned sym = 0; sym < 256; sym++) {
+				if (!counts[sym])
+					continue;
+				u8 s = (u8)sym;
+				_output.write_bytes(&s, 1);
+				_output.write_bytes(&_lengths[sym], 1);
+			}
+			_output.write_bytes(&_len, sizeof(_len));
+		}
+		if (entry_count > 1)
+			compress();
+		return NitroData{ buffer, space_required, NitroEncoderType::HUFFMAN };
+	}
+
+private:
+	void compress()
+	{
+		stats::Stage stage(&NitroStats::code_ns);
+		for (u64 i = 0; i < _len; i++) {
+			u8 sym = _input[i];
+			_output.write_bits(_codes[sym], _lengths[sym]);
+		}
+		_output.flush();
+	}
+
+	const u8*		_input;
+	u64				_len;
+	u8				_lengths[256];
+	u32				_codes[256];
+	OutputBitStream	_output;
+};
+
+
+class HuffmanDecoder : public Decoder
+{
+public:
+	HuffmanDecoder(const u8* encoded, uint64_t len)
+	{
+		_input.init(const_cast<u8*>(encoded), len);
+	}
+	virtual ~HuffmanDecoder() {}
+
+	virtual NitroData decode() override
+	{
+		{
+			stats::Stage stage(&NitroStats::header_ns);
+			decoded_size();		// throws - reads the metadata
+		}
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < _orig_len)
+				throw runtime_error("Output buffer is too small to hold the decoded result");
+		}
+		else {
+			stats::Stage stage(&NitroStats::alloc_ns);
+			output = reinterpret_cast<u8*>(malloc(_orig_len));
+			stats::allocation();
+			if (!output)
+				throw runtime_error("Could not allocate enough space to hold decoded result");
+		}
+		try {
+			stats::Stage stage(&NitroStats::code_ns);
+			decompress(output);		// throws
+		}
+		catch (...) {
+			if (!_external)
+				free(output);
+			throw;
+		}
+		return NitroData{ output, _orig_len, NitroEncoderType::HUFFMAN };
+	}
+
+	virtual u64 decoded_size() override
+	{
+		if (!_metadata_read) {
+			read_metadata();	// throws
+			_metadata_read = true;
+		}
+		return _orig_len;
+	}
+
+private:
+	void read_metadata()
+	{
+		if (!_input.valid())
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		if (_input.remaining_bytes() < protocol::sizeof_encoder_type + protocol::sizeof_table_entry_size)
+			throw runtime_error("Malformed protocol - input is shorter than the metadata.");
+		if ((NitroEncoderType)_input.read() != NitroEncoderType::HUFFMAN)
+			throw runtime_error("Wrong decoder for indicated encoder.");
+		u16 count = _input.read_bytes<u16>();
+		if (count == 0 || count > 256)
+			throw runtime_error("Malformed metadata - code length table size can be 1 to 256.");
+		if (_input.remaining_bytes() < count * huffman::sizeof_entry + sizeof(u64))
+			throw runtime_error("Malformed metadata - code length table is truncated.");
+		memset(_lengths, 0, sizeof(_lengths));
+		u32 kraft = 0;
+		int previous = -1;
+		for (unsigned i = 0; i < count; i++) {
+			u8 sym = _input.read();
+			u8 len = _input.read();
+			if ((int)sym <= previous || len > huffman::max_code_length || (len == 0) != (count == 1))
+				throw runtime_error("Malformed metadata - invalid code length table entry.");
+			previous = sym;
+			_lengths[sym] = len;
+			_single = sym;
+			kraft += len ? huffman::table_size >> len : 0;
+		}
+		if (count > 1 && kraft != huffman::table_size)
+			throw runtime_error("Malformed metadata - code lengths do not form a complete prefix code.");
+		_symbol_count = count;
+		_orig_len = _input.read_bytes<u64>();
+		if (count == 1 && _input.remaining_bytes())
+			throw runtime_error("Malformed data - data after a single symbol frame.");
+		// with two or more symbols every symbol costs at least one bit
+		if (!_orig_len || (count > 1 && _orig_len > _input.remaining_bytes() * 8))
+			throw runtime_error("Malformed protocol - length does not match the size of the coded data.");
+	}
+
+	void decompress(u8* output)
+	{
+		if (_symbol_count == 1) {
+			memset(output, _single, _orig_len);
+			return;
+		}
+		vector<huffman::DecodeEntry> table(huffman::table_size);
+		huffman::build_decode_table(_lengths, table.data());
+		const huffman::DecodeEntry* t = table.data();
+		InputBitStream in = _input;
+		u8* out = output;
+		u8* end = output + _orig_len;
+		// a refill keeps at least 56 bits - 5 lookups of at most 11 bits, up to 15 symbols
+		// plus the 4 byte store of the last lookup
+		const u64 slack = 5 * huffman::max_symbols_per_entry + sizeof(u32);
+		while ((u64)(end - out) >= slack && in.remaining_bytes() >= sizeof(u64)) {
+			in.refill();
+			for (int k = 0; k < 5; k++) {
+				const huffman::DecodeEntry& e = t[in.peek_bits(huffman::max_code_length)];
+				memcpy(out, &e.symbols, sizeof(u32));
+				out += e.count;
+				in.consume_bits(e.bits);
+			}
+		}
+		while (out < end) {
+			in.refill();
+			const huffman::DecodeEntry& e = t[in.peek_bits(huffman::max_code_length)];
+			if (e.first_bits > in.buffered_bits())
+				throw runtime_error("Malformed data - Huffman data is shorter than the original length requires.");
+			*out++ = (u8)e.symbols;
+			in.consume_bits(e.first_bits);
+		}
+		// only the padding of the last byte may be left
+		if (in.remaining_bytes() || in.buffered_bits() >= 8)
+			throw runtime_error("Malformed data - Huffman data does not match the original length.");
+	}
+
+	InputBitStream	_input;
+	u8				_lengths[256];
+	unsigned		_symbol_count{ 0 };
+	u8				_single{ 0 };
+	u64				_orig_len{ 0 };
+	bool			_metadata_read{ false };
+};
@@ -4,7 +4,22 @@
 #include <cstdint>
 
 enum NitroEncoderType {
-	BLOCK = 0xC4
+	BLOCK = 0xC4,
+	BLOCK_CHUNKED = 0xC5,		/* block encoding in independently decodable chunks, parallel encode/decode */
+	STREAM = 0xC6,				/* sequence of block encoded segments, see nitro_stream_init */
+	RANGE = 0xC7,				/* range coding with a static order-0 model */
+	RANS = 0xC8,				/* interleaved rANS with a static order-0 model, fast decoding */
+	HUFFMAN = 0xC9,				/* canonical Huffman codes (max 11 bits), table driven decoding */
+	RAW = 0xCA,					/* stored as is - incompressible data */
+	RLE = 0xCB,					/* long runs cut to one byte + run list, the rest compressed as AUTO */
+	DNA = 0xCC,					/* A, C, G, T at 2 bits + a list of the other symbols, random access */
+	SHARED = 0xCD,				/* block encoding against the shared symbol table of a context,
+								   see nitro_context_create - written and read through a context only */
+	LZ = 0xCE,					/* LZ77 with hash chains - long repeats (logs, configs), see NITRO_OPTION_LZ_LEVEL */
+	DICT = 0xCF,				/* LZ77 against a trained dictionary, see nitro_train_dictionary -
+								   written and read through a context only */
+	AUTO = 0xFF					/* compression only: picks the smallest of the types above per 1 MiB chunk,
+								   the result carries the type actually written */
 };
 
 struct NitroData
@@ -14,6 +29,46 @@ struct NitroData
 	enum NitroEncoderType	enctype;
 };
 
+/*
+ *	Library options - per calling thread
+ */
+enum NitroOption {
+	NITRO_OPTION_STATS = 1,		/* 1: record NitroStats for every call (see nitro_get_last_stats), default 0 */
+	NITRO_OPTION_CHECKSUM = 2,	/* 1: BLOCK and BLOCK_CHUNKED frames carry a CRC32C per chunk, default 0
+								   decompression verifies them whatever the option and fails on a mismatch */
+	NITRO_OPTION_LZ_LEVEL = 3	/* LZ match finder effort 1 (fastest) .. 9 (smallest), default 6 */
+};
+
+/*
+ *	returns:
+ *		the previous value of the option or -1 for unknown options and values out of range
+ */
+extern "C" int nitro_set_option(enum NitroOption option, int value);
+
+/*
+ *	Where the time of the last compress/decompress call of this thread went.
+ *	Stages of nested frames (STREAM segments, AUTO choices) add up, work done on
+ *	worker threads counts as the wall time the calling thread waited for it.
+ */
+struct NitroStats
+{
+	uint64_t			model_ns;		/* histogram, symbol table, frequency model or code lengths */
+	uint64_t			alloc_ns;		/* output allocation */
+	uint64_t			header_ns;		/* metadata write (compress) or parse (decompress) */
+	uint64_t			code_ns;		/* packing/entropy coding or unpacking/decoding */
+	uint64_t			total_ns;		/* the whole call */
+	uint64_t			bytes_in;
+	uint64_t			bytes_out;
+	uint32_t			bits_per_block;	/* block frames: bits per symbol, 0 for the other types */
+	uint32_t			allocations;	/* output buffers allocated */
+};
+
+/*
+ *	returns:
+ *		1 and fills stats if NITRO_OPTION_STATS is on, otherwise 0
+ */
+extern "C" int nitro_get_last_stats(NitroStats* stats);
+
 /*
  *
  *	args:
@@ -37,5 +92,376 @@ extern "C" NitroData nitro_compress(const uint8_t* input, uint64_t len, enum Nit
  */
 extern "C" NitroData nitro_decompress(const uint8_t* encoded, uint64_t len);
 
+/*
+ *	Same as nitro_compress but uses up to threads worker threads
+ *	for the encoder types which support parallel encoding (BLOCK_CHUNKED).
+ *	nitro_compress uses all hardware threads for those types.
+ *
+ *	args:
+ *		input:		data to be encoded
+ *		len:		number bytes to encode
+ *		type:		one of the enum EncoderType values
+ *		threads:	number of worker threads, 0 means one per hardware thread
+ *	returns:
+ *		NitroData structure holding a malloc-ed output of the encoded text
+ *		use free to release the memory!
+ */
+extern "C" NitroData nitro_compress_mt(const uint8_t* input, uint64_t len, enum NitroEncoderType type, unsigned threads);
+
+/*
+ *	Same as nitro_decompress but uses up to threads worker threads
+ *	when the encoded data supports parallel decoding (BLOCK_CHUNKED, and BLOCK
+ *	frames of more than 1M symbols which are unpacked in byte aligned slices).
+ *	nitro_decompress uses all hardware threads for those types.
+ *
+ *	args:
+ *		input:		data to be decoded
+ *		len:		number bytes to decode
+ *		threads:	number of worker threads, 0 means one per hardware thread
+ *	returns:
+ *		NitroData structure holding a malloc-ed output of the decoded text
+ *		use free to release the memory!
+ */
+extern "C" NitroData nitro_decompress_mt(const uint8_t* encoded, uint64_t len, unsigned threads);
+
+/*
+ *	Worst case size of encoding len bytes with the given encoder type.
+ *	A buffer of this size is always big enough for nitro_compress_into.
+ *
+ *	returns:
+ *		the bound or 0 for unknown types
+ */
+extern "C" uint64_t nitro_compress_bound(uint64_t len, enum NitroEncoderType type);
+
+/*
+ *	Size of the decoded data - only the metadata is read.
+ *
+ *	returns:
+ *		the number of bytes nitro_decompress would produce or 0 if the data is malformed
+ */
+extern "C" uint64_t nitro_decompressed_size(const uint8_t* encoded, uint64_t len);
+
+/*
+ *	Same as nitro_compress but writes into a caller provided buffer, nothing is allocated
+ *	for the result (size it with nitro_compress_bound).
+ *
+ *	args:
+ *		output:		buffer receiving the encoded data
+ *		capacity:	size of the output buffer
+ *	returns:
+ *		NitroData structure with data == output and len == bytes written
+ *		or data == NULL if the encoding failed (or output is too small)
+ *		do NOT free the data!
+ */
+extern "C" NitroData nitro_compress_into(const uint8_t* input, uint64_t len, enum NitroEncoderType type,
+										 uint8_t* output, uint64_t capacity);
+
+/*
+ *	Same as nitro_decompress but writes into a caller provided buffer, nothing is allocated
+ *	for the result (size it with nitro_decompressed_size).
+ *
+ *	returns:
+ *		NitroData structure with data == output and len == bytes written
+ *		or data == NULL if the decoding failed (or output is too small)
+ *		do NOT free the data!
+ */
+extern "C" NitroData nitro_decompress_into(const uint8_t* encoded, uint64_t len, uint8_t* output, uint64_t capacity);
+
+
+/*
+ *	Streaming API
+ *
+ *	Compresses/decompresses data of any size with a fixed memory budget
+ *	(about two segments). The produced data is a STREAM frame which
+ *	nitro_decompress can decode in memory too.
+ *
+ *	Usage:
+ *		s = nitro_stream_init(mode, 0);
+ *		while (input left)
+ *			nitro_stream_update(s, ...)		- until it returns NITRO_STREAM_OK
+ *											  (write out the output each time)
+ *		nitro_stream_finish(s, ...)			- until it returns NITRO_STREAM_END
+ *		nitro_stream_free(s);
+ */
+typedef struct NitroStream NitroStream;
+
+enum NitroStreamMode {
+	NITRO_STREAM_COMPRESS = 0,
+	NITRO_STREAM_DECOMPRESS = 1
+};
+
+enum NitroStreamStatus {
+	NITRO_STREAM_ERROR = -1,		/* malformed input or internal failure - the stream is unusable */
+	NITRO_STREAM_OK = 0,			/* all input consumed and all output written */
+	NITRO_STREAM_OUTPUT_FULL = 1,	/* output buffer is full - call again (with the rest of the input) */
+	NITRO_STREAM_END = 2			/* finish: the stream is complete */
+};
+
+/*
+ *	args:
+ *		mode:			compress or decompress
+ *		segment_size:	input bytes encoded per segment when compressing, 0 means default (1 MiB)
+ *						ignored when decompressing (stored in the stream)
+ *	returns:
+ *		the streaming context or NULL on failure, release it with nitro_stream_free
+ */
+extern "C" NitroStream* nitro_stream_init(enum NitroStreamMode mode, uint64_t segment_size);
+
+/*
+ *	Feeds input to the stream and collects the output produced so far.
+ *
+ *	args:
+ *		stream:		context from nitro_stream_init
+ *		input:		next piece of the input (may be NULL if len is 0)
+ *		len:		number of input bytes
+ *		consumed:	set to the number of input bytes consumed
+ *		output:		buffer receiving the output
+ *		capacity:	size of the output buffer
+ *		written:	set to the number of bytes written to output
+ *	returns:
+ *		NITRO_STREAM_OK, NITRO_STREAM_OUTPUT_FULL or NITRO_STREAM_ERROR
+ */
+extern "C" enum NitroStreamStatus nitro_stream_update(NitroStream* stream, const uint8_t* input, uint64_t len, uint64_t* consumed,
+													  uint8_t* output, uint64_t capacity, uint64_t* written);
+
+/*
+ *	Signals the end of the input and collects the remaining output.
+ *	Call it again while it returns NITRO_STREAM_OUTPUT_FULL.
+ *
+ *	returns:
+ *		NITRO_STREAM_END, NITRO_STREAM_OUTPUT_FULL or NITRO_STREAM_ERROR
+ *		(decompressing: NITRO_STREAM_ERROR if the input was truncated)
+ */
+extern "C" enum NitroStreamStatus nitro_stream_finish(NitroStream* stream, uint8_t* output, uint64_t capacity, uint64_t* written);
+
+extern "C" void nitro_stream_free(NitroStream* stream);
+
+
+/*
+ *	Random access API
+ *
+ *	Block encoding uses the same number of bits for every symbol so any symbol
+ *	can be read without decompressing the rest. Works on BLOCK, BLOCK_CHUNKED,
+ *	RAW, DNA and STREAM data (as long as the stream segments are one of those).
+ *
+ *	nitro_open parses the metadata once into a handle which answers any number
+ *	of queries. The encoded data is not copied - it must stay valid until
+ *	nitro_close.
+ *
+ *	returns:
+ *		the handle or NULL if the data is malformed or not randomly accessible
+ */
+typedef struct NitroHandle NitroHandle;
+
+extern "C" NitroHandle* nitro_open(const uint8_t* encoded, uint64_t len);
+
+extern "C" void nitro_close(NitroHandle* handle);
+
+/* number of symbols in the original data */
+extern "C" uint64_t nitro_handle_length(const NitroHandle* handle);
+
+/*
+ *	returns:
+ *		the symbol at index or -1 if the index is out of range
+ */
+extern "C" int nitro_handle_get_symbol(const NitroHandle* handle, uint64_t index);
+
+/*
+ *	Decodes count symbols starting at offset into out (at least count bytes).
+ *	returns:
+ *		number of symbols written: count or 0 if the range is out of bounds
+ */
+extern "C" uint64_t nitro_handle_get_range(const NitroHandle* handle, uint64_t offset, uint64_t count, uint8_t* out);
+
+/*
+ *	Builds the rank/select index of the handle: the count of every symbol at every
+ *	superblock boundary (at most 1/64 byte per symbol, one decoding pass). Optional -
+ *	without it nitro_rank and nitro_select count from the start of the data.
+ *	Not thread safe: build it before sharing the handle.
+ *
+ *	returns:
+ *		1 or 0 on failure
+ */
+extern "C" int nitro_handle_build_index(NitroHandle* handle);
+
+/*
+ *	Occurrences of sym among the symbols [0, pos) - counted straight in the packed
+ *	codes, with the index within one superblock only.
+ *
+ *	returns:
+ *		the count or UINT64_MAX if pos is past the length
+ */
+extern "C" uint64_t nitro_rank(const NitroHandle* handle, uint8_t sym, uint64_t pos);
+
+/*
+ *	Position of occurrence k of sym, k = 0 is the first one (rank(select(k)) == k).
+ *	With the index: binary search over the superblocks, then one superblock scanned.
+ *
+ *	returns:
+ *		the position or -1 if sym occurs at most k times
+ */
+extern "C" int64_t nitro_select(const NitroHandle* handle, uint8_t sym, uint64_t k);
+
+/*
+ *	Called for every match position of nitro_search/nitro_handle_search in increasing
+ *	order (overlapping matches included), return 0 to stop the search.
+ */
+typedef int (*NitroSearchCallback)(uint64_t position, void* user);
+
+/*
+ *	Finds the pattern without decompressing: the pattern is translated into codes
+ *	and matched against the packed codes directly, reading 8 / bits per symbol times
+ *	fewer bytes than a search on the decoded data (4x for DNA).
+ *
+ *	returns:
+ *		number of matches reported or -1 on failure
+ */
+extern "C" int64_t nitro_handle_search(const NitroHandle* handle, const uint8_t* pattern, uint64_t pattern_len,
+	NitroSearchCallback callback, void* user);
+
+/*
+ *	One shot variants - parse the metadata on every call,
+ *	use a handle for repeated queries.
+ */
+extern "C" int nitro_get_symbol(const uint8_t* encoded, uint64_t len, uint64_t index);
+
+extern "C" uint64_t nitro_get_range(const uint8_t* encoded, uint64_t len, uint64_t offset, uint64_t count, uint8_t* out);
+
+/* data of other types (e.g. HUFFMAN, LZ) is decompressed and then searched */
+extern "C" int64_t nitro_search(const uint8_t* encoded, uint64_t len, const uint8_t* pattern, uint64_t pattern_len,
+	NitroSearchCallback callback, void* user);
+
+
+
+/*
+ *	Reusable context API
+ *
+ *	For many small messages: a context keeps its scratch memory between calls
+ *	and can be primed with a sample of the data. Messages using only symbols
+ *	of the sample are then written as SHARED frames which reference the symbol
+ *	table by a 4 byte ID instead of storing it (7 bytes of header for a 200 byte
+ *	message instead of 11 + 2 per symbol). Other messages are written as BLOCK.
+ *	The results live in the context's scratch memory: do NOT free them, they
+ *	are valid until the next call on the same context.
+ *	A context is not thread safe - use one per thread.
+ *
+ *	Usage:
+ *		ctx = nitro_context_create();
+ *		nitro_context_prime(ctx, sample, sample_len);	- optional, the decoding side
+ *														  primes with the same alphabet
+ *		enc = nitro_context_compress(ctx, msg, msg_len);
+ *		dec = nitro_context_decompress(ctx, enc.data, enc.len);
+ *		nitro_context_free(ctx);
+ */
+typedef struct NitroContext NitroContext;
+
+extern "C" NitroContext* nitro_context_create(void);
+
+/*
+ *	Builds the shared symbol table from the symbols of the sample (replaces the previous one).
+ *	The ID depends only on the set of symbols.
+ *
+ *	returns:
+ *		the table ID or 0 on failure
+ */
+extern "C" uint32_t nitro_context_prime(NitroContext* ctx, const uint8_t* sample, uint64_t len);
+
+/*
+ *	returns:
+ *		NitroData structure pointing into the context's scratch memory
+ *		or data == NULL if the encoding failed
+ */
+extern "C" NitroData nitro_context_compress(NitroContext* ctx, const uint8_t* input, uint64_t len);
+
+/*
+ *	Decodes a frame of any type, SHARED frames need the context primed with the same table,
+ *	DICT frames the same dictionary loaded.
+ *
+ *	returns:
+ *		NitroData structure pointing into the context's scratch memory
+ *		or data == NULL if the decoding failed
+ */
+extern "C" NitroData nitro_context_decompress(NitroContext* ctx, const uint8_t* encoded, uint64_t len);
+
+extern "C" void nitro_context_free(NitroContext* ctx);
+
+/*
+ *	Batch API
+ *
+ *	Compresses/decompresses many independent buffers in one call on a worker pool.
+ *	All results land in one allocation: item i is arena[offsets[i], offsets[i + 1]).
+ *	Release it with nitro_batch_free. If any item fails the whole batch fails
+ *	(arena == NULL).
+ */
+struct NitroBuffer
+{
+	const uint8_t*		data;
+	uint64_t			len;
+};
+
+struct NitroBatch
+{
+	uint8_t*			arena;		/* the results back to back */
+	uint64_t*			offsets;	/* count + 1 entries */
+	uint64_t			count;
+};
+
+/*
+ *	args:
+ *		items:		count buffers to encode (each len > 0)
+ *		type:		one of the enum EncoderType values, used for every item
+ *		threads:	number of worker threads, 0 means one per hardware thread
+ */
+extern "C" NitroBatch nitro_compress_batch(const NitroBuffer* items, uint64_t count, enum NitroEncoderType type, unsigned threads);
+
+/*
+ *	args:
+ *		items:		count encoded buffers, e.g. the items of a nitro_compress_batch result
+ *		threads:	number of worker threads, 0 means one per hardware thread
+ */
+extern "C" NitroBatch nitro_decompress_batch(const NitroBuffer* items, uint64_t count, unsigned threads);
+
+extern "C" void nitro_batch_free(NitroBatch* batch);
+
+/*
+ *	Dictionary API
+ *
+ *	Small records of one kind (JSON events, log lines, protocol messages) share
+ *	field names and boilerplate but are too short to repeat anything within
+ *	themselves. A dictionary trained on samples of such records holds the
+ *	shared content, a context with the dictionary loaded writes DICT frames
+ *	whose matches reach back into it. The frame stores the 4 byte ID of the
+ *	dictionary, the decoding context must load the same dictionary.
+ *
+ *	Usage:
+ *		dict = nitro_train_dictionary(samples, count, 0);	- once, offline
+ *		ctx = nitro_context_create();
+ *		nitro_context_load_dictionary(ctx, dict.data, dict.len);
+ *		enc = nitro_context_compress(ctx, record, record_len);
+ *		dec = nitro_context_decompress(ctx, enc.data, enc.len);
+ */
+
+/*
+ *	Picks the content most samples share, best segments last.
+ *
+ *	args:
+ *		samples:	count sample records
+ *		capacity:	dictionary content size, 0 means 32 KiB, at most 128 KiB - 1
+ *
+ *	returns:
+ *		the serialized dictionary (free it with free) or data == NULL on failure,
+ *		e.g. when the samples have nothing in common
+ */
+extern "C" NitroData nitro_train_dictionary(const NitroBuffer* samples, uint64_t count, uint64_t capacity);
+
+/*
+ *	Loads a serialized dictionary into the context (replaces the previous one and
+ *	takes precedence over a shared symbol table). Compression uses the LZ level
+ *	of the calling thread (NITRO_OPTION_LZ_LEVEL).
+ *
+ *	returns:
+ *		the dictionary ID or 0 on failure
+ */
+extern "C" uint32_t nitro_context_load_dictionary(NitroContext* ctx, const uint8_t* dictionary, uint64_t len);
 
 #endif  //_NITRO_H
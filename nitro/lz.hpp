@@ -0,0 +1,551 @@
+#pragma once
+
+#include "common.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * LZ77 with hash chain match finding (LZ)
+ *
+ * Repeats of at least min_match bytes within the last window bytes become
+ * (length, offset) pairs, everything else is a literal. The effort level
+ * (NITRO_OPTION_LZ_LEVEL, 1..9) bounds how many earlier positions with the same
+ * 4 byte hash are compared per input position and the match length which ends the
+ * search early; from lazy_level on a match is only taken when the next position
+ * does not start a longer one.
+ *
+ * Layout:
+ *	- encoder type (1 byte)
+ *	- input length (8 bytes)
+ *	- tokens, LSB first:
+ *	  literal: 0, the byte (8 bits)
+ *	  match:   1, length - min_match + 1 as an Elias gamma code (n zeros, a one, the low n bits),
+ *	           5 bits n = floor(log2(offset)), the low n bits of the offset
+ *
+ * A literal costs 9 bits and a match at most 56 bits for at least 4 bytes, so the
+ * frame never exceeds 9/8 of the input. The decoder copies matches 8 bytes at a time,
+ * short offsets are widened to a multiple of the offset of at least 8 bytes first.
+ */
+namespace lz
+{
+	const u64		sizeof_header = protocol::sizeof_encoder_type + sizeof(u64);
+	const u64		min_match = 4;
+	const u64		max_match = min_match + (1 << 16) - 2;	// gamma codes of at most 33 bits
+	const unsigned	window_bits = 18;
+	const u64		window = 1ull << window_bits;			// offsets are below window
+	const unsigned	max_hash_bits = 16;
+	const int		min_level = 1;
+	const int		max_level = 9;
+	const int		default_level = 6;
+	const int		lazy_level = 4;
+
+	inline int& level()
+	{
+		static thread_local int current = default_level;
+		return current;
+	}
+
+	const u64		good_length = 32;		// a match this long cuts the rest of the search to a quarter
+
+	// positions compared per input position at the given effort level
+	inline unsigned chain_depth(int level)
+	{
+		static const unsigned depth[] = { 1, 2, 4, 6, 8, 16, 32, 128, 1024 };
+		return depth[std::min(std::max(level, min_level), max_level) - 1];
+	}
+
+	// a match this long ends the search at the given effort level
+	inline u64 nice_length(int level)
+	{
+		static const u64 nice[] = { 16, 16, 32, 32, 64, 128, 256, 1024, max_match };
+		return nice[std::min(std::max(level, min_level), max_level) - 1];
+	}
+
+	inline u64 max_encoded_size(u64 len)
+	{
+		return sizeof_header + (9 * len + 7) / 8 + sizeof(u32);
+	}
+
+	inline u32 hash(const u8* p, unsigned bits)
+	{
+		u32 word;
+		memcpy(&word, p, sizeof(word));
+		return (word * 2654435761u) >> (32 - bits);
+	}
+
+	// length of the common prefix of a and b, at most limit
+	inline u64 common_length(const u8* a, const u8* b, u64 limit)
+	{
+		u64 n = 0;
+		for (; n + sizeof(u64) <= limit; n += sizeof(u64)) {
+			u64 x, y;
+			memcpy(&x, a + n, sizeof(x));
+			memcpy(&y, b + n, sizeof(y));
+			if (u64 diff = x ^ y)
+				return n + __builtin_ctzll(diff) / 8;
+		}
+		while (n < limit && a[n] == b[n])
+			n++;
+		return n;
+	}
+
+	/*
+	 * Copies a match of length bytes from offset bytes back, out[i] = out[i - offset].
+	 * The caller checked offset <= bytes written and length <= space left.
+	 */
+	inline void copy_match(u8* out, u64 offset, u64 length)
+	{
+		const u8* src = out - offset;
+		if (offset < sizeof(u64)) {
+			// the output repeats with every multiple of offset: byte by byte until
+			// the first multiple of at least 8 is a valid distance
+			u64 wide = offset * ((sizeof(u64) + offset - 1) / offset);
+			u64 head = std::min(length, wide - offset);
+			for (u64 i = 0; i < head; i++)
+				out[i] = src[i];
+			out += head;
+			length -= head;
+			src = out - wide;
+		}
+		for (; length >= sizeof(u64); length -= sizeof(u64)) {
+			memcpy(out, src, sizeof(u64));
+			out += sizeof(u64);
+			src += sizeof(u64);
+		}
+		while (length--)
+			*out++ = *src++;
+	}
+
+	inline unsigned hash_bits_for(u64 len)
+	{
+		unsigned bits = 8;
+		while (bits < max_hash_bits && (1ull << bits) < len)
+			bits++;
+		return bits;
+	}
+
+	/*
+	 * History preloaded in front of every input (dictionary frames, see dictionary.hpp)
+	 * Indexed once: head[hash] holds the last position + 1 with that hash, prev[position]
+	 * the position + 1 of the one before it. Immutable after construction.
+	 */
+	struct History
+	{
+		History(const u8* data, u64 len) :
+			content(data, data + len),
+			hash_bits(hash_bits_for(len))
+		{
+			if (len >= window / 2)
+				throw runtime_error("Dictionary is too large - the limit is half of the LZ window.");
+			head.assign(1ull << hash_bits, 0);
+			prev.assign(len, 0);
+			for (u64 p = 0; p + min_match <= len; p++) {
+				u32 h = hash(content.data() + p, hash_bits);
+				prev[p] = head[h];
+				head[h] = (u32)(p + 1);
+			}
+		}
+
+		vector<u8>	content;
+		unsigned	hash_bits;
+		vector<u32>	head;
+		vector<u32>	prev;
+	};
+
+	/*
+	 * Hash chains over the window: head[hash] holds the last position + 1 with that hash,
+	 * prev[position % window] the distance to the one before it (0 ends the chain).
+	 * With a history the chain of the history is searched after the one of the input,
+	 * a match may run from the end of the history into the input.
+	 */
+	class MatchFinder
+	{
+	public:
+		MatchFinder(const u8* input, u64 len, int level, const History* history = nullptr) :
+			_input(input),
+			_len(len),
+			_depth(chain_depth(level)),
+			_nice(nice_length(level)),
+			_history(history)
+		{
+			_hash_bits = hash_bits_for(len);
+			u64 ring = 1;
+			while (ring < window && ring < len)
+				ring <<= 1;
+			_mask = ring - 1;
+			_head.assign(1ull << _hash_bits, 0);
+			_prev.assign(ring, 0);
+		}
+
+		// longest match for position i (length 0 if none), positions before i must be inserted
+		u64 find(u64 i, u64& offset) const
+		{
+			if (i + min_match > _len)
+				return 0;
+			u64 limit = std::min(max_match, _len - i);
+			u64 nice = std::min(_nice, limit);
+			u64 best = min_match - 1;
+			const u8* current = _input + i;
+			u64 candidate = _head[hash(current, _hash_bits)];
+			for (unsigned depth = _depth; candidate && depth; depth--) {
+				u64 p = candidate - 1;
+				if (i - p >= window || p + _mask < i)
+					break;
+				// a longer match has to differ from the best one at its last byte
+				if (_input[p + best] == current[best]) {
+					u64 n = common_length(_input + p, current, limit);
+					if (n > best) {
+						if (best < good_length && n >= good_length)
+							depth = (depth + 3) / 4;
+						best = n;
+						offset = i - p;
+						if (n >= nice)
+							break;
+					}
+				}
+				u32 distance = _prev[p & _mask];
+				if (!distance)
+					break;
+				candidate -= distance;
+			}
+			if (_history && best < nice)
+				best = find_in_history(i, limit, nice, best, offset);
+			return best >= min_match ? best : 0;
+		}
+
+		void insert(u64 i)
+		{
+			if (i + min_match > _len)
+				return;
+			u32 h = hash(_input + i, _hash_bits);
+			u64 previous = _head[h];
+			_prev[i & _mask] = previous && i + 1 - previous < window ? (u32)(i + 1 - previous) : 0;
+			_head[h] = i + 1;
+		}
+
+	private:
+		u64 find_in_history(u64 i, u64 limit, u64 nice, u64 best, u64& offset) const
+		{
+			const u8* content = _history->content.data();
+			u64 size = _history->content.size();
+			const u8* current = _input + i;
+			u32 candidate = _history->head[hash(current, _history->hash_bits)];
+			for (unsigned depth = _depth; candidate && depth; depth--) {
+				u64 p = candidate - 1;
+				u64 distance = i + size - p;
+				if (distance >= window)
+					break;
+				// the history runs on into the input
+				u64 n = common_length(content + p, current, std::min(limit, size - p));
+				if (n == size - p)
+					n += common_length(_input, current + n, limit - n);
+				if (n > best) {
+					best = n;
+					offset = distance;
+					if (n >= nice)
+						break;
+				}
+				candidate = _history->prev[p];
+			}
+			return best;
+		}
+
+		const u8*	_input;
+		u64			_len;
+		unsigned	_depth;
+		u64			_nice;
+		const History*	_history;
+		unsigned	_hash_bits;
+		u64			_mask;
+		vector<u64>	_head;
+		vector<u32>	_prev;
+	};
+}
+
+class LzEncoder : public Encoder
+{
+public:
+	LzEncoder(const u8* input, uint64_t len, int level = lz::level()) :
+		LzEncoder(input, len, level, nullptr, NitroEncoderType::LZ)
+	{
+	}
+	virtual ~LzEncoder() {}
+
+	virtual NitroData encode() override
+	{
+		if (!_input || !_len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		u64 capacity = lz::max_encoded_size(_len) - lz::sizeof_header + max_header_size();
+		// the tokens are written unchecked: a caller buffer below the bound is filled
+		// from a temporary one, the result may still fit
+		u8* output = _external && _external_capacity >= capacity ? _external : nullptr;
+		if (!output) {
+			stats::Stage stage(&NitroStats::alloc_ns);
+			output = reinterpret_cast<u8*>(malloc(capacity));
+			stats::allocation();
+			if (!output)
+				throw runtime_error("Memory allocation failed");
+		}
+		try {
+			_output.init(output, capacity);
+			{
+				stats::Stage stage(&NitroStats::header_ns);
+				write_header();
+			}
+			{
+				stats::Stage stage(&NitroStats::code_ns);
+				compress();
+			}
+			u64 len = _output.pointer() - output;
+			if (_external && output != _external) {
+				if (_external_capacity < len)
+					throw runtime_error("Output buffer is too small to hold the encoded result.");
+				memcpy(_external, output, len);
+				free(output);
+				return NitroData{ _external, len, _type };
+			}
+			if (!_external)
+				output = reinterpret_cast<u8*>(realloc(output, len));	// shrinking - can not fail
+			return NitroData{ output, len, _type };
+		}
+		catch (...) {
+			if (output != _external)
+				free(output);
+			throw;
+		}
+	}
+
+protected:
+	LzEncoder(const u8* input, uint64_t len, int level, const lz::History* history, NitroEncoderType type) :
+		_input(input),
+		_len(len),
+		_level(level),
+		_history(history)
+	{
+		_type = type;
+	}
+
+	// frame specific header in front of the tokens
+	virtual u64 max_header_size() const { return lz::sizeof_header; }
+	virtual void write_header()
+	{
+		u8 type = (u8)NitroEncoderType::LZ;
+		_output.write_bytes(&type, protocol::sizeof_encoder_type);
+		_output.write_bytes(&_len, sizeof(_len));
+	}
+
+	const u8*		_input;
+	u64				_len;
+	OutputBitStream	_output;
+
+private:
+	void compress()
+	{
+		lz::MatchFinder finder(_input, _len, _level, _history);
+		bool lazy = _level >= lz::lazy_level;
+		u64 nice = lz::nice_length(_level);
+		// the match found at i - 1 waits for the search at i when lazy
+		u64 pending = 0, pending_offset = 0;
+		u64 i = 0;
+		while (i < _len) {
+			u64 offset = 0;
+			u64 length = pending < nice ? finder.find(i, offset) : 0;
+			if (pending && length <= pending) {
+				write_match(pending, pending_offset);
+				for (u64 end = i - 1 + pending; i < end; i++)
+					finder.insert(i);
+				pending = 0;
+				continue;
+			}
+			if (pending)
+				write_literal(_input[i - 1]);
+			finder.insert(i);
+			if (lazy && length) {
+				pending = length;
+				pending_offset = offset;
+				i++;
+				continue;
+			}
+			pending = 0;
+			if (!length) {
+				write_literal(_input[i++]);
+				continue;
+			}
+			write_match(length, offset);
+			for (u64 end = i + length, p = i + 1; p < end; p++)
+				finder.insert(p);
+			i += length;
+		}
+		if (pending)
+			write_match(pending, pending_offset);
+		_output.flush();
+	}
+
+	void write_literal(u8 byte)
+	{
+		_output.write_bits((u64)byte << 1, 9);
+	}
+
+	void write_match(u64 length, u64 offset)
+	{
+		u64 value = length - lz::min_match + 1;
+		unsigned n = 63 - __builtin_clzll(value);
+		_output.write_bits(1, 1);
+		_output.write_bits(1ull << n, n + 1);		// n zeros and the one
+		if (n)
+			_output.write_bits(value & ((1ull << n) - 1), n);
+		n = 63 - __builtin_clzll(offset);
+		_output.write_bits(n, 5);
+		if (n)
+			_output.write_bits(offset & ((1ull << n) - 1), n);
+	}
+
+	int					_level;
+	const lz::History*	_history;
+};
+
+
+class LzDecoder : public Decoder
+{
+public:
+	LzDecoder(const u8* encoded, uint64_t len) :
+		LzDecoder(encoded, len, nullptr, NitroEncoderType::LZ)
+	{
+	}
+	virtual ~LzDecoder() {}
+
+	virtual NitroData decode() override
+	{
+		{
+			stats::Stage stage(&NitroStats::header_ns);
+			decoded_size();		// throws - reads the metadata
+		}
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < _orig_len)
+				throw runtime_error("Output buffer is too small to hold the decoded result");
+		}
+		else {
+			stats::Stage stage(&NitroStats::alloc_ns);
+			output = reinterpret_cast<u8*>(malloc(_orig_len));
+			stats::allocation();
+			if (!output)
+				throw runtime_error("Could not allocate enough space to hold decoded result");
+		}
+		try {
+			stats::Stage stage(&NitroStats::code_ns);
+			decompress(output);		// throws
+		}
+		catch (...) {
+			if (!_external)
+				free(output);
+			throw;
+		}
+		return NitroData{ output, _orig_len, _type };
+	}
+
+	virtual u64 decoded_size() override
+	{
+		if (!_metadata_read) {
+			if (!_input.valid())
+				throw runtime_error("invalid input (input nullptr or 0 length)");
+			read_header();	// throws
+			// a token of at least 2 bits writes at most max_match bytes
+			if (!_orig_len || _orig_len / lz::max_match > _input.remaining_bytes() * 4)
+				throw runtime_error("Malformed protocol - invalid LZ frame length.");
+			_metadata_read = true;
+		}
+		return _orig_len;
+	}
+
+protected:
+	LzDecoder(const u8* encoded, uint64_t len, const lz::History* history, NitroEncoderType type) :
+		_history(history),
+		_type(type)
+	{
+		_input.init(const_cast<u8*>(encoded), len);
+	}
+
+	// frame specific header in front of the tokens, sets _orig_len
+	virtual void read_header()
+	{
+		if (_input.remaining_bytes() < lz::sizeof_header)
+			throw runtime_error("Malformed protocol - input is shorter than the metadata.");
+		if ((NitroEncoderType)_input.read() != NitroEncoderType::LZ)
+			throw runtime_error("Wrong decoder for indicated encoder.");
+		_orig_len = _input.read_bytes<u64>();
+	}
+
+	InputBitStream		_input;
+	u64					_orig_len{ 0 };
+	const lz::History*	_history;
+
+private:
+	void decompress(u8* output)
+	{
+		InputBitStream in = _input;
+		u8* out = output;
+		u8* end = output + _orig_len;
+		// a refill keeps at least 56 bits (fewer only at the end of the data): enough for
+		// the flag and a literal or a length, the offset gets its own refill
+		while (out < end) {
+			in.refill();
+			u64 bits = in.peek_bits(std::min(in.buffered_bits(), 63u));
+			if (!(bits & 1)) {
+				if (in.buffered_bits() < 9)
+					throw runtime_error("Malformed data - LZ data is shorter than the original length requires.");
+				*out++ = (u8)(bits >> 1);
+				in.consume_bits(9);
+				continue;
+			}
+			u64 value = read_gamma(in, bits >> 1);
+			in.refill();
+			if (in.buffered_bits() < 5)
+				throw runtime_error("Malformed data - LZ data is shorter than the original length requires.");
+			unsigned n = (unsigned)in.peek_bits(5);
+			if (n >= lz::window_bits || in.buffered_bits() < 5 + n)
+				throw runtime_error("Malformed data - invalid LZ match offset.");
+			u64 offset = (1ull << n) | (in.peek_bits(5 + n) >> 5);
+			in.consume_bits(5 + n);
+			u64 length = value + lz::min_match - 1;
+			u64 written = out - output;
+			if (length > (u64)(end - out))
+				throw runtime_error("Malformed data - LZ match outside of the output.");
+			if (offset > written) {
+				// the match starts in the history and may run on into the output
+				u64 back = offset - written;
+				if (!_history || back > _history->content.size())
+					throw runtime_error("Malformed data - LZ match outside of the output.");
+				u64 head = std::min(back, length);
+				memcpy(out, _history->content.data() + _history->content.size() - back, head);
+				out += head;
+				length -= head;
+				if (!length)
+					continue;
+			}
+			lz::copy_match(out, offset, length);
+			out += length;
+		}
+		// only the padding of the last byte may be left
+		if (in.remaining_bytes() || in.buffered_bits() >= 8)
+			throw runtime_error("Malformed data - LZ data does not match the original length.");
+	}
+
+	// match length code after the flag bit, bits holds the buffered bits after the flag
+	static u64 read_gamma(InputBitStream& in, u64 bits)
+	{
+		unsigned available = in.buffered_bits() - 1;
+		unsigned n = bits ? __builtin_ctzll(bits) : 64;
+		if (n > 16 || 2 * n + 1 > available)
+			throw runtime_error("Malformed data - invalid LZ match length.");
+		u64 value = (1ull << n) | ((bits >> (n + 1)) & ((1ull << n) - 1));
+		in.consume_bits(2 * n + 2);
+		return value;
+	}
+
+	NitroEncoderType	_type;
+	bool				_metadata_read{ false };
+};
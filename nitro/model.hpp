@@ -0,0 +1,143 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * Static order-0 model for the entropy coders
+ *
+ * The symbol counts are scaled so the frequencies sum up to scale (2^12),
+ * every symbol present in the data keeps a frequency of at least 1.
+ *
+ * Serialized form:
+ *	- entry count (2 bytes)
+ *	- entries in increasing symbol order: symbol (1 byte), frequency (2 bytes)
+ */
+class FrequencyTable
+{
+public:
+	static const unsigned	scale_bits = 12;
+	static const u32		scale = 1u << scale_bits;
+	static const u64		sizeof_entry = 3;
+
+	// worst case size of the serialized table (all 256 symbols present)
+	static u64	max_serialized_size() { return protocol::sizeof_table_entry_size + 256 * sizeof_entry; }
+
+	/* counts[256] - occurrences of every byte value, at least one is non zero */
+	void normalize(const u64* counts)
+	{
+		u64 total = 0;
+		for (unsigned sym = 0; sym < 256; sym++)
+			total += counts[sym];
+		assert(total);
+		u32 sum = 0;
+		for (unsigned sym = 0; sym < 256; sym++) {
+			u32 f = 0;
+			if (counts[sym]) {
+				f = (u32)(((unsigned __int128)counts[sym] * scale + total / 2) / total);
+				if (!f)
+					f = 1;
+			}
+			_freq[sym] = f;
+			sum += f;
+		}
+		// rounding (and the minimum of 1) leaves the sum off by a little - the
+		// correction is taken from/given to the most frequent symbols, where it costs the least
+		while (sum != scale) {
+			unsigned top = 0;
+			for (unsigned sym = 1; sym < 256; sym++) {
+				if (_freq[sym] > _freq[top])
+					top = sym;
+			}
+			if (sum < scale) {
+				_freq[top] += scale - sum;
+				sum = scale;
+			}
+			else {
+				u32 excess = std::min(sum - scale, _freq[top] - 1);
+				_freq[top] -= excess;
+				sum -= excess;
+			}
+		}
+		build_cumulative();
+	}
+
+	u32			freq(u8 sym) const { return _freq[sym]; }
+	u32			cum(u8 sym) const { return _cum[sym]; }
+	unsigned	size() const { return _size; }
+	u64			serialized_size() const { return protocol::sizeof_table_entry_size + _size * sizeof_entry; }
+
+	u8*	write(u8* out) const
+	{
+		u16 count = (u16)_size;
+		memcpy(out, &count, sizeof(count));
+		out += sizeof(count);
+		for (unsigned sym = 0; sym < 256; sym++) {
+			if (!_freq[sym])
+				continue;
+			u16 f = (u16)_freq[sym];
+			*out++ = (u8)sym;
+			memcpy(out, &f, sizeof(f));
+			out += sizeof(f);
+		}
+		return out;
+	}
+
+	/* returns the position after the table, throws on malformed tables */
+	const u8* read(const u8* in, const u8* end)
+	{
+		if ((u64)(end - in) < protocol::sizeof_table_entry_size)
+			throw runtime_error("Malformed metadata - frequency table is truncated.");
+		u16 count;
+		memcpy(&count, in, sizeof(count));
+		in += sizeof(count);
+		if (count == 0 || count > 256)
+			throw runtime_error("Malformed metadata - frequency table size can be 1 to 256.");
+		if ((u64)(end - in) < count * sizeof_entry)
+			throw runtime_error("Malformed metadata - frequency table is truncated.");
+		memset(_freq, 0, sizeof(_freq));
+		u32 sum = 0;
+		int previous = -1;
+		for (unsigned i = 0; i < count; i++) {
+			u8 sym = *in++;
+			u16 f;
+			memcpy(&f, in, sizeof(f));
+			in += sizeof(f);
+			if ((int)sym <= previous || f == 0)
+				throw runtime_error("Malformed metadata - invalid frequency table entry.");
+			previous = sym;
+			_freq[sym] = f;
+			sum += f;
+		}
+		if (sum != scale)
+			throw runtime_error("Malformed metadata - frequencies do not add up to the model scale.");
+		build_cumulative();
+		return in;
+	}
+
+	/* slots[scale] - the symbol owning every cumulative frequency slot */
+	void fill_slots(u8* slots) const
+	{
+		for (unsigned sym = 0; sym < 256; sym++)
+			memset(slots + _cum[sym], sym, _freq[sym]);
+	}
+
+private:
+	void build_cumulative()
+	{
+		_size = 0;
+		u32 c = 0;
+		for (unsigned sym = 0; sym < 256; sym++) {
+			_cum[sym] = c;
+			c += _freq[sym];
+			_size += _freq[sym] != 0;
+		}
+		_cum[256] = c;
+	}
+
+	u32			_freq[256]{ 0 };
+	u32			_cum[257]{ 0 };
+	unsigned	_size{ 0 };
+};
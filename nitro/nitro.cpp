@@ -1,6 +1,19 @@
 #include <nitro/nitro.h>
 #include "encoder.hpp"
 #include "decoder.hpp"
+#include "stream.hpp"
+#include "access.hpp"
+#include "range.hpp"
+#include "rans.hpp"
+#include "huffman.hpp"
+#include "raw.hpp"
+#include "select.hpp"
+#include "rle.hpp"
+#include "dna.hpp"
+#include "context.hpp"
+#include "batch.hpp"
+#include "lz.hpp"
+#include "dictionary.hpp"
 
 #include <memory>
 #include <exception>
@@ -12,24 +25,88 @@ static void unknown_decoder_type(NitroEncoderType type)
 	fprintf(stderr, "Error- Unknown decoder type detected: %d\n", type);
 }
 
-NitroData nitro_compress(const uint8_t* input, uint64_t len, NitroEncoderType type)
+unique_ptr<Encoder> make_encoder(NitroEncoderType type, const u8* input, u64 len, unsigned threads)
 {
-    unique_ptr<Encoder> encoder {nullptr};
-    switch(type) {
-        case BLOCK:
-            encoder = make_unique<BlockEncoder>(input, len);
-            break;
-        default:
-			unknown_decoder_type(type);
-            break;
-    }
+	switch (type) {
+	case BLOCK:
+		return make_unique<BlockEncoder>(input, len);
+	case BLOCK_CHUNKED:
+		return make_unique<ChunkedBlockEncoder>(input, len, threads);
+	case STREAM:
+		return make_unique<StreamEncoder>(input, len);
+	case RANGE:
+		return make_unique<RangeEncoder>(input, len);
+	case RANS:
+		return make_unique<RansEncoder>(input, len);
+	case HUFFMAN:
+		return make_unique<HuffmanEncoder>(input, len);
+	case RAW:
+		return make_unique<RawEncoder>(input, len);
+	case AUTO:
+		return make_unique<AutoEncoder>(input, len, threads);
+	case RLE:
+		return make_unique<RleEncoder>(input, len, threads);
+	case DNA:
+		return make_unique<DnaEncoder>(input, len);
+	case LZ:
+		return make_unique<LzEncoder>(input, len);
+	default:
+		return nullptr;
+	}
+}
+
+unique_ptr<Decoder> make_decoder(const u8* encoded, u64 len, unsigned threads)
+{
+	switch (determine_type(encoded)) {
+	case BLOCK:
+		return make_unique<BlockDecoder>(encoded, len, threads);
+	case BLOCK_CHUNKED:
+		return make_unique<ChunkedBlockDecoder>(encoded, len, threads);
+	case STREAM:
+		return make_unique<StreamDecoder>(encoded, len);
+	case RANGE:
+		return make_unique<RangeDecoder>(encoded, len);
+	case RANS:
+		return make_unique<RansDecoder>(encoded, len);
+	case HUFFMAN:
+		return make_unique<HuffmanDecoder>(encoded, len);
+	case RAW:
+		return make_unique<RawDecoder>(encoded, len);
+	case RLE:
+		return make_unique<RleDecoder>(encoded, len, threads);
+	case DNA:
+		return make_unique<DnaDecoder>(encoded, len);
+	case LZ:
+		return make_unique<LzDecoder>(encoded, len);
+	case SHARED:
+		return make_unique<SharedDecoder>(encoded, len, nullptr, 0);	// no table - decode() throws
+	case DICT:
+		return make_unique<DictDecoder>(encoded, len, nullptr, 0);		// no dictionary - decode() throws
+	default:
+		return nullptr;
+	}
+}
+
+/*
+ * Common implementation of the compress/decompress variants
+ * output == nullptr means the result is malloc-ed
+ */
+static NitroData compress(const uint8_t* input, uint64_t len, NitroEncoderType type, unsigned threads,
+						  uint8_t* output, uint64_t capacity)
+{
+    unique_ptr<Encoder> encoder = make_encoder(type, input, len, threads);
+    if (!encoder)
+		unknown_decoder_type(type);
 	NitroData data{ nullptr, 0, type};
     // check for nullptr
     if(!encoder || !len) 
         return data;
 
+	stats::Call call(len);
 	try
 	{
+		if (output)
+			encoder->set_output(output, capacity);
 		data = encoder->encode();
 	}
 	catch (const exception& err)
@@ -37,32 +114,31 @@ NitroData nitro_compress(const uint8_t* input, uint64_t len, NitroEncoderType ty
 		data.data = nullptr;
 		data.len = 0;
 	}
+	call.finish(data.len);
 	return data;
 }
 
-NitroData nitro_decompress(const uint8_t * encoded, uint64_t len)
+static NitroData decompress(const uint8_t * encoded, uint64_t len, unsigned threads,
+							uint8_t* output, uint64_t capacity)
 {
 	NitroData data{ nullptr, 0, (NitroEncoderType)0 };
-	NitroEncoderType type;
+	NitroEncoderType type{ (NitroEncoderType)0 };
+	stats::Call call(len);
 	try
 	{
 		if(!encoded || !len)
 			throw runtime_error("Invalid input to decoder!");
-		unique_ptr<Decoder> decoder{ nullptr };
 		type = determine_type(encoded);
-		switch (type) {
-		case BLOCK:
-			decoder = make_unique<BlockDecoder>(encoded, len);
-			break;
-		default:
+		unique_ptr<Decoder> decoder = make_decoder(encoded, len, threads);
+		if (!decoder)
 			unknown_decoder_type(type);
-			break;
-		}
 
 		// check for nullptr
 		if (!decoder)
 			throw runtime_error("Failed to obtain decoder object!");
 
+		if (output)
+			decoder->set_output(output, capacity);
 		data = decoder->decode();	// throws
 	}
 	catch (runtime_error& err)
@@ -70,9 +146,452 @@ NitroData nitro_decompress(const uint8_t * encoded, uint64_t len)
 		cerr << err.what() << endl;
 		data.enctype = type;
 	}
+	call.finish(data.len);
+	return data;
+}
+
+int nitro_set_option(NitroOption option, int value)
+{
+	switch (option) {
+	case NITRO_OPTION_STATS:
+	{
+		int previous = stats::enabled();
+		stats::enabled() = value != 0;
+		return previous;
+	}
+	case NITRO_OPTION_CHECKSUM:
+	{
+		int previous = checksum::enabled();
+		checksum::enabled() = value != 0;
+		return previous;
+	}
+	case NITRO_OPTION_LZ_LEVEL:
+	{
+		if (value < lz::min_level || value > lz::max_level)
+			return -1;
+		int previous = lz::level();
+		lz::level() = value;
+		return previous;
+	}
+	default:
+		return -1;
+	}
+}
+
+int nitro_get_last_stats(NitroStats* out)
+{
+	if (!out || !stats::enabled())
+		return 0;
+	*out = stats::current();
+	return 1;
+}
+
+NitroData nitro_compress(const uint8_t* input, uint64_t len, NitroEncoderType type)
+{
+	return compress(input, len, type, 0, nullptr, 0);
+}
+
+NitroData nitro_decompress(const uint8_t * encoded, uint64_t len)
+{
+	return decompress(encoded, len, 0, nullptr, 0);
+}
+
+NitroData nitro_compress_mt(const uint8_t* input, uint64_t len, NitroEncoderType type, unsigned threads)
+{
+	return compress(input, len, type, threads, nullptr, 0);
+}
+
+NitroData nitro_decompress_mt(const uint8_t * encoded, uint64_t len, unsigned threads)
+{
+	return decompress(encoded, len, threads, nullptr, 0);
+}
+
+uint64_t nitro_compress_bound(uint64_t len, NitroEncoderType type)
+{
+	switch (type) {
+	case BLOCK:
+		return BlockEncoder::max_encoded_size(len);
+	case BLOCK_CHUNKED:
+		return ChunkedBlockEncoder::max_encoded_size(len);
+	case STREAM:
+		return stream::max_encoded_size(len, protocol::default_chunk_size);
+	case RANGE:
+		return range_coder::max_encoded_size(len);
+	case RANS:
+		return rans::max_encoded_size(len);
+	case HUFFMAN:
+		return huffman::max_encoded_size(len);
+	case RAW:
+		return raw::max_encoded_size(len);
+	case AUTO:
+		return autoselect::max_encoded_size(len);
+	case RLE:
+		return rle::max_encoded_size(autoselect::max_encoded_size(len));
+	case DNA:
+		return dna::max_encoded_size(len);
+	case SHARED:
+		return shared::max_encoded_size(len);
+	case LZ:
+		return lz::max_encoded_size(len);
+	case DICT:
+		return dictionary::max_encoded_size(len);
+	default:
+		return 0;
+	}
+}
+
+uint64_t nitro_decompressed_size(const uint8_t* encoded, uint64_t len)
+{
+	try
+	{
+		if (!encoded || !len)
+			throw runtime_error("Invalid input to decoder!");
+		unique_ptr<Decoder> decoder = make_decoder(encoded, len, 1);
+		if (decoder)
+			return decoder->decoded_size();	// throws
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return 0;
+}
+
+NitroData nitro_compress_into(const uint8_t* input, uint64_t len, NitroEncoderType type,
+							  uint8_t* output, uint64_t capacity)
+{
+	if (!output)
+		return NitroData{ nullptr, 0, type };
+	return compress(input, len, type, 0, output, capacity);
+}
+
+NitroData nitro_decompress_into(const uint8_t* encoded, uint64_t len, uint8_t* output, uint64_t capacity)
+{
+	if (!output)
+		return NitroData{ nullptr, 0, (NitroEncoderType)0 };
+	return decompress(encoded, len, 0, output, capacity);
+}
+
+NitroStream* nitro_stream_init(NitroStreamMode mode, uint64_t segment_size)
+{
+	try
+	{
+		if (mode == NITRO_STREAM_COMPRESS)
+			return new StreamCompressor(segment_size);
+		if (mode == NITRO_STREAM_DECOMPRESS)
+			return new StreamDecompressor();
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return nullptr;
+}
+
+NitroStreamStatus nitro_stream_update(NitroStream* stream, const uint8_t* input, uint64_t len, uint64_t* consumed,
+									  uint8_t* output, uint64_t capacity, uint64_t* written)
+{
+	if (!stream || !consumed || !written)
+		return NITRO_STREAM_ERROR;
+	*consumed = 0;
+	*written = 0;
+	if ((!input && len) || (!output && capacity))
+		return NITRO_STREAM_ERROR;
+	try
+	{
+		return stream->update(input, len, *consumed, output, capacity, *written);
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return NITRO_STREAM_ERROR;
+}
+
+NitroStreamStatus nitro_stream_finish(NitroStream* stream, uint8_t* output, uint64_t capacity, uint64_t* written)
+{
+	if (!stream || !written)
+		return NITRO_STREAM_ERROR;
+	*written = 0;
+	if (!output && capacity)
+		return NITRO_STREAM_ERROR;
+	try
+	{
+		return stream->finish(output, capacity, *written);
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return NITRO_STREAM_ERROR;
+}
+
+void nitro_stream_free(NitroStream* stream)
+{
+	delete stream;
+}
+
+NitroHandle* nitro_open(const uint8_t* encoded, uint64_t len)
+{
+	try
+	{
+		return new NitroHandle(encoded, len);
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return nullptr;
+}
+
+void nitro_close(NitroHandle* handle)
+{
+	delete handle;
+}
+
+uint64_t nitro_handle_length(const NitroHandle* handle)
+{
+	return handle ? handle->size() : 0;
+}
+
+int nitro_handle_get_symbol(const NitroHandle* handle, uint64_t index)
+{
+	if (!handle || index >= handle->size())
+		return -1;
+	return handle->at(index);
+}
+
+uint64_t nitro_handle_get_range(const NitroHandle* handle, uint64_t offset, uint64_t count, uint8_t* out)
+{
+	if (!handle || !out || offset > handle->size() || count > handle->size() - offset)
+		return 0;
+	handle->range(offset, count, out);
+	return count;
+}
+
+int nitro_handle_build_index(NitroHandle* handle)
+{
+	if (!handle)
+		return 0;
+	try
+	{
+		handle->build_index();
+		return 1;
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return 0;
+}
+
+uint64_t nitro_rank(const NitroHandle* handle, uint8_t sym, uint64_t pos)
+{
+	if (!handle || pos > handle->size())
+		return UINT64_MAX;
+	return handle->rank(sym, pos);
+}
+
+int64_t nitro_select(const NitroHandle* handle, uint8_t sym, uint64_t k)
+{
+	if (!handle)
+		return -1;
+	u64 pos = handle->select(sym, k);
+	return pos < handle->size() ? (int64_t)pos : -1;
+}
+
+int64_t nitro_handle_search(const NitroHandle* handle, const uint8_t* pattern, uint64_t pattern_len,
+	NitroSearchCallback callback, void* user)
+{
+	if (!handle || !callback)
+		return -1;
+	try
+	{
+		int64_t matches = 0;
+		handle->search(pattern, pattern_len, [&](u64 position) {
+			matches++;
+			return callback(position, user) != 0;
+		});
+		return matches;
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return -1;
+}
+
+int nitro_get_symbol(const uint8_t* encoded, uint64_t len, uint64_t index)
+{
+	NitroHandle* handle = nitro_open(encoded, len);
+	int sym = nitro_handle_get_symbol(handle, index);
+	nitro_close(handle);
+	return sym;
+}
+
+uint64_t nitro_get_range(const uint8_t* encoded, uint64_t len, uint64_t offset, uint64_t count, uint8_t* out)
+{
+	NitroHandle* handle = nitro_open(encoded, len);
+	u64 written = nitro_handle_get_range(handle, offset, count, out);
+	nitro_close(handle);
+	return written;
+}
+
+int64_t nitro_search(const uint8_t* encoded, uint64_t len, const uint8_t* pattern, uint64_t pattern_len,
+	NitroSearchCallback callback, void* user)
+{
+	if (!encoded || !len || !pattern || !pattern_len || !callback)
+		return -1;
+	unique_ptr<NitroHandle> handle;
+	try
+	{
+		handle = make_unique<NitroHandle>(encoded, len);
+	}
+	catch (const exception&)
+	{
+		// not randomly accessible (or malformed) - decompress then search
+	}
+	if (handle)
+		return nitro_handle_search(handle.get(), pattern, pattern_len, callback, user);
+	NitroData data = nitro_decompress(encoded, len);
+	if (!data.data)
+		return -1;
+	int64_t matches = 0;
+	auto visit = [&](u64 position) {
+		matches++;
+		return callback(position, user) != 0;
+	};
+	if (pattern_len <= data.len)
+		packedsearch::find_bytes(data.data, data.len - pattern_len + 1, pattern, pattern_len, visit);
+	free(data.data);
+	return matches;
+}
+
+NitroContext* nitro_context_create(void)
+{
+	try
+	{
+		return new NitroContext();
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return nullptr;
+}
+
+uint32_t nitro_context_prime(NitroContext* ctx, const uint8_t* sample, uint64_t len)
+{
+	if (!ctx)
+		return 0;
+	try
+	{
+		return ctx->prime(sample, len);
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return 0;
+}
+
+NitroData nitro_context_compress(NitroContext* ctx, const uint8_t* input, uint64_t len)
+{
+	NitroData data{ nullptr, 0, NitroEncoderType::SHARED };
+	if (!ctx || !input || !len)
+		return data;
+	try
+	{
+		data = ctx->compress(input, len);
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return data;
+}
+
+NitroData nitro_context_decompress(NitroContext* ctx, const uint8_t* encoded, uint64_t len)
+{
+	NitroData data{ nullptr, 0, (NitroEncoderType)0 };
+	if (!ctx)
+		return data;
+	try
+	{
+		data = ctx->decompress(encoded, len);
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+		if (encoded && len)
+			data.enctype = determine_type(encoded);
+	}
 	return data;
 }
 
+uint32_t nitro_context_load_dictionary(NitroContext* ctx, const uint8_t* dictionary, uint64_t len)
+{
+	if (!ctx)
+		return 0;
+	try
+	{
+		return ctx->load_dictionary(dictionary, len);
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return 0;
+}
+
+void nitro_context_free(NitroContext* ctx)
+{
+	delete ctx;
+}
+
+NitroBatch nitro_compress_batch(const NitroBuffer* items, uint64_t count, NitroEncoderType type, unsigned threads)
+{
+	try
+	{
+		return batch::compress(items, count, type, threads);
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return NitroBatch{ nullptr, nullptr, 0 };
+}
 
+NitroBatch nitro_decompress_batch(const NitroBuffer* items, uint64_t count, unsigned threads)
+{
+	try
+	{
+		return batch::decompress(items, count, threads);
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return NitroBatch{ nullptr, nullptr, 0 };
+}
 
+void nitro_batch_free(NitroBatch* batch)
+{
+	if (!batch)
+		return;
+	free(batch->offsets);		// the arena lives in the same allocation
+	*batch = NitroBatch{ nullptr, nullptr, 0 };
+}
 
+NitroData nitro_train_dictionary(const NitroBuffer* samples, uint64_t count, uint64_t capacity)
+{
+	try
+	{
+		return dictionary::serialize(dictionary::train(samples, count, capacity));
+	}
+	catch (const exception& err)
+	{
+		cerr << err.what() << endl;
+	}
+	return NitroData{ nullptr, 0, NitroEncoderType::DICT };
+}
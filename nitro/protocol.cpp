@@ -4,4 +4,5 @@ namespace protocol
 {
 	const int	sizeof_encoder_type{ 1 };
 	const u64	sizeof_table_entry_size{ 2 };
+	const u64	default_chunk_size{ 1 << 20 };		// symbols per chunk in chunked frames
 }
\ No newline at end of file
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "common.hpp"
+#include "entropy.hpp"
+
+/*
+ * Range coding with a static order-0 model (RANGE)
+ *
+ * Frame: see entropy.hpp, the data is the range coded input.
+ *
+ * The coder is the LZMA style one: 32 bit range, 33 bit low and carry propagation
+ * through the cached byte and the count of pending 0xFF bytes. The first byte of the
+ * data is the initial cache byte and always 0.
+ * A symbol costs log2(scale / freq) bits so skewed distributions (DNA with a few
+ * N runs) come out well below the fixed width of the block encoding.
+ */
+namespace range_coder
+{
+	const u32	top = 1u << 24;		// renormalize once the range drops below this
+	const u64	sizeof_flush = 5;
+
+	// worst case size of the coded data: a symbol with frequency 1 costs 12 bits
+	inline u64 max_data_size(u64 len)
+	{
+		return len + len / 2 + len / 1024 + sizeof_flush + 1;
+	}
+	inline u64 max_encoded_size(u64 len)
+	{
+		return entropy::max_header_size() + max_data_size(len);
+	}
+}
+
+class RangeEncoder : public EntropyEncoder
+{
+public:
+	RangeEncoder(const u8* input, uint64_t len) :
+		EntropyEncoder(input, len, NitroEncoderType::RANGE)
+	{
+	}
+	virtual ~RangeEncoder() {}
+
+protected:
+	virtual u64 max_data_size() const override { return range_coder::max_data_size(_len); }
+
+	virtual u8* compress(u8* out, u8* end) override
+	{
+		_out = out;
+		_end = end;
+		for (u64 i = 0; i < _len; i++) {
+			u8 sym = _input[i];
+			u32 r = _range >> FrequencyTable::scale_bits;
+			_low += (u64)r * _model.cum(sym);
+			_range = r * _model.freq(sym);
+			while (_range < range_coder::top) {
+				_range <<= 8;
+				shift_low();
+			}
+		}
+		for (u64 i = 0; i < range_coder::sizeof_flush; i++)
+			shift_low();
+		return _out;
+	}
+
+private:
+	void shift_low()
+	{
+		// the top byte is settled unless it is 0xFF and a carry may still arrive
+		if ((u32)_low < 0xFF000000u || (_low >> 32)) {
+			u8 carry = (u8)(_low >> 32);
+			u8 byte = _cache;
+			do {
+				put((u8)(byte + carry));
+				byte = 0xFF;
+			} while (--_pending);
+			_cache = (u8)(_low >> 24);
+		}
+		_pending++;
+		_low = (_low & 0x00FFFFFF) << 8;
+	}
+
+	void put(u8 byte)
+	{
+		if (_out == _end)
+			throw runtime_error("Output buffer is too small to hold the encoded result.");
+		*_out++ = byte;
+	}
+
+	u64		_low{ 0 };
+	u32		_range{ 0xFFFFFFFFu };
+	u8		_cache{ 0 };
+	u64		_pending{ 1 };		// cached byte + following 0xFF bytes not written yet
+	u8*		_out{ nullptr };
+	u8*		_end{ nullptr };
+};
+
+
+class RangeDecoder : public EntropyDecoder
+{
+public:
+	RangeDecoder(const u8* encoded, uint64_t len) :
+		EntropyDecoder(encoded, len, NitroEncoderType::RANGE)
+	{
+	}
+	virtual ~RangeDecoder() {}
+
+protected:
+	virtual u64 min_data_size() const override { return range_coder::sizeof_flush; }
+
+	virtual void decompress(u8* output) override
+	{
+		u8 slots[FrequencyTable::scale];
+		_model.fill_slots(slots);
+		const u8* p = _data + 1;	// initial cache byte
+		const u8* end = _encoded + _len;
+		u32 code = 0;
+		for (int i = 0; i < 4; i++)
+			code = (code << 8) | *p++;
+		u32 range = 0xFFFFFFFFu;
+		for (u64 i = 0; i < _orig_len; i++) {
+			u32 r = range >> FrequencyTable::scale_bits;
+			u32 slot = code / r;
+			if (slot >= FrequencyTable::scale)
+				throw runtime_error("Malformed data - range coded value is out of range.");
+			u8 sym = slots[slot];
+			output[i] = sym;
+			code -= r * _model.cum(sym);
+			range = r * _model.freq(sym);
+			while (range < range_coder::top) {
+				// valid data is consumed exactly
+				if (p == end)
+					throw runtime_error("Malformed data - range coded data is shorter than the original length requires.");
+				code = (code << 8) | *p++;
+				range <<= 8;
+			}
+		}
+		if (p != end)
+			throw runtime_error("Malformed data - range coded data does not match the original length.");
+	}
+};
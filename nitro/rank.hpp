@@ -0,0 +1,165 @@
+#pragma once
+
+#include "common.hpp"
+#include "bitpack.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * Counting and locating one code in packed data (rank/select, see access.hpp)
+ *
+ * Symbol i of a block of width W sits at bit i * W, so 8 * floor(8 / W) symbols
+ * (a group) fill at most 8 bytes starting on a byte boundary. A group is loaded
+ * as one word and compared with the code in all fields at once: XOR with the code
+ * repeated in every field leaves a zero field where the code matches, OR-ing the
+ * field bits down to the lowest one and inverting leaves one bit per match,
+ * which popcount counts and count trailing zeros locates.
+ */
+namespace rankselect
+{
+	// popcnt instruction when the build targets it, otherwise the SWAR bit count (no libgcc call)
+	inline unsigned popcount(u64 x)
+	{
+#ifdef __POPCNT__
+		return (unsigned)__builtin_popcountll(x);
+#else
+		x = x - ((x >> 1) & 0x5555555555555555ull);
+		x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+		x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		return (unsigned)((x * 0x0101010101010101ull) >> 56);
+#endif
+	}
+
+	template<unsigned W>
+	struct Group
+	{
+		static const unsigned	symbols = 8 * (8 / W);
+		static const unsigned	bytes = symbols * W / 8;
+		// the lowest bit of every field
+		static u64 lows()
+		{
+			u64 low = 0;
+			for (unsigned i = 0; i < symbols; i++)
+				low |= 1ull << (i * W);
+			return low;
+		}
+	};
+
+	// one bit (the lowest of the field) per field of word equal to code
+	template<unsigned W>
+	inline u64 matches(u64 word, u64 pattern, u64 low)
+	{
+		u64 x = word ^ pattern;
+		u64 y = x;
+		for (unsigned s = 1; s < W; s++)
+			y |= x >> s;
+		return ~y & low;
+	}
+
+	/*
+	 * Walks the groups covering the symbols [first, last), calls visit(position of the
+	 * group, match bits) until it returns false.
+	 */
+	template<unsigned W, typename Visit>
+	inline void scan(const u8* data, u64 first, u64 last, u8 code, Visit visit)
+	{
+		typedef Group<W> G;
+		const u64 low = G::lows();
+		const u64 pattern = low * code;
+		u64 pos = first & ~7ull;
+		while (pos < last) {
+			u64 n = std::min<u64>(G::symbols, last - pos);
+			u64 word = 0;
+			const u8* p = data + pos / 8 * W;
+			if (n == G::symbols)
+				memcpy(&word, p, G::bytes);
+			else
+				memcpy(&word, p, (n * W + 7) / 8);
+			u64 m = matches<W>(word, pattern, low);
+			if (n < G::symbols)
+				m &= (1ull << (n * W)) - 1;
+			if (pos < first)
+				m &= ~((1ull << ((first - pos) * W)) - 1);
+			if (!visit(pos, m))
+				return;
+			pos += n;
+		}
+	}
+
+	template<unsigned W>
+	inline u64 count(const u8* data, u64 first, u64 last, u8 code)
+	{
+		u64 total = 0;
+		scan<W>(data, first, last, code, [&total](u64, u64 m) {
+			total += popcount(m);
+			return true;
+		});
+		return total;
+	}
+
+	template<unsigned W>
+	inline u64 select(const u8* data, u64 first, u64 last, u8 code, u64& k)
+	{
+		u64 found = last;
+		scan<W>(data, first, last, code, [&](u64 pos, u64 m) {
+			u64 c = popcount(m);
+			if (c <= k) {
+				k -= c;
+				return true;
+			}
+			for (; k; k--)
+				m &= m - 1;
+			found = pos + __builtin_ctzll(m) / W;
+			return false;
+		});
+		return found;
+	}
+
+	/* number of codes equal to code among the symbols [first, last) of a block of the given width */
+	inline u64 count(unsigned width, const u8* data, u64 first, u64 last, u8 code)
+	{
+		if (first >= last || code >> width)
+			return 0;
+		switch (width) {
+		case 0: return last - first;
+		case 1: return count<1>(data, first, last, code);
+		case 2: return count<2>(data, first, last, code);
+		case 3: return count<3>(data, first, last, code);
+		case 4: return count<4>(data, first, last, code);
+		case 5: return count<5>(data, first, last, code);
+		case 6: return count<6>(data, first, last, code);
+		case 7: return count<7>(data, first, last, code);
+		case 8: return count<8>(data, first, last, code);
+		default:
+			throw runtime_error("Block width can be max 8 bits.");
+		}
+	}
+
+	/*
+	 * Position of match k (0 = the first) of code among the symbols [first, last),
+	 * last if there are at most k - then k is reduced by the number of matches.
+	 */
+	inline u64 select(unsigned width, const u8* data, u64 first, u64 last, u8 code, u64& k)
+	{
+		if (first >= last || code >> width)
+			return last;
+		switch (width) {
+		case 0:
+			if (k < last - first)
+				return first + k;
+			k -= last - first;
+			return last;
+		case 1: return select<1>(data, first, last, code, k);
+		case 2: return select<2>(data, first, last, code, k);
+		case 3: return select<3>(data, first, last, code, k);
+		case 4: return select<4>(data, first, last, code, k);
+		case 5: return select<5>(data, first, last, code, k);
+		case 6: return select<6>(data, first, last, code, k);
+		case 7: return select<7>(data, first, last, code, k);
+		case 8: return select<8>(data, first, last, code, k);
+		default:
+			throw runtime_error("Block width can be max 8 bits.");
+		}
+	}
+}
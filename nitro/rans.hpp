@@ -0,0 +1,231 @@
+#pragma once
+
+#include "common.hpp"
+#include "bitpack.hpp"		// SIMD detection
+#include "entropy.hpp"
+
+#include <array>
+#include <cstring>
+
+/*
+ * Interleaved rANS with a static order-0 model (RANS)
+ *
+ * Frame: see entropy.hpp, the data is:
+ *	- final states of the 8 coders (4 bytes each)
+ *	- 16 bit renormalization words
+ *
+ * Symbol i is coded by coder i % 8. The 8 states are independent so their decode
+ * steps overlap in the pipeline, the AVX2 decoder runs the 8 states in the lanes of
+ * one register (table lookups by gather, the words are distributed to the lanes
+ * which need them with a permute).
+ * States are kept in [2^16, 2^32) and renormalized 16 bits at a time, so one read
+ * always brings a state back into range. The encoder works from the last symbol to
+ * the first writing the words backwards - the decoder reads them in the order it
+ * needs them. Every coder starts from the lower bound of the state range, the
+ * decoder checks it ends there.
+ */
+namespace rans
+{
+	const unsigned	lanes = 8;
+	const u32		lower_bound = 1u << 16;
+	const u64		sizeof_states = lanes * sizeof(u32);
+
+	// worst case size of the coded data: a symbol with frequency 1 costs 12 bits
+	inline u64 max_data_size(u64 len)
+	{
+		return len + len / 2 + len / 1024 + sizeof_states + lanes * sizeof(u16);
+	}
+	inline u64 max_encoded_size(u64 len)
+	{
+		return entropy::max_header_size() + max_data_size(len);
+	}
+
+	/* table[scale] entries: symbol | (freq - 1) << 8 | (slot - cum) << 20 */
+	inline void build_decode_table(const FrequencyTable& model, u32* table)
+	{
+		for (unsigned sym = 0; sym < 256; sym++) {
+			u32 freq = model.freq((u8)sym);
+			u32 cum = model.cum((u8)sym);
+			for (u32 i = 0; i < freq; i++)
+				table[cum + i] = sym | (freq - 1) << 8 | i << 20;
+		}
+	}
+
+	inline u8 decode_step(u32& x, const u32* table)
+	{
+		u32 e = table[x & (FrequencyTable::scale - 1)];
+		x = (((e >> 8) & 0xFFF) + 1) * (x >> FrequencyTable::scale_bits) + (e >> 20);
+		return (u8)e;
+	}
+
+	// renormalization from checked input
+	inline void refill(u32& x, const u8*& p, const u8* end)
+	{
+		if (x < lower_bound) {
+			if (end - p < (ptrdiff_t)sizeof(u16))
+				throw runtime_error("Malformed data - rANS data is shorter than the original length requires.");
+			u16 w;
+			memcpy(&w, p, sizeof(w));
+			p += sizeof(w);
+			x = x << 16 | w;
+		}
+	}
+
+#ifdef NITRO_X86_SIMD
+	/* for every mask of renormalizing lanes: the word index each lane takes */
+	inline const u32* refill_permutations()
+	{
+		static const auto lut = []() {
+			std::array<u32, 256 * lanes> t{};
+			for (unsigned mask = 0; mask < 256; mask++) {
+				u32 next = 0;
+				for (unsigned lane = 0; lane < lanes; lane++) {
+					if (mask & (1u << lane))
+						t[mask * lanes + lane] = next++;
+				}
+			}
+			return t;
+		}();
+		return lut.data();
+	}
+
+	/*
+	 * Decodes groups of 8 symbols while 16 bytes of input are left
+	 * Returns the number of groups decoded.
+	 */
+	__attribute__((target("avx2")))
+	inline u64 decode_avx2(u32* states, const u32* table, const u8*& p, const u8* end, u8* out, u64 groups)
+	{
+		const u32* perms = refill_permutations();
+		const __m256i slot_mask = _mm256_set1_epi32(FrequencyTable::scale - 1);
+		const __m256i freq_mask = _mm256_set1_epi32(0xFFF);
+		const __m256i one = _mm256_set1_epi32(1);
+		const __m256i zero = _mm256_setzero_si256();
+		// low byte of every lane (the symbol) to the first 4 bytes of each 128 bit half
+		const __m256i sym_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+												   0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+		const __m256i sym_halves = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+		__m256i x = _mm256_loadu_si256((const __m256i*)states);
+		u64 g = 0;
+		for (; g < groups && end - p >= 16; g++) {
+			__m256i e = _mm256_i32gather_epi32((const int*)table, _mm256_and_si256(x, slot_mask), 4);
+			__m256i syms = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(e, sym_bytes), sym_halves);
+			_mm_storel_epi64((__m128i*)(out + g * lanes), _mm256_castsi256_si128(syms));
+			__m256i freq = _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(e, 8), freq_mask), one);
+			x = _mm256_add_epi32(_mm256_mullo_epi32(freq, _mm256_srli_epi32(x, FrequencyTable::scale_bits)),
+								 _mm256_srli_epi32(e, 20));
+			// lanes below the lower bound take the next words in lane order
+			__m256i low = _mm256_cmpeq_epi32(_mm256_srli_epi32(x, 16), zero);
+			unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(low));
+			__m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+			__m256i perm = _mm256_loadu_si256((const __m256i*)(perms + mask * lanes));
+			__m256i refilled = _mm256_or_si256(_mm256_slli_epi32(x, 16), _mm256_permutevar8x32_epi32(words, perm));
+			x = _mm256_blendv_epi8(x, refilled, low);
+			p += __builtin_popcount(mask) * sizeof(u16);
+		}
+		_mm256_storeu_si256((__m256i*)states, x);
+		return g;
+	}
+#endif // NITRO_X86_SIMD
+}
+
+class RansEncoder : public EntropyEncoder
+{
+public:
+	RansEncoder(const u8* input, uint64_t len) :
+		EntropyEncoder(input, len, NitroEncoderType::RANS)
+	{
+	}
+	virtual ~RansEncoder() {}
+
+protected:
+	virtual u64 max_data_size() const override { return rans::max_data_size(_len); }
+
+	virtual u8* compress(u8* out, u8* end) override
+	{
+		// states at or above x_max would leave the state range after coding the symbol
+		u64 x_max[256];
+		for (unsigned sym = 0; sym < 256; sym++)
+			x_max[sym] = (u64)((rans::lower_bound >> FrequencyTable::scale_bits) << 16) * _model.freq((u8)sym);
+		u32 x[rans::lanes];
+		for (auto& state : x)
+			state = rans::lower_bound;
+		u8* p = end;
+		for (u64 i = _len; i-- > 0;) {
+			u32& state = x[i % rans::lanes];
+			u8 sym = _input[i];
+			u32 freq = _model.freq(sym);
+			if (state >= x_max[sym]) {
+				if (p - out < (ptrdiff_t)sizeof(u16))
+					throw runtime_error("Output buffer is too small to hold the encoded result.");
+				u16 w = (u16)state;
+				p -= sizeof(w);
+				memcpy(p, &w, sizeof(w));
+				state >>= 16;
+			}
+			state = ((state / freq) << FrequencyTable::scale_bits) + state % freq + _model.cum(sym);
+		}
+		if ((u64)(p - out) < rans::sizeof_states)
+			throw runtime_error("Output buffer is too small to hold the encoded result.");
+		p -= rans::sizeof_states;
+		memcpy(p, x, rans::sizeof_states);
+		u64 len = end - p;
+		memmove(out, p, len);
+		return out + len;
+	}
+};
+
+
+class RansDecoder : public EntropyDecoder
+{
+public:
+	RansDecoder(const u8* encoded, uint64_t len) :
+		EntropyDecoder(encoded, len, NitroEncoderType::RANS)
+	{
+	}
+	virtual ~RansDecoder() {}
+
+protected:
+	virtual u64 min_data_size() const override { return rans::sizeof_states; }
+
+	virtual void decompress(u8* output) override
+	{
+		vector<u32> table(FrequencyTable::scale);
+		rans::build_decode_table(_model, table.data());
+		const u8* p = _data;
+		const u8* end = _encoded + _len;
+		u32 x[rans::lanes];
+		memcpy(x, p, rans::sizeof_states);
+		p += rans::sizeof_states;
+		for (u32 state : x) {
+			if (state < rans::lower_bound)
+				throw runtime_error("Malformed data - rANS state is out of range.");
+		}
+
+		u64 groups = _orig_len / rans::lanes;
+		u64 g = 0;
+#ifdef NITRO_X86_SIMD
+		if (bitpack::detect_simd() == bitpack::SimdLevel::AVX2)
+			g = rans::decode_avx2(x, table.data(), p, end, output, groups);
+#endif // NITRO_X86_SIMD
+		for (; g < groups; g++) {
+			u8* out = output + g * rans::lanes;
+			for (unsigned lane = 0; lane < rans::lanes; lane++)
+				out[lane] = rans::decode_step(x[lane], table.data());
+			for (unsigned lane = 0; lane < rans::lanes; lane++)
+				rans::refill(x[lane], p, end);	// throws
+		}
+		for (u64 i = groups * rans::lanes; i < _orig_len; i++) {
+			u32& state = x[i % rans::lanes];
+			output[i] = rans::decode_step(state, table.data());
+			rans::refill(state, p, end);	// throws
+		}
+
+		if (p != end)
+			throw runtime_error("Malformed data - rANS data does not match the original length.");
+		for (u32 state : x) {
+			if (state != rans::lower_bound)
+				throw runtime_error("Malformed data - rANS decoder did not end in the initial state.");
+		}
+	}
+};
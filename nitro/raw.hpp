@@ -0,0 +1,108 @@
+#pragma once
+
+#include "common.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+
+#include <cstring>
+
+/*
+ * Stored frame for incompressible data (RAW)
+ *
+ * Layout:
+ *	- encoder type (1 byte)
+ *	- input length (8 bytes)
+ *	- the input as is
+ */
+namespace raw
+{
+	const u64	sizeof_header = protocol::sizeof_encoder_type + sizeof(u64);
+
+	inline u64 max_encoded_size(u64 len)
+	{
+		return sizeof_header + len;
+	}
+}
+
+class RawEncoder : public Encoder
+{
+public:
+	RawEncoder(const u8* input, uint64_t len) :
+		_input(input),
+		_len(len)
+	{
+		_type = NitroEncoderType::RAW;
+	}
+	virtual ~RawEncoder() {}
+
+	virtual NitroData encode() override
+	{
+		if (!_input || !_len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		u64 space_required = raw::max_encoded_size(_len);
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < space_required)
+				throw runtime_error("Output buffer is too small to hold the encoded result.");
+		}
+		else {
+			output = reinterpret_cast<u8*>(malloc(space_required));
+			if (!output)
+				throw runtime_error("Memory allocation failed");
+		}
+		output[0] = (u8)NitroEncoderType::RAW;
+		memcpy(output + protocol::sizeof_encoder_type, &_len, sizeof(u64));
+		memcpy(output + raw::sizeof_header, _input, _len);
+		return NitroData{ output, space_required, NitroEncoderType::RAW };
+	}
+
+private:
+	const u8*	_input;
+	u64			_len;
+};
+
+
+class RawDecoder : public Decoder
+{
+public:
+	RawDecoder(const u8* encoded, uint64_t len) :
+		_encoded(encoded),
+		_len(len)
+	{
+	}
+	virtual ~RawDecoder() {}
+
+	virtual NitroData decode() override
+	{
+		u64 len = decoded_size();	// throws
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < len)
+				throw runtime_error("Output buffer is too small to hold the decoded result");
+		}
+		else {
+			output = reinterpret_cast<u8*>(malloc(len));
+			if (!output)
+				throw runtime_error("Could not allocate enough space to hold decoded result");
+		}
+		memcpy(output, data(), len);
+		return NitroData{ output, len, NitroEncoderType::RAW };
+	}
+
+	virtual u64 decoded_size() override
+	{
+		if (!_encoded || _len < raw::sizeof_header || (NitroEncoderType)_encoded[0] != NitroEncoderType::RAW)
+			throw runtime_error("Malformed protocol - invalid raw frame header.");
+		u64 len;
+		memcpy(&len, _encoded + protocol::sizeof_encoder_type, sizeof(u64));
+		if (len != _len - raw::sizeof_header)
+			throw runtime_error("Malformed data - raw frame length does not match the input length.");
+		return len;
+	}
+
+	const u8*	data() const { return _encoded + raw::sizeof_header; }
+
+private:
+	const u8*	_encoded;
+	u64			_len;
+};
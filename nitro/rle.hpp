@@ -0,0 +1,267 @@
+#pragma once
+
+#include "common.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+
+#include <cstring>
+
+/*
+ * Run length pre-pass (RLE)
+ *
+ * Runs of at least min_run equal bytes are cut down to a single byte, the run
+ * lengths go to a side list and the reduced sequence is compressed by a nested
+ * frame (AUTO chosen). Long N runs and homopolymers shrink to a few bytes.
+ *
+ * Layout:
+ *	- encoder type (1 byte)
+ *	- input length (8 bytes)
+ *	- side list length in bytes (8 bytes)
+ *	- side list, LEB128 varints: run count, then for every run the number of
+ *	  reduced bytes before it (since the previous run) and its length - min_run
+ *	- nested frame holding the reduced sequence
+ *
+ * The decoder decodes the reduced sequence into the tail of the output buffer
+ * and expands it forward in place (the write position never passes the read
+ * position), runs are filled with memset.
+ */
+namespace rle
+{
+	const u64	min_run = 16;
+	const u64	sizeof_header = protocol::sizeof_encoder_type + 2 * sizeof(u64);
+
+	// length of the run of in[0] (at most len)
+	inline u64 run_length(const u8* in, u64 len)
+	{
+		const u64 pattern = in[0] * 0x0101010101010101ull;
+		u64 i = 1;
+		for (; i + sizeof(u64) <= len; i += sizeof(u64)) {
+			u64 word;
+			memcpy(&word, in + i, sizeof(word));
+			if (u64 diff = word ^ pattern)
+				return i + __builtin_ctzll(diff) / 8;
+		}
+		while (i < len && in[i] == in[0])
+			i++;
+		return i;
+	}
+
+	// worst case: no runs, the nested AUTO frame of the whole input
+	inline u64 max_encoded_size(u64 nested_bound)
+	{
+		return sizeof_header + varint::max_size + nested_bound;
+	}
+}
+
+class RleEncoder : public Encoder
+{
+public:
+	RleEncoder(const u8* input, uint64_t len, unsigned threads) :
+		_input(input),
+		_len(len),
+		_threads(threads)
+	{
+		_type = NitroEncoderType::RLE;
+	}
+	virtual ~RleEncoder() {}
+
+	virtual NitroData encode() override
+	{
+		if (!_input || !_len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		vector<u8> reduced;
+		vector<u8> runs;
+		u64 run_count = reduce(reduced, runs);
+
+		u8 count[varint::max_size];
+		u64 side_len = (varint::write(count, run_count) - count) + runs.size();
+		u64 header = rle::sizeof_header + side_len;
+		u64 capacity = header + nitro_compress_bound(reduced.size(), NitroEncoderType::AUTO);
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < header)
+				throw runtime_error("Output buffer is too small to hold the encoded result.");
+			capacity = _external_capacity;
+		}
+		else {
+			output = reinterpret_cast<u8*>(malloc(capacity));
+			if (!output)
+				throw runtime_error("Memory allocation failed");
+		}
+		try {
+			output[0] = (u8)NitroEncoderType::RLE;
+			memcpy(output + protocol::sizeof_encoder_type, &_len, sizeof(u64));
+			memcpy(output + protocol::sizeof_encoder_type + sizeof(u64), &side_len, sizeof(u64));
+			u8* p = varint::write(output + rle::sizeof_header, run_count);
+			if (!runs.empty())		// no runs is the common case - data() may be nullptr then
+				memcpy(p, runs.data(), runs.size());
+
+			auto nested = make_encoder(NitroEncoderType::AUTO, reduced.data(), reduced.size(), _threads);
+			nested->set_output(output + header, capacity - header);
+			u64 len = header + nested->encode().len;	// throws
+			if (!_external)
+				output = reinterpret_cast<u8*>(realloc(output, len));	// shrinking - can not fail
+			return NitroData{ output, len, NitroEncoderType::RLE };
+		}
+		catch (...) {
+			if (!_external)
+				free(output);
+			throw;
+		}
+	}
+
+private:
+	// splits the input into the reduced sequence and the run list, returns the run count
+	u64 reduce(vector<u8>& reduced, vector<u8>& runs) const
+	{
+		reduced.reserve(_len);
+		u64 run_count = 0;
+		u64 gap = 0;		// reduced bytes since the previous run
+		u8 varints[2 * varint::max_size];
+		for (u64 i = 0; i < _len;) {
+			u64 n = rle::run_length(_input + i, _len - i);
+			if (n >= rle::min_run) {
+				u8* p = varint::write(varints, gap);
+				p = varint::write(p, n - rle::min_run);
+				runs.insert(runs.end(), varints, p);
+				reduced.push_back(_input[i]);
+				run_count++;
+				gap = 0;
+			}
+			else {
+				reduced.insert(reduced.end(), _input + i, _input + i + n);
+				gap += n;
+			}
+			i += n;
+		}
+		return run_count;
+	}
+
+	const u8*	_input;
+	u64			_len;
+	unsigned	_threads;
+};
+
+
+class RleDecoder : public Decoder
+{
+public:
+	RleDecoder(const u8* encoded, uint64_t len, unsigned threads) :
+		_encoded(encoded),
+		_len(len),
+		_threads(threads)
+	{
+	}
+	virtual ~RleDecoder() {}
+
+	virtual NitroData decode() override
+	{
+		decoded_size();		// throws - reads the metadata
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < _orig_len)
+				throw runtime_error("Output buffer is too small to hold the decoded result");
+		}
+		else {
+			output = reinterpret_cast<u8*>(malloc(_orig_len));
+			if (!output)
+				throw runtime_error("Could not allocate enough space to hold decoded result");
+		}
+		try {
+			expand(output);		// throws
+		}
+		catch (...) {
+			if (!_external)
+				free(output);
+			throw;
+		}
+		return NitroData{ output, _orig_len, NitroEncoderType::RLE };
+	}
+
+	virtual u64 decoded_size() override
+	{
+		if (!_metadata_read) {
+			read_metadata();	// throws
+			_metadata_read = true;
+		}
+		return _orig_len;
+	}
+
+private:
+	void read_metadata()
+	{
+		if (!_encoded || _len < rle::sizeof_header || (NitroEncoderType)_encoded[0] != NitroEncoderType::RLE)
+			throw runtime_error("Malformed protocol - invalid run length frame header.");
+		memcpy(&_orig_len, _encoded + protocol::sizeof_encoder_type, sizeof(u64));
+		u64 side_len;
+		memcpy(&side_len, _encoded + protocol::sizeof_encoder_type + sizeof(u64), sizeof(u64));
+		if (side_len >= _len - rle::sizeof_header)
+			throw runtime_error("Malformed protocol - run length list runs past the end of the input.");
+		_runs = _encoded + rle::sizeof_header;
+		_runs_end = _runs + side_len;
+		if ((NitroEncoderType)*_runs_end == NitroEncoderType::RLE)
+			throw runtime_error("Malformed protocol - nested run length frame.");
+		_nested = make_decoder(_runs_end, _len - rle::sizeof_header - side_len, _threads);
+		if (!_nested)
+			throw runtime_error("Malformed protocol - unknown nested frame type.");
+		_reduced_len = _nested->decoded_size();	// throws
+		if (_reduced_len > _orig_len)
+			throw runtime_error("Malformed data - reduced sequence is longer than the original.");
+		// every run adds its length - 1 bytes to the reduced sequence, the sum has to be the original length
+		const u8* p = _runs;
+		u64 run_count = varint::read(p, _runs_end);	// throws
+		u64 expanded = _reduced_len;
+		for (u64 r = 0; r < run_count; r++) {
+			varint::read(p, _runs_end);		// gap, checked by expand
+			u64 run = varint::read(p, _runs_end);
+			u64 room = _orig_len - expanded;
+			if (room < rle::min_run - 1 || run > room - (rle::min_run - 1))
+				throw runtime_error("Malformed data - run length list does not match the original length.");
+			expanded += run + rle::min_run - 1;
+		}
+		if (expanded != _orig_len)
+			throw runtime_error("Malformed data - run length list does not match the original length.");
+	}
+
+	void expand(u8* output)
+	{
+		u8* reduced = output + _orig_len - _reduced_len;
+		_nested->set_output(reduced, _reduced_len);
+		_nested->decode();	// throws
+
+		const u8* p = _runs;
+		u64 run_count = varint::read(p, _runs_end);
+		u8* out = output;
+		u8* end = output + _orig_len;
+		const u8* in = reduced;
+		for (u64 r = 0; r < run_count; r++) {
+			u64 gap = varint::read(p, _runs_end);
+			u64 run = varint::read(p, _runs_end);
+			// the gap and the run byte have to come from the reduced sequence, the run
+			// has to leave room for the rest of it (which keeps out behind in)
+			u64 left_in = end - in;
+			u64 room = (end - out) - left_in + 1;
+			if (gap >= left_in || run >= room || run + rle::min_run > room)
+				throw runtime_error("Malformed data - run length list does not match the reduced sequence.");
+			memmove(out, in, gap);
+			out += gap;
+			in += gap;
+			u8 sym = *in++;
+			memset(out, sym, run + rle::min_run);
+			out += run + rle::min_run;
+		}
+		if (p != _runs_end || (u64)(end - out) != (u64)(end - in))
+			throw runtime_error("Malformed data - run length list does not match the original length.");
+		memmove(out, in, end - in);
+	}
+
+	const u8*			_encoded;
+	u64					_len;
+	unsigned			_threads;
+	u64					_orig_len{ 0 };
+	u64					_reduced_len{ 0 };
+	const u8*			_runs{ nullptr };
+	const u8*			_runs_end{ nullptr };
+	unique_ptr<Decoder>	_nested;
+	bool				_metadata_read{ false };
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "common.hpp"
+#include "bitpack.hpp"
+#include "rank.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * Pattern search in packed data (nitro_search, see access.hpp)
+ *
+ * Translated through the symbol table a pattern is a sequence of codes of the block
+ * width W, a match starts at any multiple of W bits. A step covers floor(56 / W)
+ * start positions: the word loaded at the bit position of symbol pos + j holds the
+ * candidates' j-th symbols in its fields, compared with code j in all fields at once
+ * (rankselect::matches). Candidates are AND-ed over j, so a step usually ends after
+ * the first two or three symbols of the pattern and the packed bytes are read
+ * instead of the 8 / W times larger decoded data.
+ */
+namespace packedsearch
+{
+	template<unsigned W>
+	struct Step
+	{
+		static const unsigned	symbols = 56 / W;	// a shifted 8 byte load holds at least 57 bits
+		static u64 lows()
+		{
+			u64 low = 0;
+			for (unsigned i = 0; i < symbols; i++)
+				low |= 1ull << (i * W);
+			return low;
+		}
+	};
+
+	// 64 bits from the bit position of symbol index, at least 57 of them valid
+	template<unsigned W>
+	inline u64 load(const u8* data, u64 bytes, u64 index)
+	{
+		u64 bit = index * W;
+		u64 byte = bit / 8;
+		u64 word = 0;
+		if (byte + sizeof(word) <= bytes)
+			memcpy(&word, data + byte, sizeof(word));
+		else if (byte < bytes)
+			memcpy(&word, data + byte, bytes - byte);
+		return word >> (bit % 8);
+	}
+
+	/*
+	 * Calls visit(position) for every start position in [0, count - m] where the m codes
+	 * of the packed data (count symbols) equal codes, in increasing order.
+	 * Returns false if visit stopped the search by returning false.
+	 */
+	template<unsigned W, typename Visit>
+	inline bool find(const u8* data, u64 count, const u8* codes, u64 m, Visit& visit)
+	{
+		typedef Step<W> S;
+		const u64 low = S::lows();
+		const u64 bytes = bitpack::packed_size(W, count);
+		if (!m || m > count)
+			return true;
+		u64 starts = count - m + 1;
+		for (u64 pos = 0; pos < starts; pos += S::symbols) {
+			u64 n = std::min<u64>(S::symbols, starts - pos);
+			u64 candidates = n == S::symbols ? low : low & ((1ull << (n * W)) - 1);
+			for (u64 j = 0; j < m && candidates; j++)
+				candidates &= rankselect::matches<W>(load<W>(data, bytes, pos + j), low * codes[j], low);
+			while (candidates) {
+				if (!visit(pos + __builtin_ctzll(candidates) / W))
+					return false;
+				candidates &= candidates - 1;
+			}
+		}
+		return true;
+	}
+
+	template<typename Visit>
+	inline bool find(unsigned width, const u8* data, u64 count, const u8* codes, u64 m, Visit& visit)
+	{
+		switch (width) {
+		case 1: return find<1>(data, count, codes, m, visit);
+		case 2: return find<2>(data, count, codes, m, visit);
+		case 3: return find<3>(data, count, codes, m, visit);
+		case 4: return find<4>(data, count, codes, m, visit);
+		case 5: return find<5>(data, count, codes, m, visit);
+		case 6: return find<6>(data, count, codes, m, visit);
+		case 7: return find<7>(data, count, codes, m, visit);
+		case 8: return find<8>(data, count, codes, m, visit);
+		default:
+			throw runtime_error("Block width can be max 8 bits.");
+		}
+	}
+
+	/*
+	 * Calls visit(position) for every start position below starts where the bytes of text
+	 * equal the pattern (text holds at least starts + m - 1 bytes). Returns false if stopped.
+	 */
+	template<typename Visit>
+	inline bool find_bytes(const u8* text, u64 starts, const u8* pattern, u64 m, Visit& visit)
+	{
+		const u8* p = text;
+		const u8* end = text + starts;
+		while (p < end && (p = (const u8*)memchr(p, pattern[0], end - p))) {
+			if (!memcmp(p + 1, pattern + 1, m - 1) && !visit((u64)(p - text)))
+				return false;
+			p++;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "common.hpp"
+#include "encoder.hpp"
+#include "histogram.hpp"
+#include "dna.hpp"
+#include "huffman.hpp"
+#include "model.hpp"
+#include "rans.hpp"
+#include "raw.hpp"
+#include "stream.hpp"
+
+#include <cmath>
+
+/*
+ * Encoder selection (AUTO)
+ *
+ * One histogram pass gives the output size of every candidate: exact for BLOCK,
+ * HUFFMAN and RAW, an upper bound for DNA (every exception a run of its own),
+ * the model entropy plus the state flush for RANS (RANGE
+ * codes the same model to the same size but decodes slower, so it is not a candidate).
+ * The smallest one wins, ties go to the faster decoder. The histogram is handed
+ * to the chosen encoder so it does not count again.
+ * Inputs above the default chunk size are written as a STREAM frame and every
+ * segment gets its own choice, so mixed data is handled piece by piece.
+ * The result is never bigger than the RAW frame.
+ */
+namespace autoselect
+{
+	inline u64 table_header(u64 symbols, u64 entry_size)
+	{
+		return protocol::sizeof_encoder_type + protocol::sizeof_table_entry_size + symbols * entry_size + sizeof(u64);
+	}
+
+	inline u64 estimate_block(const u64* counts, u64 len)
+	{
+		unsigned symbols = 0;
+		for (unsigned sym = 0; sym < 256; sym++)
+			symbols += counts[sym] != 0;
+		unsigned bits = 0;
+		while ((1u << bits) < symbols)
+			bits++;
+		return table_header(symbols, 2) + (bits * len + 7) / 8;
+	}
+
+	inline u64 estimate_huffman(const u64* counts)
+	{
+		u8 lengths[256];
+		huffman::build_lengths(counts, lengths);
+		u64 symbols = 0, bits = 0;
+		for (unsigned sym = 0; sym < 256; sym++) {
+			symbols += counts[sym] != 0;
+			bits += counts[sym] * lengths[sym];
+		}
+		return table_header(symbols, huffman::sizeof_entry) + (bits + 7) / 8;
+	}
+
+	/* for inputs up to the default chunk size: gap and length varints take at most 3 bytes */
+	inline u64 estimate_dna(const u64* counts, u64 len)
+	{
+		u64 exceptions = len - counts['A'] - counts['C'] - counts['G'] - counts['T'];
+		return dna::sizeof_header + bitpack::packed_size(2, len) + exceptions * (2 * 3 + 1);
+	}
+
+	inline u64 estimate_rans(const u64* counts)
+	{
+		FrequencyTable model;
+		model.normalize(counts);
+		double bits = 0;
+		for (unsigned sym = 0; sym < 256; sym++) {
+			if (counts[sym])
+				bits += counts[sym] * (FrequencyTable::scale_bits - std::log2((double)model.freq((u8)sym)));
+		}
+		// the final states and the last partially used renormalization words
+		return table_header(model.size(), FrequencyTable::sizeof_entry) + (u64)(bits / 8) +
+			   rans::sizeof_states + rans::lanes * sizeof(u16);
+	}
+
+	/* counts[256] of the len input bytes */
+	inline NitroEncoderType choose(const u64* counts, u64 len)
+	{
+		// candidates in decoding speed order - a later one has to be strictly smaller
+		const std::pair<NitroEncoderType, u64> candidates[] = {
+			{ NitroEncoderType::RAW, raw::max_encoded_size(len) },
+			{ NitroEncoderType::BLOCK, estimate_block(counts, len) },
+			{ NitroEncoderType::DNA, estimate_dna(counts, len) },
+			{ NitroEncoderType::HUFFMAN, estimate_huffman(counts) },
+			{ NitroEncoderType::RANS, estimate_rans(counts) },
+		};
+		auto best = candidates[0];
+		for (const auto& c : candidates) {
+			if (c.second < best.second)
+				best = c;
+		}
+		return best.first;
+	}
+
+	inline u64 max_encoded_size(u64 len)
+	{
+		return stream::max_encoded_size(len, protocol::default_chunk_size);
+	}
+}
+
+class AutoEncoder : public Encoder
+{
+public:
+	AutoEncoder(const u8* input, uint64_t len, unsigned threads) :
+		_input(input),
+		_len(len),
+		_threads(threads)
+	{
+		_type = NitroEncoderType::AUTO;
+	}
+	virtual ~AutoEncoder() {}
+
+	virtual NitroData encode() override
+	{
+		if (!_input || !_len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		if (_len > protocol::default_chunk_size) {
+			StreamEncoder encoder(_input, _len, protocol::default_chunk_size, NitroEncoderType::AUTO);
+			if (_external)
+				encoder.set_output(_external, _external_capacity);
+			return encoder.encode();	// throws
+		}
+
+		u64 counts[256] = { 0 };
+		histogram::count(_input, _len, counts);
+		NitroEncoderType type = autoselect::choose(counts, _len);
+		if (type != NitroEncoderType::RAW) {
+			auto encoder = make_encoder(type, _input, _len, _threads);
+			encoder->set_histogram(counts);
+			if (_external)
+				encoder->set_output(_external, _external_capacity);
+			NitroData data{ nullptr, 0, type };
+			try {
+				data = encoder->encode();
+			}
+			catch (const runtime_error&) {
+				// the estimate was off and the caller's buffer (sized for RAW) is too small
+				if (!_external)
+					throw;
+			}
+			if (data.data && data.len <= raw::max_encoded_size(_len))
+				return data;
+			if (!_external)
+				free(data.data);
+		}
+		RawEncoder encoder(_input, _len);
+		if (_external)
+			encoder.set_output(_external, _external_capacity);
+		return encoder.encode();	// throws
+	}
+
+private:
+	const u8*	_input;
+	u64			_len;
+	unsigned	_threads;
+};
@@ -0,0 +1,435 @@
+#pragma once
+
+#include "common.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * Streaming frame
+ *
+ * Layout:
+ *	- encoder type (STREAM)
+ *	- segment size: max number of input bytes in one segment (8 bytes)
+ *	- segments: encoded length (8 bytes) followed by a complete frame of any
+ *	  non streaming type encoding at most segment size bytes (nitro writes BLOCK
+ *	  frames, or the type chosen per segment in AUTO mode)
+ *	- end marker: encoded length 0
+ *
+ * Every segment carries its own metadata so the alphabet can change along the
+ * stream and neither side ever holds more than one segment in memory.
+ */
+namespace stream
+{
+	const u64	sizeof_stream_header = protocol::sizeof_encoder_type + sizeof(u64);
+	const u64	max_segment_size = 1ull << 30;
+
+	inline u64	resolve_segment_size(u64 segment_size)
+	{
+		if (!segment_size)
+			return protocol::default_chunk_size;
+		if (segment_size > max_segment_size)
+			throw runtime_error("Segment size is too big.");
+		return segment_size;
+	}
+
+	// worst case size of one encoded segment
+	inline u64	max_encoded_segment(u64 segment_size)
+	{
+		return BlockEncoder::max_encoded_size(segment_size);
+	}
+
+	// worst case size of a whole stream frame holding len bytes
+	inline u64	max_encoded_size(u64 len, u64 segment_size)
+	{
+		u64 segments = (len + segment_size - 1) / segment_size;
+		// metadata and checksums of every segment, the symbols themselves add up to len
+		u64 per_segment = sizeof(u64) + max_encoded_segment(0) +
+						  checksum::segment_count(segment_size, protocol::default_chunk_size) * checksum::sizeof_checksum;
+		return sizeof_stream_header + segments * per_segment + len + sizeof(u64);
+	}
+}
+
+/*
+ * Streaming context behind the nitro_stream_* API
+ * Output which did not fit into the caller's buffer stays pending
+ * and is handed out first on the next call.
+ */
+struct NitroStream
+{
+	virtual ~NitroStream() {}
+	virtual NitroStreamStatus update(const u8* input, u64 len, u64& consumed,
+									 u8* output, u64 capacity, u64& written) = 0;
+	virtual NitroStreamStatus finish(u8* output, u64 capacity, u64& written) = 0;
+
+protected:
+	// copies as much pending output as fits, returns true once nothing is pending
+	bool drain(u8* output, u64 capacity, u64& written)
+	{
+		u64 n = std::min(_pending_len - _pending_pos, capacity - written);
+		if (n)
+			memcpy(output + written, _pending.data() + _pending_pos, n);
+		_pending_pos += n;
+		written += n;
+		return _pending_pos == _pending_len;
+	}
+	void set_pending(u64 len)
+	{
+		_pending_len = len;
+		_pending_pos = 0;
+	}
+
+	vector<u8>		_pending;
+	u64				_pending_len{ 0 };
+	u64				_pending_pos{ 0 };
+};
+
+
+class StreamCompressor : public NitroStream
+{
+public:
+	explicit StreamCompressor(u64 segment_size) :
+		_segment_size(stream::resolve_segment_size(segment_size))
+	{
+		_segment.resize(_segment_size);
+		_pending.resize(sizeof(u64) + stream::max_encoded_segment(_segment_size));
+		// the stream header goes out first
+		_pending[0] = (u8)NitroEncoderType::STREAM;
+		memcpy(&_pending[protocol::sizeof_encoder_type], &_segment_size, sizeof(u64));
+		set_pending(stream::sizeof_stream_header);
+	}
+	virtual ~StreamCompressor() {}
+
+	virtual NitroStreamStatus update(const u8* input, u64 len, u64& consumed,
+									 u8* output, u64 capacity, u64& written) override
+	{
+		consumed = 0;
+		written = 0;
+		if (_finished)
+			return NITRO_STREAM_ERROR;
+		while (drain(output, capacity, written)) {
+			if (consumed == len)
+				return NITRO_STREAM_OK;
+			u64 n = std::min(len - consumed, _segment_size - _segment_len);
+			memcpy(&_segment[_segment_len], input + consumed, n);
+			_segment_len += n;
+			consumed += n;
+			if (_segment_len == _segment_size)
+				encode_segment();
+		}
+		return NITRO_STREAM_OUTPUT_FULL;
+	}
+
+	virtual NitroStreamStatus finish(u8* output, u64 capacity, u64& written) override
+	{
+		written = 0;
+		while (drain(output, capacity, written)) {
+			if (_segment_len) {
+				encode_segment();
+			}
+			else if (!_finished) {
+				u64 end_marker = 0;
+				memcpy(_pending.data(), &end_marker, sizeof(end_marker));
+				set_pending(sizeof(end_marker));
+				_finished = true;
+			}
+			else {
+				return NITRO_STREAM_END;
+			}
+		}
+		return NITRO_STREAM_OUTPUT_FULL;
+	}
+
+private:
+	void encode_segment()
+	{
+		BlockEncoder encoder(_segment.data(), _segment_len);
+		encoder.set_output(&_pending[sizeof(u64)], _pending.size() - sizeof(u64));
+		NitroData data = encoder.encode();	// throws
+		memcpy(_pending.data(), &data.len, sizeof(u64));
+		set_pending(sizeof(u64) + data.len);
+		_segment_len = 0;
+	}
+
+	u64					_segment_size;
+	vector<u8>			_segment;
+	u64					_segment_len{ 0 };
+	bool				_finished{ false };
+};
+
+
+class StreamDecompressor : public NitroStream
+{
+public:
+	StreamDecompressor()
+	{
+		_staged.resize(stream::sizeof_stream_header);
+		_need = stream::sizeof_stream_header;
+	}
+	virtual ~StreamDecompressor() {}
+
+	virtual NitroStreamStatus update(const u8* input, u64 len, u64& consumed,
+									 u8* output, u64 capacity, u64& written) override
+	{
+		consumed = 0;
+		written = 0;
+		while (drain(output, capacity, written)) {
+			if (_state == State::DONE)
+				return consumed == len ? NITRO_STREAM_OK : NITRO_STREAM_ERROR;	// trailing garbage
+			if (consumed == len)
+				return NITRO_STREAM_OK;
+			u64 n = std::min(len - consumed, _need - _staged_len);
+			memcpy(&_staged[_staged_len], input + consumed, n);
+			_staged_len += n;
+			consumed += n;
+			if (_staged_len == _need)
+				advance();	// throws
+		}
+		return NITRO_STREAM_OUTPUT_FULL;
+	}
+
+	virtual NitroStreamStatus finish(u8* output, u64 capacity, u64& written) override
+	{
+		written = 0;
+		if (!drain(output, capacity, written))
+			return NITRO_STREAM_OUTPUT_FULL;
+		if (_state != State::DONE)
+			throw runtime_error("Truncated stream - end marker is missing.");
+		return NITRO_STREAM_END;
+	}
+
+private:
+	enum class State
+	{
+		HEADER,
+		LENGTH,
+		SEGMENT,
+		DONE
+	};
+
+	// the staged bytes of the current state are complete
+	void advance()
+	{
+		switch (_state) {
+		case State::HEADER:
+			if ((NitroEncoderType)_staged[0] != NitroEncoderType::STREAM)
+				throw runtime_error("Input is not a nitro stream.");
+			memcpy(&_segment_size, &_staged[protocol::sizeof_encoder_type], sizeof(u64));
+			if (!_segment_size || _segment_size > stream::max_segment_size)
+				throw runtime_error("Malformed stream - invalid segment size.");
+			_staged.resize(stream::max_encoded_segment(_segment_size));
+			_pending.resize(_segment_size);
+			expect(State::LENGTH, sizeof(u64));
+			break;
+		case State::LENGTH:
+		{
+			u64 encoded_len;
+			memcpy(&encoded_len, _staged.data(), sizeof(u64));
+			if (!encoded_len)
+				expect(State::DONE, 0);
+			else if (encoded_len > _staged.size())
+				throw runtime_error("Malformed stream - segment is bigger than the segment size allows.");
+			else
+				expect(State::SEGMENT, encoded_len);
+			break;
+		}
+		case State::SEGMENT:
+		{
+			if ((NitroEncoderType)_staged[0] == NitroEncoderType::STREAM)
+				throw runtime_error("Malformed stream - nested stream segment.");
+			auto decoder = make_decoder(_staged.data(), _need, 1);
+			if (!decoder)
+				throw runtime_error("Malformed stream - unknown segment type.");
+			decoder->set_output(_pending.data(), _segment_size);
+			NitroData data = decoder->decode();	// throws
+			set_pending(data.len);
+			expect(State::LENGTH, sizeof(u64));
+			break;
+		}
+		case State::DONE:
+			break;
+		}
+	}
+	void expect(State state, u64 bytes)
+	{
+		_state = state;
+		_need = bytes;
+		_staged_len = 0;
+	}
+
+	State			_state{ State::HEADER };
+	u64				_segment_size{ 0 };
+	vector<u8>		_staged;			// bytes of the header/length/segment being collected
+	u64				_staged_len{ 0 };
+	u64				_need{ 0 };
+};
+
+
+/*
+ * Encodes a complete in memory buffer as a stream frame (nitro_compress)
+ */
+class StreamEncoder : public Encoder
+{
+public:
+	StreamEncoder(const u8* input, uint64_t len, u64 segment_size = 0,
+				  NitroEncoderType segment_type = NitroEncoderType::BLOCK) :
+		_input(input),
+		_len(len),
+		_segment_size(stream::resolve_segment_size(segment_size)),
+		_segment_type(segment_type)
+	{
+		_type = NitroEncoderType::STREAM;
+	}
+	virtual ~StreamEncoder() {}
+
+	virtual NitroData encode() override
+	{
+		if (!_input || !_len)
+			throw runtime_error("invalid input (input nullptr or 0 length)");
+		u64 capacity = stream::max_encoded_size(_len, _segment_size);
+		u8* output = _external;
+		if (output) {
+			capacity = _external_capacity;
+		}
+		else {
+			output = reinterpret_cast<u8*>(malloc(capacity));
+			if (!output)
+				throw runtime_error("Memory allocation failed");
+		}
+		try {
+			u64 pos = write_header(output, capacity);
+			for (u64 offset = 0; offset < _len; offset += _segment_size) {
+				u64 segment = std::min(_segment_size, _len - offset);
+				if (capacity - pos < sizeof(u64))
+					throw runtime_error("Output buffer is too small to hold the encoded result.");
+				auto encoder = make_encoder(_segment_type, _input + offset, segment, 1);
+				encoder->set_output(output + pos + sizeof(u64), capacity - pos - sizeof(u64));
+				u64 encoded_len = encoder->encode().len;	// throws
+				memcpy(output + pos, &encoded_len, sizeof(u64));
+				pos += sizeof(u64) + encoded_len;
+			}
+			if (capacity - pos < sizeof(u64))
+				throw runtime_error("Output buffer is too small to hold the encoded result.");
+			memset(output + pos, 0, sizeof(u64));	// end marker
+			pos += sizeof(u64);
+			if (!_external)
+				output = reinterpret_cast<u8*>(realloc(output, pos));	// shrinking - can not fail
+			return NitroData{ output, pos, NitroEncoderType::STREAM };
+		}
+		catch (...) {
+			if (!_external)
+				free(output);
+			throw;
+		}
+	}
+
+private:
+	u64 write_header(u8* output, u64 capacity) const
+	{
+		if (capacity < stream::sizeof_stream_header)
+			throw runtime_error("Output buffer is too small to hold the encoded result.");
+		output[0] = (u8)NitroEncoderType::STREAM;
+		memcpy(output + protocol::sizeof_encoder_type, &_segment_size, sizeof(u64));
+		return stream::sizeof_stream_header;
+	}
+
+	const u8*			_input;
+	u64					_len;
+	u64					_segment_size;
+	NitroEncoderType	_segment_type;
+};
+
+
+/*
+ * Decodes a complete in memory stream frame (nitro_decompress)
+ */
+class StreamDecoder : public Decoder
+{
+public:
+	StreamDecoder(const u8* encoded, uint64_t len) :
+		_encoded(encoded),
+		_len(len)
+	{
+	}
+	virtual ~StreamDecoder() {}
+
+	// (offset, encoded length) of every segment - valid after decoded_size
+	const vector<std::pair<u64, u64>>&	segments() const { return _segments; }
+
+	virtual NitroData decode() override
+	{
+		u64 total = decoded_size();	// throws - validates the segment layout
+		u8* output = _external;
+		if (output) {
+			if (_external_capacity < total)
+				throw runtime_error("Output buffer is too small to hold the decoded result");
+		}
+		else {
+			output = reinterpret_cast<u8*>(malloc(total ? total : 1));
+			if (!output)
+				throw runtime_error("Could not allocate enough space to hold decoded result");
+		}
+		try {
+			u64 written = 0;
+			for (const auto& segment : _segments) {
+				auto decoder = make_decoder(_encoded + segment.first, segment.second, 1);
+				decoder->set_output(output + written, total - written);
+				written += decoder->decode().len;
+			}
+		}
+		catch (...) {
+			if (!_external)
+				free(output);
+			throw;
+		}
+		return NitroData{ output, total, NitroEncoderType::STREAM };
+	}
+
+	virtual u64 decoded_size() override
+	{
+		if (_parsed)
+			return _total;
+		if (_len < stream::sizeof_stream_header || (NitroEncoderType)_encoded[0] != NitroEncoderType::STREAM)
+			throw runtime_error("Malformed stream - invalid header.");
+		u64 segment_size;
+		memcpy(&segment_size, _encoded + protocol::sizeof_encoder_type, sizeof(u64));
+		if (!segment_size || segment_size > stream::max_segment_size)
+			throw runtime_error("Malformed stream - invalid segment size.");
+		u64 pos = stream::sizeof_stream_header;
+		while (true) {
+			if (_len - pos < sizeof(u64))
+				throw runtime_error("Truncated stream - end marker is missing.");
+			u64 encoded_len;
+			memcpy(&encoded_len, _encoded + pos, sizeof(u64));
+			pos += sizeof(u64);
+			if (!encoded_len)
+				break;
+			if (encoded_len > _len - pos)
+				throw runtime_error("Malformed stream - segment runs past the end of the input.");
+			if ((NitroEncoderType)_encoded[pos] == NitroEncoderType::STREAM)
+				throw runtime_error("Malformed stream - nested stream segment.");
+			auto decoder = make_decoder(_encoded + pos, encoded_len, 1);
+			if (!decoder)
+				throw runtime_error("Malformed stream - unknown segment type.");
+			u64 size = decoder->decoded_size();	// throws
+			if (size > segment_size)
+				throw runtime_error("Malformed stream - segment is bigger than the segment size allows.");
+			_total += size;
+			_segments.emplace_back(pos, encoded_len);
+			pos += encoded_len;
+		}
+		if (pos != _len)
+			throw runtime_error("Malformed stream - trailing bytes after the end marker.");
+		_parsed = true;
+		return _total;
+	}
+
+private:
+	const u8*					_encoded;
+	u64							_len;
+	vector<std::pair<u64, u64>>	_segments;		// (offset, encoded length)
+	u64							_total{ 0 };
+	bool						_parsed{ false };
+};
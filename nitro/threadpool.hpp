@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+ * Minimal worker pool for data parallel work
+ *
+ * parallel_for runs task(i) for every i in [0, count). The workers (and the calling
+ * thread, which acts as one of them) pull the next index from a shared counter
+ * so uneven task costs balance out. The call blocks until every task finished.
+ * The first exception thrown by a task is rethrown in the calling thread.
+ */
+class ThreadPool
+{
+public:
+	/* threads == 0 means one worker per hardware thread */
+	explicit ThreadPool(unsigned threads)
+	{
+		if (threads == 0)
+			threads = std::thread::hardware_concurrency();
+		_threads = threads ? threads : 1;
+	}
+
+	unsigned size() const { return _threads; }
+
+	void parallel_for(u64 count, const std::function<void(u64)>& task)
+	{
+		if (!count)
+			return;
+		unsigned workers = (unsigned)std::min<u64>(_threads, count);
+		if (workers == 1) {
+			for (u64 i = 0; i < count; i++)
+				task(i);
+			return;
+		}
+
+		std::atomic<u64>	next{ 0 };
+		std::exception_ptr	error{ nullptr };
+		std::mutex			error_lock;
+		auto worker = [&]() {
+			for (u64 i = next++; i < count; i = next++) {
+				try {
+					task(i);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> guard(error_lock);
+					if (!error)
+						error = std::current_exception();
+					next = count;	// stop handing out work
+				}
+			}
+		};
+
+		vector<std::thread> pool;
+		pool.reserve(workers - 1);
+		for (unsigned t = 1; t < workers; t++)
+			pool.emplace_back(worker);
+		worker();
+		for (auto& th : pool)
+			th.join();
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+private:
+	unsigned	_threads{ 1 };
+};
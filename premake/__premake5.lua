@@ -34,3 +34,19 @@ project "test_nitro"
    filter "configurations:Release"
       defines { "NDEBUG" }
       optimize "On"
+
+project "benchNitro"
+   kind "ConsoleApp"
+   language "C++"
+   targetdir "bin/%{cfg.buildcfg}"
+   includedirs { "nitro/include" }
+   links { "nitro", "benchmark", "pthread" }
+   files { "bench/*.cpp" }
+
+   filter "configurations:Debug"
+      defines { "DEBUG" }
+      symbols "On"
+
+   filter "configurations:Release"
+      defines { "NDEBUG" }
+      optimize "On"
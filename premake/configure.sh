@@ -1,5 +1,6 @@
 rm Makefile
 rm test_nitro.make
 rm nitro.make
+rm benchNitro.make
 
 premake5 gmake
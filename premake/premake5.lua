@@ -10,6 +10,7 @@ project "nitro"
    targetdir "bin/%{cfg.buildcfg}"
    includedirs { "nitro", "nitro/include" }
    files { "nitro/*.h", "nitro/*.cpp" }
+   links { "pthread" }
 
    filter "configurations:Debug"
       defines { "DEBUG" }
@@ -19,3 +20,18 @@ project "nitro"
       defines { "NDEBUG" }
       optimize "On"
 
+project "benchNitro"
+   kind "ConsoleApp"
+   language "C++"
+   targetdir "bin/%{cfg.buildcfg}"
+   includedirs { "nitro/include" }
+   links { "nitro", "benchmark", "pthread" }
+   files { "bench/*.cpp" }
+
+   filter "configurations:Debug"
+      defines { "DEBUG" }
+      symbols "On"
+
+   filter "configurations:Release"
+      defines { "NDEBUG" }
+      optimize "On"
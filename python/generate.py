@@ -6,18 +6,45 @@ import os
 
 def generate(alphabet , size, output_file_name):
     def do_generate(outfile):
-        for _ in xrange(size):
-            c = random.choice(alphabet)
-            outfile.write(c)
+        written = 0
+        while written < size:
+            n = min(1 << 20, size - written)
+            outfile.write(''.join(random.choices(alphabet, k=n)))
+            written += n
 
     with open(output_file_name, 'w') as outfile:
-        do_generate(outfile)    
+        do_generate(outfile)
+
+
+def generate_genome(size, output_file_name):
+    """ACGT with homopolymers, scattered IUPAC codes and long N gaps"""
+    def do_generate(outfile):
+        written = 0
+        while written < size:
+            r = random.random()
+            if r < 0.0001:
+                piece = 'N' * random.randint(1000, 50000)
+            elif r < 0.001:
+                piece = random.choice('RYKMSWBDHV')
+            elif r < 0.05:
+                piece = random.choice('ACGT') * random.randint(4, 30)
+            else:
+                piece = ''.join(random.choices('ACGT', k=random.randint(1, 200)))
+            piece = piece[:size - written]
+            outfile.write(piece)
+            written += len(piece)
+
+    with open(output_file_name, 'w') as outfile:
+        do_generate(outfile)
 
 
 alphabet = ['a', 'b','c','d']
 
 if __name__ == "__main__":
+    # generate.py COUNT OUTFILE [--genome]
     count = int(sys.argv[1])
     outfile = os.path.expanduser(sys.argv[2])
-    generate(alphabet, count, outfile)
-    
\ No newline at end of file
+    if len(sys.argv) > 3 and sys.argv[3] == '--genome':
+        generate_genome(count, outfile)
+    else:
+        generate(alphabet, count, outfile)
@@ -0,0 +1,2 @@
+# ./run_bench.sh [benchmark flags] [CORPUS_FILE...] - results in bench_results.json
+LD_LIBRARY_PATH=./lib ./bin/benchNitro --benchmark_out=bench_results.json --benchmark_out_format=json "$@"
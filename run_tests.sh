@@ -1 +1 @@
-LD_LIBRARY_PATH=./lib ./bin/testNitro
+LD_LIBRARY_PATH=./lib ./bin/testNitro && ./tests/testApp.sh
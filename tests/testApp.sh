@@ -0,0 +1,33 @@
+#!/bin/bash
+# nitro app round trips through the mapped input and output files (run from the repository root)
+NITRO="./bin/nitro"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+export LD_LIBRARY_PATH=./lib
+
+fail() {
+	echo "[  FAILED  ] app: $1"
+	exit 1
+}
+
+head -c 3000000 /dev/urandom | tr -dc 'ACGTN' > "$WORK/input"
+head -c 1000000 /dev/urandom >> "$WORK/input"
+
+for method in -b -p -a -h -o -z; do
+	$NITRO -c "$WORK/input" "$WORK/encoded" $method > /dev/null || fail "compress $method"
+	$NITRO -x "$WORK/encoded" "$WORK/decoded" > /dev/null || fail "decompress $method"
+	cmp -s "$WORK/input" "$WORK/decoded" || fail "round trip $method"
+	rm -f "$WORK/encoded" "$WORK/decoded"
+done
+
+# a failed run leaves no output file behind
+$NITRO -c "$WORK/input" "$WORK/encoded" -a > /dev/null || fail "compress"
+size=$(wc -c < "$WORK/encoded")
+printf '\377\377\377\377' | dd of="$WORK/encoded" bs=1 seek=$((size - 4)) conv=notrunc 2> /dev/null
+$NITRO -x "$WORK/encoded" "$WORK/decoded" > /dev/null 2>&1
+[ -e "$WORK/decoded" ] && fail "corrupted input left an output file"
+: > "$WORK/empty"
+$NITRO -c "$WORK/empty" "$WORK/encoded_empty" -b > /dev/null 2>&1
+[ -e "$WORK/encoded_empty" ] && fail "empty input left an output file"
+
+echo "[  PASSED  ] app round trips"
@@ -1,6 +1,15 @@
 
 #include <gtest/gtest.h>
 #include "helper.hpp"
+#include "../nitro/bitpack.hpp"
+#include "../nitro/checksum.hpp"
+#include "../nitro/dictionary.hpp"
+#include "../nitro/dna.hpp"
+#include "../nitro/histogram.hpp"
+#include "../nitro/huffman.hpp"
+#include "../nitro/lz.hpp"
+#include "../nitro/model.hpp"
+#include "../nitro/rle.hpp"
 
 /*
  * Test!:
@@ -64,6 +73,28 @@ TEST(NitroEncode, compressionRatio)
 	}
 }
 
+TEST(NitroEncode, packedLayout)
+{
+	// codes are assigned in increasing symbol order (A=0, B=1) and packed LSB first
+	const char* text = "ABBBAAABB";
+	u64 len = strlen(text);
+	auto enc = nitro_compress((const u8*)text, len, NitroEncoderType::BLOCK);
+	ASSERT_EQ(enc.len, 1 + 2 + 4 + 8 + 2);
+	ASSERT_EQ(enc.data[enc.len - 2], 0x8E);
+	ASSERT_EQ(enc.data[enc.len - 1], 0x01);
+	free(enc.data);
+}
+
+TEST(NitroEncode, symbolTableOrder)
+{
+	// codes follow the symbol order, entries are written as (code, symbol) pairs
+	const char* text = "CAB";
+	auto enc = nitro_compress((const u8*)text, 3, NitroEncoderType::BLOCK);
+	const u8 expected[] = { 0, 'A', 1, 'B', 2, 'C' };
+	ASSERT_EQ(enc.data[1], 3);
+	ASSERT_EQ(memcmp(enc.data + 3, expected, sizeof(expected)), 0);
+	free(enc.data);
+}
 
 TEST(NitroEncode, inputLenEqualsOne)
 {
@@ -99,6 +130,984 @@ TEST(NitroEncode, inputLenEqualZero)
 	ASSERT_EQ(enc.len, 0);
 }
 
+TEST(NitroEncode, histogramCounts)
+{
+	// DNA like text with a symbol outside the sampled alphabet appearing late,
+	// the small alphabet path has to hand over to the scalar one
+	u64 len = 300000;
+	vector<u8> text(len);
+	for (auto& c : text)
+		c = "ACGT"[rand() % 4];
+	text[len / 2] = 'N';
+	text[len - 1] = 0;
+	for (u64 n : { (u64)0, (u64)5, (u64)4096, (u64)5000, len / 2, len }) {
+		u64 expected[256] = { 0 };
+		for (u64 i = 0; i < n; i++)
+			expected[text[i]]++;
+		u64 counts[256] = { 0 };
+		histogram::count(text.data(), n, counts);
+		ASSERT_EQ(memcmp(counts, expected, sizeof(counts)), 0);
+		bool seen[256];
+		unsigned distinct = histogram::present(text.data(), n, seen);
+		unsigned expected_distinct = 0;
+		for (unsigned sym = 0; sym < 256; sym++) {
+			ASSERT_EQ(seen[sym], expected[sym] != 0);
+			expected_distinct += expected[sym] != 0;
+		}
+		ASSERT_EQ(distinct, expected_distinct);
+	}
+}
+
+TEST(NitroDecode, unpackKernelsMatchScalar)
+{
+	using namespace bitpack;
+	u8 codes[256], table[256];
+	for (int i = 0; i < 256; i++) {
+		codes[i] = (u8)i;
+		table[i] = (u8)(255 - i);
+	}
+	for (unsigned width = 0; width <= 8; width++) {
+		for (u64 len : { 1, 7, 16, 31, 33, 64, 100, 1000, 4099 }) {
+			vector<u8> text(len);
+			for (auto& c : text)
+				c = (u8)(rand() % (1 << width));
+			vector<u8> packed(packed_size(width, len));
+			pack_block(width, text.data(), len, codes, packed.data());
+			vector<u8> scalar(len);
+			unpack_block(width, packed.data(), len, table, scalar.data(), SimdLevel::SCALAR);
+			for (u64 i = 0; i < len; i++)
+				ASSERT_EQ(scalar[i], table[text[i]]);
+			for (auto level : { SimdLevel::SSSE3, SimdLevel::AVX2 }) {
+				if (level > detect_simd())
+					continue;
+				vector<u8> simd(len);
+				unpack_block(width, packed.data(), len, table, simd.data(), level);
+				ASSERT_EQ(memcmp(scalar.data(), simd.data(), len), 0);
+			}
+		}
+	}
+}
+TEST(NitroChunked, roundTripAcrossChunkBoundaries)
+{
+	// default chunk is 1 MiB symbols - cover a partial, an exact and a multi chunk input
+	const u64 chunk = 1 << 20;
+	for (u64 len : { (u64)1000, chunk, 3 * chunk + 12345 }) {
+		auto alphabet = generate_big_alphabet(5);
+		auto text = get_some_input(alphabet, len);
+		auto enc = nitro_compress_mt(text.get(), len, NitroEncoderType::BLOCK_CHUNKED, 4);
+		ASSERT_NE(enc.data, nullptr);
+		ASSERT_EQ(enc.enctype, NitroEncoderType::BLOCK_CHUNKED);
+		for (unsigned threads : { 1, 3 }) {
+			auto dec = nitro_decompress_mt(enc.data, enc.len, threads);
+			ASSERT_EQ(dec.len, len);
+			ASSERT_EQ(memcmp(dec.data, text.get(), len), 0);
+			free(dec.data);
+		}
+		free(enc.data);
+	}
+}
+
+TEST(NitroChunked, outputIndependentOfThreadCount)
+{
+	u64 len = 5 * (1 << 20) + 7;
+	auto text = get_some_input(generate_big_alphabet(19), len);
+	auto one = nitro_compress_mt(text.get(), len, NitroEncoderType::BLOCK_CHUNKED, 1);
+	auto many = nitro_compress_mt(text.get(), len, NitroEncoderType::BLOCK_CHUNKED, 8);
+	ASSERT_EQ(one.len, many.len);
+	ASSERT_EQ(memcmp(one.data, many.data, one.len), 0);
+	free(one.data);
+	free(many.data);
+}
+
+TEST(NitroChunked, malformedChunkTable)
+{
+	u64 len = 3000;
+	auto text = get_some_input({ 'A', 'C', 'G', 'T' }, len);
+	auto enc = nitro_compress(text.get(), len, NitroEncoderType::BLOCK_CHUNKED);
+	// header: type, entry count, 4 entries, length, chunk size, chunk count, one offset
+	u64 offset_pos = 1 + 2 + 4 * 2 + 8 + 8 + 4;
+	enc.data[offset_pos] = 0xFF;
+	auto dec = nitro_decompress(enc.data, enc.len);
+	ASSERT_EQ(dec.data, nullptr);
+	free(enc.data);
+}
+// pushes data through a stream in pieces of random size with a small output buffer
+vector<u8> pump_stream(NitroStream* stream, const u8* data, u64 len, u64 out_capacity)
+{
+	vector<u8> result;
+	vector<u8> out(out_capacity);
+	u64 consumed, written;
+	u64 pos = 0;
+	while (pos < len) {
+		u64 piece = min<u64>(len - pos, 1 + rand() % 5000);
+		NitroStreamStatus status;
+		do {
+			status = nitro_stream_update(stream, data + pos, piece, &consumed, out.data(), out.size(), &written);
+			EXPECT_NE(status, NITRO_STREAM_ERROR);
+			if (status == NITRO_STREAM_ERROR)
+				return result;
+			result.insert(result.end(), out.begin(), out.begin() + written);
+			pos += consumed;
+			piece -= consumed;
+		} while (status == NITRO_STREAM_OUTPUT_FULL);
+	}
+	NitroStreamStatus status;
+	do {
+		status = nitro_stream_finish(stream, out.data(), out.size(), &written);
+		EXPECT_NE(status, NITRO_STREAM_ERROR);
+		if (status == NITRO_STREAM_ERROR)
+			return result;
+		result.insert(result.end(), out.begin(), out.begin() + written);
+	} while (status != NITRO_STREAM_END);
+	return result;
+}
+
+TEST(NitroStream, roundTripSmallBuffers)
+{
+	u64 len = 100000;
+	auto text = get_some_input(generate_big_alphabet(7), len);
+	for (u64 out_capacity : { 1, 13, 4096 }) {
+		NitroStream* compressor = nitro_stream_init(NITRO_STREAM_COMPRESS, 1000);
+		ASSERT_NE(compressor, nullptr);
+		auto encoded = pump_stream(compressor, text.get(), len, out_capacity);
+		nitro_stream_free(compressor);
+
+		NitroStream* decompressor = nitro_stream_init(NITRO_STREAM_DECOMPRESS, 0);
+		auto decoded = pump_stream(decompressor, encoded.data(), encoded.size(), out_capacity);
+		nitro_stream_free(decompressor);
+		ASSERT_EQ(decoded.size(), len);
+		ASSERT_EQ(memcmp(decoded.data(), text.get(), len), 0);
+
+		// whole stream frames decode in memory as well
+		auto dec = nitro_decompress(encoded.data(), encoded.size());
+		ASSERT_EQ(dec.len, len);
+		ASSERT_EQ(memcmp(dec.data, text.get(), len), 0);
+		free(dec.data);
+	}
+}
+
+TEST(NitroStream, inMemoryMatchesStreaming)
+{
+	u64 len = 3 * (1 << 20) + 99;
+	auto text = get_some_input(generate_big_alphabet(4), len);
+	NitroStream* compressor = nitro_stream_init(NITRO_STREAM_COMPRESS, 0);
+	auto streamed = pump_stream(compressor, text.get(), len, 1 << 16);
+	nitro_stream_free(compressor);
+	auto enc = nitro_compress(text.get(), len, NitroEncoderType::STREAM);
+	ASSERT_EQ(enc.enctype, NitroEncoderType::STREAM);
+	ASSERT_EQ(enc.len, streamed.size());
+	ASSERT_EQ(memcmp(enc.data, streamed.data(), enc.len), 0);
+	free(enc.data);
+}
+
+TEST(NitroStream, truncatedInput)
+{
+	u64 len = 5000;
+	auto text = get_some_input({ 'A', 'C', 'G', 'T' }, len);
+	auto enc = nitro_compress(text.get(), len, NitroEncoderType::STREAM);
+	auto dec = nitro_decompress(enc.data, enc.len - 1);
+	ASSERT_EQ(dec.data, nullptr);
+
+	NitroStream* decompressor = nitro_stream_init(NITRO_STREAM_DECOMPRESS, 0);
+	vector<u8> out(2 * len);
+	u64 consumed, written;
+	ASSERT_EQ(nitro_stream_update(decompressor, enc.data, enc.len - 1, &consumed, out.data(), out.size(), &written),
+			  NITRO_STREAM_OK);
+	ASSERT_EQ(nitro_stream_finish(decompressor, out.data(), out.size(), &written), NITRO_STREAM_ERROR);
+	nitro_stream_free(decompressor);
+	free(enc.data);
+
+	// missing stream or out parameters are errors, not crashes
+	NitroStream* compressor = nitro_stream_init(NITRO_STREAM_COMPRESS, 0);
+	ASSERT_EQ(nitro_stream_update(nullptr, text.get(), len, &consumed, out.data(), out.size(), &written), NITRO_STREAM_ERROR);
+	ASSERT_EQ(nitro_stream_update(compressor, text.get(), len, nullptr, out.data(), out.size(), &written), NITRO_STREAM_ERROR);
+	ASSERT_EQ(nitro_stream_update(compressor, text.get(), len, &consumed, out.data(), out.size(), nullptr), NITRO_STREAM_ERROR);
+	ASSERT_EQ(nitro_stream_finish(nullptr, out.data(), out.size(), &written), NITRO_STREAM_ERROR);
+	ASSERT_EQ(nitro_stream_finish(compressor, out.data(), out.size(), nullptr), NITRO_STREAM_ERROR);
+	nitro_stream_free(compressor);
+}
+TEST(NitroAccess, symbolsAndRanges)
+{
+	u64 len = 2 * (1 << 20) + 333;
+	for (u16 symcount : { 1, 2, 5, 16, 100, 256 }) {
+		auto text = get_some_input(generate_big_alphabet(symcount), len);
+		for (auto type : { NitroEncoderType::BLOCK, NitroEncoderType::BLOCK_CHUNKED, NitroEncoderType::STREAM }) {
+			auto enc = nitro_compress(text.get(), len, type);
+			NitroHandle* handle = nitro_open(enc.data, enc.len);
+			ASSERT_NE(handle, nullptr);
+			ASSERT_EQ(nitro_handle_length(handle), len);
+			for (int i = 0; i < 1000; i++) {
+				u64 index = rand() % len;
+				ASSERT_EQ(nitro_handle_get_symbol(handle, index), text.get()[index]);
+			}
+			ASSERT_EQ(nitro_handle_get_symbol(handle, len), -1);
+			vector<u8> window(5000);
+			for (int i = 0; i < 50; i++) {
+				u64 count = rand() % window.size();
+				u64 offset = rand() % (len - count);
+				if (i == 0)
+					offset = (1 << 20) - 17;		// spans a chunk/segment boundary
+				ASSERT_EQ(nitro_handle_get_range(handle, offset, count, window.data()), count);
+				ASSERT_EQ(memcmp(window.data(), text.get() + offset, count), 0);
+			}
+			ASSERT_EQ(nitro_handle_get_range(handle, len - 10, 11, window.data()), 0);
+			nitro_close(handle);
+			ASSERT_EQ(nitro_get_symbol(enc.data, enc.len, len - 1), text.get()[len - 1]);
+			free(enc.data);
+		}
+	}
+}
+
+TEST(NitroAccess, rankAndSelect)
+{
+	u64 len = (1 << 20) + 12345;
+	for (u16 symcount : { 1, 2, 5, 16, 256 }) {
+		auto text = get_some_input(generate_big_alphabet(symcount), len);
+		if (symcount == 5) {
+			// DNA with N runs: bases packed, N in the exception list
+			for (u64 i = 0; i < len; i++)
+				text.get()[i] = "ACGT"[rand() % 4];
+			for (u64 i = 1000; i < len; i += 77777)
+				memset(text.get() + i, 'N', 1 + i % 300);
+		}
+		for (auto type : { NitroEncoderType::BLOCK, NitroEncoderType::STREAM, NitroEncoderType::DNA }) {
+			if (type == NitroEncoderType::DNA && symcount != 5)
+				continue;
+			auto enc = nitro_compress(text.get(), len, type);
+			NitroHandle* handle = nitro_open(enc.data, enc.len);
+			ASSERT_NE(handle, nullptr);
+			for (int indexed = 0; indexed < 2; indexed++) {
+				if (indexed) {
+					ASSERT_EQ(nitro_handle_build_index(handle), 1);
+				}
+				for (u8 sym : { text.get()[0], text.get()[len / 2], (u8)'N', (u8)'#' }) {
+					vector<u64> positions;
+					for (u64 i = 0; i < len; i++) {
+						if (text.get()[i] == sym)
+							positions.push_back(i);
+					}
+					for (int i = 0; i < 100; i++) {
+						u64 pos = i == 0 ? len : rand() % len;
+						u64 expected = std::lower_bound(positions.begin(), positions.end(), pos) - positions.begin();
+						ASSERT_EQ(nitro_rank(handle, sym, pos), expected);
+						if (positions.empty())
+							continue;
+						u64 k = i == 0 ? positions.size() - 1 : rand() % positions.size();
+						ASSERT_EQ(nitro_select(handle, sym, k), (int64_t)positions[k]);
+					}
+					ASSERT_EQ(nitro_select(handle, sym, positions.size()), -1);
+				}
+			}
+			ASSERT_EQ(nitro_rank(handle, 'A', len + 1), UINT64_MAX);
+			nitro_close(handle);
+			free(enc.data);
+		}
+	}
+}
+
+static int collect_match(uint64_t position, void* user)
+{
+	auto matches = static_cast<vector<u64>*>(user);
+	matches->push_back(position);
+	return 1;
+}
+
+TEST(NitroAccess, searchPackedCodes)
+{
+	u64 len = (1 << 20) + 4321;
+	for (u16 symcount : { 1, 2, 4, 5, 16, 256 }) {
+		auto text = get_some_input(generate_big_alphabet(symcount), len);
+		if (symcount == 4) {
+			// DNA with N runs
+			for (u64 i = 0; i < len; i++)
+				text.get()[i] = "ACGT"[rand() % 4];
+			for (u64 i = 1000; i < len; i += 77777)
+				memset(text.get() + i, 'N', 1 + i % 300);
+		}
+		// planted matches: the start, across the 1 MiB chunk/segment boundary, the end
+		vector<u8> pattern(text.get() + 5000, text.get() + 5000 + 9);
+		for (u64 at : { (u64)0, (u64)(1 << 20) - 4, len - pattern.size() })
+			memcpy(text.get() + at, pattern.data(), pattern.size());
+		vector<vector<u8>> patterns = { pattern, { pattern.begin(), pattern.begin() + 2 }, { text.get()[7] } };
+		if (symcount == 4)
+			patterns.push_back({ 'A', 'N', 'N' });
+		for (auto type : { NitroEncoderType::BLOCK, NitroEncoderType::BLOCK_CHUNKED, NitroEncoderType::STREAM,
+						   NitroEncoderType::DNA, NitroEncoderType::HUFFMAN }) {
+			if (type == NitroEncoderType::DNA && symcount != 4)
+				continue;
+			auto enc = nitro_compress(text.get(), len, type);
+			for (const auto& p : patterns) {
+				vector<u64> expected, found;
+				for (u64 i = 0; i + p.size() <= len; i++) {
+					if (!memcmp(text.get() + i, p.data(), p.size()))
+						expected.push_back(i);
+				}
+				int64_t reported = nitro_search(enc.data, enc.len, p.data(), p.size(), collect_match, &found);
+				ASSERT_EQ(reported, (int64_t)found.size());
+				ASSERT_EQ(found, expected);
+			}
+			free(enc.data);
+		}
+	}
+	// the callback stops the search, no pattern is an error
+	vector<u8> text(1000, 'A');
+	auto enc = nitro_compress(text.data(), text.size(), NitroEncoderType::BLOCK);
+	auto stop = [](uint64_t, void*) { return 0; };
+	ASSERT_EQ(nitro_search(enc.data, enc.len, text.data(), 10, stop, nullptr), 1);
+	ASSERT_EQ(nitro_search(enc.data, enc.len, text.data(), 0, stop, nullptr), -1);
+	free(enc.data);
+}
+
+TEST(NitroAccess, malformedInput)
+{
+	u8 garbage[] = { 0xDE, 0xAD };
+	ASSERT_EQ(nitro_open(garbage, sizeof(garbage)), nullptr);
+	ASSERT_EQ(nitro_open(nullptr, 10), nullptr);
+	ASSERT_EQ(nitro_get_symbol(garbage, sizeof(garbage), 0), -1);
+
+	// stream with a short segment before a full one: segment size 100, segments of 10 and 100 symbols
+	auto text = get_some_input({ 'A', 'C', 'G', 'T' }, 110);
+	vector<u8> stream = { (u8)NitroEncoderType::STREAM };
+	u64 segment_size = 100;
+	stream.insert(stream.end(), (u8*)&segment_size, (u8*)&segment_size + sizeof(u64));
+	for (auto piece : { std::make_pair((u64)0, (u64)10), std::make_pair((u64)10, (u64)100) }) {
+		auto enc = nitro_compress(text.get() + piece.first, piece.second, NitroEncoderType::BLOCK);
+		stream.insert(stream.end(), (u8*)&enc.len, (u8*)&enc.len + sizeof(u64));
+		stream.insert(stream.end(), enc.data, enc.data + enc.len);
+		free(enc.data);
+	}
+	stream.insert(stream.end(), sizeof(u64), 0);	// end marker
+	NitroHandle* handle = nitro_open(stream.data(), stream.size());
+	ASSERT_NE(handle, nullptr);
+	for (u64 index : { 0, 9, 10, 50, 109 })
+		ASSERT_EQ(nitro_handle_get_symbol(handle, index), text.get()[index]);
+	ASSERT_EQ(nitro_handle_get_symbol(handle, 110), -1);
+	nitro_close(handle);
+}
+TEST(NitroBuffers, compressAndDecompressInto)
+{
+	u64 len = 1500000;
+	for (u16 symcount : { 3, 256 }) {
+		auto text = get_some_input(generate_big_alphabet(symcount), len);
+		for (auto type : { NitroEncoderType::BLOCK, NitroEncoderType::BLOCK_CHUNKED, NitroEncoderType::STREAM }) {
+			u64 bound = nitro_compress_bound(len, type);
+			vector<u8> encoded(bound);
+			auto enc = nitro_compress_into(text.get(), len, type, encoded.data(), encoded.size());
+			ASSERT_EQ(enc.data, encoded.data());
+			ASSERT_LE(enc.len, bound);
+			// identical to the allocating variant
+			auto ref = nitro_compress(text.get(), len, type);
+			ASSERT_EQ(ref.len, enc.len);
+			ASSERT_EQ(memcmp(ref.data, enc.data, enc.len), 0);
+			free(ref.data);
+
+			ASSERT_EQ(nitro_decompressed_size(enc.data, enc.len), len);
+			vector<u8> decoded(len);
+			auto dec = nitro_decompress_into(enc.data, enc.len, decoded.data(), decoded.size());
+			ASSERT_EQ(dec.data, decoded.data());
+			ASSERT_EQ(dec.len, len);
+			ASSERT_EQ(memcmp(decoded.data(), text.get(), len), 0);
+		}
+	}
+}
+
+TEST(NitroBuffers, outputTooSmall)
+{
+	u64 len = 1000;
+	auto text = get_some_input({ 'A', 'C', 'G', 'T' }, len);
+	vector<u8> small(100);
+	auto enc = nitro_compress_into(text.get(), len, NitroEncoderType::BLOCK, small.data(), small.size());
+	ASSERT_EQ(enc.data, nullptr);
+
+	auto full = nitro_compress(text.get(), len, NitroEncoderType::BLOCK);
+	auto dec = nitro_decompress_into(full.data, full.len, small.data(), small.size());
+	ASSERT_EQ(dec.data, nullptr);
+	ASSERT_EQ(nitro_decompressed_size(full.data, 5), 0);
+	free(full.data);
+}
+
+TEST(NitroEntropy, roundTrip)
+{
+	for (auto type : { NitroEncoderType::RANGE, NitroEncoderType::RANS, NitroEncoderType::HUFFMAN }) {
+		for (u16 symcount : { 1, 2, 5, 60, 256 }) {
+			for (u64 len : { 1, 7, 8, 9, 100003 }) {
+				auto text = get_some_input(generate_big_alphabet(symcount), len);
+				auto enc = nitro_compress(text.get(), len, type);
+				ASSERT_NE(enc.data, nullptr);
+				ASSERT_LE(enc.len, nitro_compress_bound(len, type));
+				ASSERT_EQ(nitro_decompressed_size(enc.data, enc.len), len);
+				auto dec = nitro_decompress(enc.data, enc.len);
+				ASSERT_EQ(dec.len, len);
+				ASSERT_EQ(memcmp(dec.data, text.get(), len), 0);
+				free(enc.data);
+				free(dec.data);
+			}
+		}
+	}
+}
+
+TEST(NitroEntropy, skewedBeatsBlock)
+{
+	// DNA with skewed base frequencies and a few N runs - block encoding needs 3 bits per base
+	u64 len = 1000000;
+	vector<u8> text(len);
+	for (u64 i = 0; i < len; i++) {
+		int r = rand() % 100;
+		text[i] = r < 40 ? 'A' : r < 70 ? 'T' : r < 90 ? 'C' : 'G';
+	}
+	memset(text.data() + 1000, 'N', 500);
+	auto block = nitro_compress(text.data(), len, NitroEncoderType::BLOCK);
+	for (auto type : { NitroEncoderType::RANGE, NitroEncoderType::RANS, NitroEncoderType::HUFFMAN }) {
+		auto enc = nitro_compress(text.data(), len, type);
+		ASSERT_LT(enc.len, block.len * 3 / 4);
+		auto dec = nitro_decompress(enc.data, enc.len);
+		ASSERT_EQ(dec.len, len);
+		ASSERT_EQ(memcmp(dec.data, text.data(), len), 0);
+		free(enc.data);
+		free(dec.data);
+	}
+	free(block.data);
+}
+
+TEST(NitroEntropy, malformedInput)
+{
+	auto text = get_some_input(generate_big_alphabet(20), 10000);
+	for (auto type : { NitroEncoderType::RANGE, NitroEncoderType::RANS, NitroEncoderType::HUFFMAN }) {
+		auto enc = nitro_compress(text.get(), 10000, type);
+		auto dec = nitro_decompress(enc.data, enc.len - 1);		// truncated
+		ASSERT_EQ(dec.data, nullptr);
+		// a length the coded data can not hold is refused before allocating
+		u16 count;
+		memcpy(&count, enc.data + 1, sizeof(count));
+		u64 entry = type == NitroEncoderType::HUFFMAN ? huffman::sizeof_entry : FrequencyTable::sizeof_entry;
+		u8* length = enc.data + protocol::sizeof_encoder_type + protocol::sizeof_table_entry_size + count * entry;
+		u64 original = 10000, huge = 1ull << 40;
+		ASSERT_EQ(memcmp(length, &original, sizeof(u64)), 0);
+		memcpy(length, &huge, sizeof(u64));
+		ASSERT_EQ(nitro_decompressed_size(enc.data, enc.len), 0);
+		ASSERT_EQ(nitro_decompress(enc.data, enc.len).data, nullptr);
+		memcpy(length, &original, sizeof(u64));
+		enc.data[enc.len - 1] ^= 0x5A;		// corrupted payload
+		dec = nitro_decompress(enc.data, enc.len);
+		if (type == NitroEncoderType::RANS) {	// the final state check catches it
+			ASSERT_EQ(dec.data, nullptr);
+		}
+		free(dec.data);
+		enc.data[1] = 0;		// no frequency table entries
+		dec = nitro_decompress(enc.data, enc.len);
+		ASSERT_EQ(dec.data, nullptr);
+		free(enc.data);
+	}
+}
+
+TEST(NitroEntropy, huffmanLengthLimit)
+{
+	// Fibonacci like counts produce a degenerate tree much deeper than the limit
+	u64 counts[256] = { 0 };
+	u64 a = 1, b = 1;
+	for (unsigned sym = 0; sym < 40; sym++) {
+		counts[sym] = a;
+		u64 c = a + b;
+		a = b;
+		b = c;
+	}
+	u8 lengths[256];
+	huffman::build_lengths(counts, lengths);
+	u32 kraft = 0;
+	for (unsigned sym = 0; sym < 40; sym++) {
+		ASSERT_GE(lengths[sym], 1);
+		ASSERT_LE(lengths[sym], huffman::max_code_length);
+		kraft += huffman::table_size >> lengths[sym];
+	}
+	ASSERT_EQ(kraft, huffman::table_size);
+	ASSERT_LE(lengths[39], lengths[0]);		// frequent symbols keep the short codes
+}
+
+TEST(NitroAuto, picksTheSmallest)
+{
+	u64 len = 100000;
+	// few symbols, uniform: fixed width codes win
+	auto dna = get_some_input(generate_big_alphabet(4), len);
+	auto enc = nitro_compress(dna.get(), len, NitroEncoderType::AUTO);
+	ASSERT_EQ(enc.enctype, NitroEncoderType::BLOCK);
+	free(enc.data);
+	// all byte values: stored
+	vector<u8> noise(len);
+	for (auto& c : noise)
+		c = (u8)rand();
+	enc = nitro_compress(noise.data(), len, NitroEncoderType::AUTO);
+	ASSERT_EQ(enc.enctype, NitroEncoderType::RAW);
+	ASSERT_EQ(enc.len, len + 9);
+	free(enc.data);
+	// skewed: an entropy coder
+	vector<u8> skewed(len);
+	for (auto& c : skewed)
+		c = rand() % 10 ? 'a' : 'a' + 1 + rand() % 20;
+	enc = nitro_compress(skewed.data(), len, NitroEncoderType::AUTO);
+	ASSERT_TRUE(enc.enctype == NitroEncoderType::RANS || enc.enctype == NitroEncoderType::HUFFMAN);
+	ASSERT_LT(enc.len, len / 3);
+	free(enc.data);
+}
+
+TEST(NitroAuto, mixedChunksRoundTrip)
+{
+	// 1 MiB of DNA followed by 1 MiB of noise - every chunk gets its own type
+	u64 chunk = 1 << 20, len = 2 * chunk + 1000;
+	auto dna = get_some_input(generate_big_alphabet(4), chunk);
+	vector<u8> text(len);
+	memcpy(text.data(), dna.get(), chunk);
+	for (u64 i = chunk; i < len; i++)
+		text[i] = (u8)rand();
+	vector<u8> encoded(nitro_compress_bound(len, NitroEncoderType::AUTO));
+	auto enc = nitro_compress_into(text.data(), len, NitroEncoderType::AUTO, encoded.data(), encoded.size());
+	ASSERT_EQ(enc.enctype, NitroEncoderType::STREAM);
+	ASSERT_LT(enc.len, len - chunk / 2);
+	auto dec = nitro_decompress(enc.data, enc.len);
+	ASSERT_EQ(dec.len, len);
+	ASSERT_EQ(memcmp(dec.data, text.data(), len), 0);
+	free(dec.data);
+	// block and raw segments stay randomly accessible
+	NitroHandle* handle = nitro_open(enc.data, enc.len);
+	ASSERT_NE(handle, nullptr);
+	for (u64 index : { (u64)0, chunk - 1, chunk, len - 1 })
+		ASSERT_EQ(nitro_handle_get_symbol(handle, index), text[index]);
+	nitro_close(handle);
+}
+
+TEST(NitroRle, runsShrink)
+{
+	// bases with homopolymers and long N runs, a run at both ends
+	vector<u8> text;
+	for (int i = 0; i < 2000; i++) {
+		int r = rand() % 100;
+		u64 n = r < 3 ? 1000 + rand() % 5000 : r < 10 ? 16 + rand() % 20 : 1 + rand() % 15;
+		u8 sym = r < 3 ? 'N' : "ACGT"[rand() % 4];
+		text.insert(text.end(), n, sym);
+	}
+	text.insert(text.end(), 40, 'A');
+	u64 len = text.size();
+	auto block = nitro_compress(text.data(), len, NitroEncoderType::BLOCK);
+	auto enc = nitro_compress(text.data(), len, NitroEncoderType::RLE);
+	ASSERT_NE(enc.data, nullptr);
+	ASSERT_LT(enc.len, block.len / 4);
+	ASSERT_LE(enc.len, nitro_compress_bound(len, NitroEncoderType::RLE));
+	ASSERT_EQ(nitro_decompressed_size(enc.data, enc.len), len);
+	auto dec = nitro_decompress(enc.data, enc.len);
+	ASSERT_EQ(dec.len, len);
+	ASSERT_EQ(memcmp(dec.data, text.data(), len), 0);
+	free(dec.data);
+	free(block.data);
+
+	// the run list does not add up to the stored length
+	u64 wrong_len = len + 1;
+	memcpy(enc.data + 1, &wrong_len, sizeof(wrong_len));
+	dec = nitro_decompress(enc.data, enc.len);
+	ASSERT_EQ(dec.data, nullptr);
+	// refused from the metadata, before allocating
+	wrong_len = 1ull << 40;
+	memcpy(enc.data + 1, &wrong_len, sizeof(wrong_len));
+	ASSERT_EQ(nitro_decompressed_size(enc.data, enc.len), 0);
+	ASSERT_EQ(nitro_decompress(enc.data, enc.len).data, nullptr);
+	free(enc.data);
+
+	// no runs at all
+	auto plain = get_some_input(generate_big_alphabet(200), 5000);
+	enc = nitro_compress(plain.get(), 5000, NitroEncoderType::RLE);
+	dec = nitro_decompress(enc.data, enc.len);
+	ASSERT_EQ(dec.len, 5000);
+	ASSERT_EQ(memcmp(dec.data, plain.get(), 5000), 0);
+	free(enc.data);
+	free(dec.data);
+}
+
+TEST(NitroDna, basesAndExceptions)
+{
+	// bases with N blocks and scattered IUPAC codes, exceptions at both ends
+	u64 len = 3 * (1 << 20) + 77;
+	auto bases = get_some_input({ 'A', 'C', 'G', 'T' }, len);
+	vector<u8> text(bases.get(), bases.get() + len);
+	for (int i = 0; i < 20; i++)
+		memset(text.data() + rand() % (len - 5000), 'N', rand() % 5000);
+	for (int i = 0; i < 500; i++)
+		text[rand() % len] = "RYKMSWn"[rand() % 7];
+	text[0] = 'N';
+	text[len - 1] = 'Y';
+	auto block = nitro_compress(text.data(), len, NitroEncoderType::BLOCK);
+	auto enc = nitro_compress(text.data(), len, NitroEncoderType::DNA);
+	ASSERT_EQ(enc.enctype, NitroEncoderType::DNA);
+	ASSERT_LT(enc.len, block.len * 3 / 4);
+	ASSERT_LE(enc.len, nitro_compress_bound(len, NitroEncoderType::DNA));
+	auto dec = nitro_decompress(enc.data, enc.len);
+	ASSERT_EQ(dec.len, len);
+	ASSERT_EQ(memcmp(dec.data, text.data(), len), 0);
+	free(dec.data);
+	free(block.data);
+
+	// packed bases and exceptions through the random access handle
+	NitroHandle* handle = nitro_open(enc.data, enc.len);
+	ASSERT_NE(handle, nullptr);
+	for (int i = 0; i < 10000; i++) {
+		u64 index = rand() % len;
+		ASSERT_EQ(nitro_handle_get_symbol(handle, index), text[index]);
+	}
+	ASSERT_EQ(nitro_handle_get_symbol(handle, len - 1), 'Y');
+	vector<u8> window(20000);
+	for (int i = 0; i < 100; i++) {
+		u64 count = rand() % window.size();
+		u64 offset = rand() % (len - count);
+		ASSERT_EQ(nitro_handle_get_range(handle, offset, count, window.data()), count);
+		ASSERT_EQ(memcmp(window.data(), text.data() + offset, count), 0);
+	}
+	nitro_close(handle);
+
+	// the exception list runs past the sequence
+	enc.data[enc.len - 2] = 0x7F;
+	ASSERT_EQ(nitro_decompress(enc.data, enc.len).data, nullptr);
+	free(enc.data);
+
+	// the AVX2 packer and the scalar one write the same bits
+	vector<u8> simd(bitpack::packed_size(2, len)), scalar(simd.size());
+	vector<dna::Run> simd_runs, scalar_runs;
+	dna::pack(text.data(), len, simd.data(), simd_runs);
+	dna::pack_scalar(text.data(), 0, len, scalar.data(), scalar_runs);
+	ASSERT_EQ(simd, scalar);
+	ASSERT_EQ(simd_runs.size(), scalar_runs.size());
+
+	// AUTO never does worse than DNA on bases with a few scattered exceptions
+	for (int i = 0; i < 100; i++)
+		bases.get()[rand() % 100000] = 'N';
+	enc = nitro_compress(bases.get(), 100000, NitroEncoderType::DNA);
+	auto best = nitro_compress(bases.get(), 100000, NitroEncoderType::AUTO);
+	ASSERT_LE(best.len, enc.len);
+	free(enc.data);
+	free(best.data);
+}
+
+TEST(NitroLz, repeatsShrink)
+{
+	// log like lines: a few templates with varying numbers, runs with short offsets, random tails
+	string text;
+	const char* templates[] = { "GET /api/v1/items/%d HTTP/1.1 200 %d\n", "worker %d: flushed %d records\n",
+								"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa%d%d\n", "abcabcabcabcabcabcab%d%d\n" };
+	char line[128];
+	for (int i = 0; i < 40000; i++) {
+		snprintf(line, sizeof(line), templates[rand() % 4], rand() % 1000, rand() % 50);
+		text += line;
+	}
+	const u8* input = reinterpret_cast<const u8*>(text.data());
+	u64 len = text.size();
+	auto block = nitro_compress(input, len, NitroEncoderType::BLOCK);
+	u64 previous = len;
+	for (int level : { 1, 3, 6, 9 }) {
+		ASSERT_EQ(nitro_set_option(NITRO_OPTION_LZ_LEVEL, level), level == 1 ? 6 : level == 3 ? 1 : level == 6 ? 3 : 6);
+		auto enc = nitro_compress(input, len, NitroEncoderType::LZ);
+		ASSERT_NE(enc.data, nullptr);
+		ASSERT_LT(enc.len, block.len / 2);
+		ASSERT_LE(enc.len, previous + previous / 50);	// more effort, (about) smaller output
+		previous = enc.len;
+		auto dec = nitro_decompress(enc.data, enc.len);
+		ASSERT_EQ(dec.len, len);
+		ASSERT_EQ(memcmp(dec.data, input, len), 0);
+		free(dec.data);
+		if (level == 9) {
+			// a match reaching back before the start of the output
+			enc.data[lz::sizeof_header] = 0x01;
+			dec = nitro_decompress(enc.data, enc.len);
+			ASSERT_EQ(dec.data, nullptr);
+		}
+		free(enc.data);
+	}
+	ASSERT_EQ(nitro_set_option(NITRO_OPTION_LZ_LEVEL, 0), -1);
+	ASSERT_EQ(nitro_set_option(NITRO_OPTION_LZ_LEVEL, lz::default_level), 9);
+	free(block.data);
+
+	// a caller buffer of exactly the encoded size is enough, one byte less is not
+	auto ref = nitro_compress(input, len, NitroEncoderType::LZ);
+	vector<u8> exact(ref.len);
+	auto into = nitro_compress_into(input, len, NitroEncoderType::LZ, exact.data(), exact.size());
+	ASSERT_EQ(into.data, exact.data());
+	ASSERT_EQ(into.len, ref.len);
+	ASSERT_EQ(memcmp(exact.data(), ref.data, ref.len), 0);
+	ASSERT_EQ(nitro_compress_into(input, len, NitroEncoderType::LZ, exact.data(), exact.size() - 1).data, nullptr);
+	free(ref.data);
+
+	// incompressible and tiny inputs stay within the bound
+	for (u64 n : { 1, 3, 4, 5, 17, 100000 }) {
+		auto random = get_some_input(generate_big_alphabet(256), n);
+		auto enc = nitro_compress(random.get(), n, NitroEncoderType::LZ);
+		ASSERT_LE(enc.len, nitro_compress_bound(n, NitroEncoderType::LZ));
+		auto dec = nitro_decompress(enc.data, enc.len);
+		ASSERT_EQ(dec.len, n);
+		ASSERT_EQ(memcmp(dec.data, random.get(), n), 0);
+		free(enc.data);
+		free(dec.data);
+	}
+}
+
+TEST(NitroContext, sharedTableMessages)
+{
+	// many short messages over one alphabet
+	auto alphabet = generate_regular_alphabet(20);
+	u64 len = 200;
+	NitroContext* encoder = nitro_context_create();
+	NitroContext* decoder = nitro_context_create();
+	ASSERT_NE(encoder, nullptr);
+	auto sample = get_some_input(alphabet, 10000);
+	u32 id = nitro_context_prime(encoder, sample.get(), 10000);
+	ASSERT_NE(id, 0u);
+	ASSERT_EQ(nitro_context_prime(decoder, alphabet.data(), alphabet.size()), id);	// same symbols, same table
+	for (int i = 0; i < 100; i++) {
+		auto text = get_some_input(alphabet, len);
+		auto block = nitro_compress(text.get(), len, NitroEncoderType::BLOCK);
+		auto enc = nitro_context_compress(encoder, text.get(), len);
+		ASSERT_EQ(enc.enctype, NitroEncoderType::SHARED);
+		ASSERT_LE(enc.len + 11 + 2 * 16, block.len);
+		auto dec = nitro_context_decompress(decoder, enc.data, enc.len);
+		ASSERT_EQ(dec.len, len);
+		ASSERT_EQ(memcmp(dec.data, text.get(), len), 0);
+		free(block.data);
+	}
+
+	// a symbol outside the table: ordinary BLOCK frame, any context decodes it
+	vector<u8> other(len, alphabet[0]);
+	other[7] = '#';
+	auto enc = nitro_context_compress(encoder, other.data(), other.size());
+	ASSERT_EQ(enc.enctype, NitroEncoderType::BLOCK);
+	auto dec = nitro_decompress(enc.data, enc.len);
+	ASSERT_EQ(memcmp(dec.data, other.data(), len), 0);
+	free(dec.data);
+
+	// SHARED frames need the table: not without a context, not with a different table
+	enc = nitro_context_compress(encoder, sample.get(), len);
+	ASSERT_EQ(nitro_decompress(enc.data, enc.len).data, nullptr);
+	ASSERT_EQ(nitro_decompressed_size(enc.data, enc.len), len);
+	nitro_context_prime(decoder, other.data(), other.size());
+	ASSERT_EQ(nitro_context_decompress(decoder, enc.data, enc.len).data, nullptr);
+
+	// a context without the table or dictionary refuses the frame before sizing its scratch buffer
+	NitroContext* empty = nitro_context_create();
+	for (auto type : { NitroEncoderType::SHARED, NitroEncoderType::DICT }) {
+		u8 frame[16] = { (u8)type, 1, 2, 3, 4 };
+		u8* end = varint::write(frame + 5, 1ull << 40);
+		if (type == NitroEncoderType::SHARED) {		// unchecked without the table
+			ASSERT_EQ(nitro_decompressed_size(frame, end - frame), 1ull << 40);
+		}
+		ASSERT_EQ(nitro_context_decompress(empty, frame, end - frame).data, nullptr);
+	}
+	nitro_context_free(empty);
+	nitro_context_free(encoder);
+	nitro_context_free(decoder);
+}
+
+TEST(NitroContext, dictionaryRecords)
+{
+	// small JSON events: the same keys and boilerplate, varying values
+	auto record = []() {
+		static const char* levels[] = { "debug", "info", "warning", "error" };
+		char line[256];
+		snprintf(line, sizeof(line), "{\"timestamp\":\"2024-05-%02dT%02d:%02d:%02dZ\",\"level\":\"%s\",\"service\":\"checkout\","
+			"\"message\":\"request completed\",\"duration_ms\":%d,\"user_id\":%d}",
+			rand() % 28 + 1, rand() % 24, rand() % 60, rand() % 60, levels[rand() % 4], rand() % 5000, rand());
+		return string(line);
+	};
+	vector<string> samples;
+	for (int i = 0; i < 500; i++)
+		samples.push_back(record());
+	vector<NitroBuffer> buffers;
+	for (const auto& s : samples)
+		buffers.push_back(NitroBuffer{ reinterpret_cast<const u8*>(s.data()), s.size() });
+	auto dict = nitro_train_dictionary(buffers.data(), buffers.size(), 4096);
+	ASSERT_NE(dict.data, nullptr);
+	ASSERT_LE(dict.len, 4096 + dictionary::sizeof_header);
+
+	NitroContext* encoder = nitro_context_create();
+	NitroContext* decoder = nitro_context_create();
+	u32 id = nitro_context_load_dictionary(encoder, dict.data, dict.len);
+	ASSERT_NE(id, 0u);
+	ASSERT_EQ(nitro_context_load_dictionary(decoder, dict.data, dict.len), id);
+	u64 total = 0, total_lz = 0;
+	for (int i = 0; i < 100; i++) {
+		string text = record();
+		const u8* input = reinterpret_cast<const u8*>(text.data());
+		auto lz = nitro_compress(input, text.size(), NitroEncoderType::LZ);
+		auto enc = nitro_context_compress(encoder, input, text.size());
+		ASSERT_EQ(enc.enctype, NitroEncoderType::DICT);
+		ASSERT_LE(enc.len, nitro_compress_bound(text.size(), NitroEncoderType::DICT));
+		total += enc.len;
+		total_lz += lz.len;
+		auto dec = nitro_context_decompress(decoder, enc.data, enc.len);
+		ASSERT_EQ(dec.len, text.size());
+		ASSERT_EQ(memcmp(dec.data, input, text.size()), 0);
+		free(lz.data);
+	}
+	ASSERT_LT(total, total_lz / 2);
+
+	// DICT frames need the same dictionary
+	string text = record();
+	auto enc = nitro_context_compress(encoder, reinterpret_cast<const u8*>(text.data()), text.size());
+	ASSERT_EQ(nitro_decompress(enc.data, enc.len).data, nullptr);
+	ASSERT_EQ(nitro_decompressed_size(enc.data, enc.len), text.size());
+	auto other = nitro_train_dictionary(buffers.data(), buffers.size() / 2, 1024);
+	ASSERT_NE(nitro_context_load_dictionary(decoder, other.data, other.len), id);
+	ASSERT_EQ(nitro_context_decompress(decoder, enc.data, enc.len).data, nullptr);
+	dict.data[dictionary::sizeof_header] ^= 1;
+	ASSERT_EQ(nitro_context_load_dictionary(decoder, dict.data, dict.len), 0u);
+
+	// nothing in common
+	vector<u8> a(100, 'a'), b(100, 'b');
+	NitroBuffer unrelated[] = { { a.data(), a.size() }, { b.data(), b.size() } };
+	ASSERT_EQ(nitro_train_dictionary(unrelated, 2, 0).data, nullptr);
+	free(dict.data);
+	free(other.data);
+	nitro_context_free(encoder);
+	nitro_context_free(decoder);
+}
+
+TEST(NitroBatch, roundTrip)
+{
+	// items of very different sizes, each with its own alphabet
+	vector<unique_ptr<u8>> texts;
+	vector<NitroBuffer> items;
+	for (u64 i = 0; i < 300; i++) {
+		u64 len = i % 50 == 0 ? 100000 + rand() % 100000 : 1 + rand() % 500;
+		texts.push_back(get_some_input(generate_big_alphabet(1 + i % 40), len));
+		items.push_back(NitroBuffer{ texts.back().get(), len });
+	}
+	for (auto type : { NitroEncoderType::BLOCK, NitroEncoderType::AUTO }) {
+		auto enc = nitro_compress_batch(items.data(), items.size(), type, 4);
+		ASSERT_NE(enc.arena, nullptr);
+		ASSERT_EQ(enc.count, items.size());
+		vector<NitroBuffer> encoded;
+		for (u64 i = 0; i < enc.count; i++) {
+			auto single = nitro_compress(items[i].data, items[i].len, type);
+			ASSERT_EQ(enc.offsets[i + 1] - enc.offsets[i], single.len);	// same frames as one by one
+			ASSERT_EQ(memcmp(enc.arena + enc.offsets[i], single.data, single.len), 0);
+			free(single.data);
+			encoded.push_back(NitroBuffer{ enc.arena + enc.offsets[i], enc.offsets[i + 1] - enc.offsets[i] });
+		}
+		auto dec = nitro_decompress_batch(encoded.data(), encoded.size(), 0);
+		ASSERT_NE(dec.arena, nullptr);
+		for (u64 i = 0; i < dec.count; i++) {
+			ASSERT_EQ(dec.offsets[i + 1] - dec.offsets[i], items[i].len);
+			ASSERT_EQ(memcmp(dec.arena + dec.offsets[i], items[i].data, items[i].len), 0);
+		}
+		nitro_batch_free(&dec);
+		ASSERT_EQ(dec.arena, nullptr);
+
+		// one bad item fails the batch
+		encoded[17].len = 3;
+		dec = nitro_decompress_batch(encoded.data(), encoded.size(), 0);
+		ASSERT_EQ(dec.arena, nullptr);
+		nitro_batch_free(&enc);
+	}
+	items[5].len = 0;
+	ASSERT_EQ(nitro_compress_batch(items.data(), items.size(), NitroEncoderType::BLOCK, 0).arena, nullptr);
+}
+
+TEST(NitroStats, stagesRecorded)
+{
+	u64 len = 1 << 20;
+	auto text = get_some_input({'A', 'C', 'G', 'T'}, len);
+	NitroStats stats;
+	ASSERT_EQ(nitro_set_option(NITRO_OPTION_STATS, 0), 0);
+	ASSERT_EQ(nitro_get_last_stats(&stats), 0);
+	ASSERT_EQ(nitro_set_option(NITRO_OPTION_STATS, 1), 0);
+
+	auto enc = nitro_compress(text.get(), len, NitroEncoderType::BLOCK);
+	ASSERT_EQ(nitro_get_last_stats(&stats), 1);
+	ASSERT_EQ(stats.bytes_in, len);
+	ASSERT_EQ(stats.bytes_out, enc.len);
+	ASSERT_EQ(stats.bits_per_block, 2u);
+	ASSERT_EQ(stats.allocations, 1u);
+	ASSERT_GT(stats.code_ns, 0u);
+	ASSERT_GE(stats.total_ns, stats.model_ns + stats.alloc_ns + stats.header_ns + stats.code_ns);
+
+	auto dec = nitro_decompress(enc.data, enc.len);
+	ASSERT_EQ(nitro_get_last_stats(&stats), 1);
+	ASSERT_EQ(stats.bytes_in, enc.len);
+	ASSERT_EQ(stats.bytes_out, len);
+	ASSERT_EQ(stats.allocations, 1u);
+	ASSERT_GT(stats.code_ns, 0u);
+	free(dec.data);
+	free(enc.data);
+	ASSERT_EQ(nitro_set_option(NITRO_OPTION_STATS, 0), 1);
+	ASSERT_EQ(nitro_set_option((NitroOption)12345, 1), -1);
+}
+
+TEST(NitroDecode, parallelBlockSlices)
+{
+	// existing single BLOCK frames decode in slices, every width and a partial last slice
+	for (unsigned symbols : { 1u, 2u, 5u, 17u, 200u }) {
+		u64 len = 2 * protocol::default_chunk_size + 8 * symbols + 3;
+		auto text = get_some_input(generate_big_alphabet(symbols), len);
+		auto enc = nitro_compress(text.get(), len, NitroEncoderType::BLOCK);
+		for (unsigned threads : { 1u, 3u, 0u }) {
+			auto dec = nitro_decompress_mt(enc.data, enc.len, threads);
+			ASSERT_EQ(dec.len, len);
+			ASSERT_EQ(memcmp(dec.data, text.get(), len), 0);
+			free(dec.data);
+		}
+		free(enc.data);
+	}
+}
+
+TEST(NitroChecksum, crc32c)
+{
+	// known answer of the Castagnoli polynomial, both code paths
+	const u8* text = reinterpret_cast<const u8*>("123456789");
+	ASSERT_EQ(crc32c::extend(0, text, 9), 0xE3069283u);
+	ASSERT_EQ(~crc32c::update_scalar(~0u, text, 9), 0xE3069283u);
+	ASSERT_EQ(crc32c::extend(crc32c::extend(0, text, 4), text + 4, 5), 0xE3069283u);
+}
+
+TEST(NitroChecksum, corruptChunkDetected)
+{
+	u64 len = 3 * protocol::default_chunk_size + 12345;
+	auto text = get_some_input({'A', 'C', 'G', 'T', 'N'}, len);
+	for (auto type : { NitroEncoderType::BLOCK, NitroEncoderType::BLOCK_CHUNKED }) {
+		auto plain = nitro_compress(text.get(), len, type);
+		ASSERT_EQ(nitro_set_option(NITRO_OPTION_CHECKSUM, 1), 0);
+		auto enc = nitro_compress_mt(text.get(), len, type, 4);
+		ASSERT_EQ(nitro_set_option(NITRO_OPTION_CHECKSUM, 0), 1);
+		ASSERT_EQ(enc.len, plain.len + 4 * sizeof(u32));		// one CRC per chunk
+		ASSERT_LE(enc.len, nitro_compress_bound(len, type));
+		free(plain.data);
+
+		auto dec = nitro_decompress_mt(enc.data, enc.len, 4);
+		ASSERT_EQ(dec.len, len);
+		ASSERT_EQ(memcmp(dec.data, text.get(), len), 0);
+		free(dec.data);
+
+		// a flipped bit in the third chunk decodes to the right length but fails the check
+		enc.data[enc.len - bitpack::packed_size(3, len - 2 * protocol::default_chunk_size) + 100] ^= 0x10;
+		dec = nitro_decompress_mt(enc.data, enc.len, 4);
+		ASSERT_EQ(dec.data, nullptr);
+		enc.data[enc.len - bitpack::packed_size(3, len - 2 * protocol::default_chunk_size) + 100] ^= 0x10;
+		// so does a corrupted symbol (the header is covered by every chunk)
+		enc.data[4] ^= 1;
+		dec = nitro_decompress(enc.data, enc.len);
+		ASSERT_EQ(dec.data, nullptr);
+		free(enc.data);
+	}
+}
+
+TEST(NitroChecksum, streamRoundTrip)
+{
+	// every segment carries its checksums, the bound has to count them
+	u64 len = 3 * protocol::default_chunk_size;
+	auto text = get_some_input(generate_big_alphabet(256), len);
+	ASSERT_EQ(nitro_set_option(NITRO_OPTION_CHECKSUM, 1), 0);
+	auto enc = nitro_compress(text.get(), len, NitroEncoderType::STREAM);
+	ASSERT_EQ(nitro_set_option(NITRO_OPTION_CHECKSUM, 0), 1);
+	ASSERT_GT(enc.len, 0);
+	ASSERT_LE(enc.len, nitro_compress_bound(len, NitroEncoderType::STREAM));
+
+	auto dec = nitro_decompress(enc.data, enc.len);
+	ASSERT_EQ(dec.len, len);
+	ASSERT_EQ(memcmp(dec.data, text.get(), len), 0);
+	free(dec.data);
+	free(enc.data);
+}
 
 TEST(NitroDecode, nullPtrPassed)
 {